@@ -0,0 +1,374 @@
+/* ------------------------------------------------------------ *
+ * file:        archive_lsm303d.c                               *
+ * purpose:     Delta compressed sample archive for long-term   *
+ *              capture. Samples of a mostly stationary sensor  *
+ *              differ by a few LSB, so each block stores one   *
+ *              keyframe and then zigzag varint deltas, about   *
+ *              8 bytes per sample instead of 24 raw or 40 as   *
+ *              struct lsm303dsample. Blocks are written whole, *
+ *              one 4 KB write per ~500 samples, and a block    *
+ *              index at the end allows seeking by sample.      *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lsm303d.h"
+
+#define ZHDR sizeof(struct lsm303d_zblock)
+
+_Static_assert(sizeof(struct lsm303d_zblock) == 32, "block header is 32 bytes");
+
+/* ------------------------------------------------------------ *
+ * Zigzag maps signed to unsigned so small magnitudes of either *
+ * sign become small numbers: 0, -1, 1, -2 ... -> 0, 1, 2, 3 .. *
+ * Varints store 7 bits per byte, the MSB flags a next byte.    *
+ * ------------------------------------------------------------ */
+static inline uint64_t zigzag(int64_t v) {
+   return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t u) {
+   return (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t u) {
+   while(u >= 0x80) {
+      *p++ = (uint8_t) u | 0x80;
+      u >>= 7;
+   }
+   *p++ = (uint8_t) u;
+   return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *u) {
+   uint64_t v = 0;
+   for(int shift=0; p < end && shift < 64; shift += 7) {
+      uint8_t b = *p++;
+      v |= (uint64_t) (b & 0x7F) << shift;
+      if(!(b & 0x80)) {
+         *u = v;
+         return p;
+      }
+   }
+   return NULL;        // truncated or corrupt block
+}
+
+/* ------------------------------------------------------------ *
+ * zlog_flush() writes the current block in one write() call,   *
+ * and adds it to the block index. Returns 0 or -1 on error.    *
+ * ------------------------------------------------------------ */
+static int zlog_flush(struct lsm303d_zlog *z) {
+   struct lsm303d_zblock *blk = (struct lsm303d_zblock *) z->buf;
+   if(blk->n == 0) return(0);
+   blk->size = z->used;
+
+   if(z->blocks == z->maxblocks) {
+      uint32_t max = z->maxblocks ? 2 * z->maxblocks : 256;
+      struct lsm303d_zindex *idx = realloc(z->index, max * sizeof(struct lsm303d_zindex));
+      if(idx == NULL) {
+         printf("Error: could not grow the archive block index.\n");
+         return(-1);
+      }
+      z->index = idx;
+      z->maxblocks = max;
+   }
+   z->index[z->blocks].offset = z->offset;
+   z->index[z->blocks].first  = z->hdr.count - blk->n;
+   z->index[z->blocks].ts0    = blk->ts0;
+
+   size_t len = ZHDR + z->used;
+   if(write(z->fd, z->buf, len) != len) {
+      printf("Error: archive block write failure at offset %llu\n", (unsigned long long) z->offset);
+      return(-1);
+   }
+   z->offset += len;
+   z->blocks++;
+   blk->n = 0;
+   z->used = 0;
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * zlog_create() starts a new archive in file, with the header  *
+ * of log_header() and period, the sample period in ns.         *
+ * Returns 0 on success, -1 on error.                           *
+ * ------------------------------------------------------------ */
+int zlog_create(struct lsm303d_zlog *z, const char *file, uint64_t period) {
+   memset(z, 0, sizeof(struct lsm303d_zlog));
+   log_header(&z->hdr, period);
+   z->hdr.flags = LSM303D_LOG_DELTA;
+
+   z->fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if(z->fd < 0) {
+      printf("Error: could not create sample archive %s\n", file);
+      return(-1);
+   }
+   if(write(z->fd, &z->hdr, sizeof(z->hdr)) != sizeof(z->hdr)) {
+      printf("Error: could not write the archive header.\n");
+      close(z->fd);
+      return(-1);
+   }
+   z->offset = sizeof(z->hdr);
+   if(verbose == 1) printf("Debug: Sample archive [%s] created, %d byte blocks\n",
+                            file, LSM303D_ZBLOCK);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * zlog_append() encodes one sample into the current block. It  *
+ * only makes a system call when a block is full. Returns 0 on  *
+ * success, -1 on error.                                        *
+ * ------------------------------------------------------------ */
+int zlog_append(struct lsm303d_zlog *z, const struct lsm303draw *raw) {
+   struct lsm303d_zblock *blk = (struct lsm303d_zblock *) z->buf;
+   int64_t us = raw->ts / 1000;
+
+   if(blk->n > 0 && (z->used + LSM303D_ZSAMPLE_MAX > LSM303D_ZBLOCK - ZHDR || blk->n == UINT16_MAX))
+      if(zlog_flush(z) != 0) return(-1);
+
+   if(blk->n == 0) {                     // keyframe
+      blk->magic = LSM303D_ZBLOCK_MAGIC;
+      blk->ts0   = raw->ts;
+      for(int i=0; i<3; i++) {
+         blk->key[i]     = raw->mag[i];
+         blk->key[3 + i] = raw->acc[i];
+      }
+      blk->key[6]   = raw->temp;
+      blk->status_m = raw->status_m;
+      blk->status_a = raw->status_a;
+   }
+   else {
+      const struct lsm303draw *p = &z->prev;
+      uint8_t *o = z->buf + ZHDR + z->used;
+      int chg = raw->temp != p->temp || raw->status_m != p->status_m
+                || raw->status_a != p->status_a;
+      int64_t jitter = us - z->prev_us - (int64_t) (z->hdr.period / 1000);
+      o = put_varint(o, zigzag(jitter) << 1 | chg);
+      for(int i=0; i<3; i++) o = put_varint(o, zigzag(raw->mag[i] - p->mag[i]));
+      for(int i=0; i<3; i++) o = put_varint(o, zigzag(raw->acc[i] - p->acc[i]));
+      if(chg) {
+         o = put_varint(o, zigzag(raw->temp - p->temp));
+         *o++ = raw->status_m;
+         *o++ = raw->status_a;
+      }
+      z->used = o - (z->buf + ZHDR);
+   }
+   z->prev = *raw;
+   z->prev_us = us;
+   blk->n++;
+   z->hdr.count++;
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * zlog_decode() decodes the next sample of the current block   *
+ * into raw and z->prev. Returns 0, or -1 on a corrupt block.   *
+ * ------------------------------------------------------------ */
+static int zlog_decode(struct lsm303d_zlog *z, struct lsm303draw *raw) {
+   const struct lsm303d_zblock *blk =
+      (const struct lsm303d_zblock *) (z->map + z->index[z->cur].offset);
+   struct lsm303draw *p = &z->prev;
+
+   if(z->pos == 0 && z->left == blk->n) {  // keyframe
+      memset(p, 0, sizeof(struct lsm303draw));
+      p->ts = blk->ts0;
+      for(int i=0; i<3; i++) {
+         p->mag[i] = blk->key[i];
+         p->acc[i] = blk->key[3 + i];
+      }
+      p->temp     = blk->key[6];
+      p->status_m = blk->status_m;
+      p->status_a = blk->status_a;
+      z->prev_us  = blk->ts0 / 1000;
+   }
+   else {
+      const uint8_t *in  = (const uint8_t *) blk + ZHDR + z->pos;
+      const uint8_t *end = (const uint8_t *) blk + ZHDR + blk->size;
+      uint64_t u, v[6];
+      if((in = get_varint(in, end, &u)) == NULL) return(-1);
+      for(int i=0; i<6; i++)
+         if((in = get_varint(in, end, &v[i])) == NULL) return(-1);
+      z->prev_us += unzigzag(u >> 1) + (int64_t) (z->hdr.period / 1000);
+      p->ts = z->prev_us * 1000;
+      for(int i=0; i<3; i++) {
+         p->mag[i] += unzigzag(v[i]);
+         p->acc[i] += unzigzag(v[3 + i]);
+      }
+      if(u & 1) {
+         if((in = get_varint(in, end, &u)) == NULL || in + 2 > end) return(-1);
+         p->temp += unzigzag(u);
+         p->status_m = *in++;
+         p->status_a = *in++;
+      }
+      z->pos = in - ((const uint8_t *) blk + ZHDR);
+   }
+   z->left--;
+   *raw = *p;
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * zlog_scan() rebuilds the block index of an archive without   *
+ * a trailer, e.g. after a crash, by following the block chain  *
+ * up to the first incomplete block.                            *
+ * ------------------------------------------------------------ */
+static int zlog_scan(struct lsm303d_zlog *z) {
+   uint64_t off = sizeof(struct lsm303d_loghdr), first = 0;
+   while(off + ZHDR <= z->mapsize) {
+      const struct lsm303d_zblock *blk = (const struct lsm303d_zblock *) (z->map + off);
+      if(blk->magic != LSM303D_ZBLOCK_MAGIC || off + ZHDR + blk->size > z->mapsize) break;
+      if(z->blocks == z->maxblocks) {
+         uint32_t max = z->maxblocks ? 2 * z->maxblocks : 256;
+         struct lsm303d_zindex *idx = realloc(z->index, max * sizeof(struct lsm303d_zindex));
+         if(idx == NULL) return(-1);
+         z->index = idx;
+         z->maxblocks = max;
+      }
+      z->index[z->blocks].offset = off;
+      z->index[z->blocks].first  = first;
+      z->index[z->blocks].ts0    = blk->ts0;
+      z->blocks++;
+      first += blk->n;
+      off += ZHDR + blk->size;
+   }
+   z->hdr.count = first;
+   if(verbose == 1) printf("Debug: Archive without index, %u blocks found\n", z->blocks);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * zlog_open() maps an archive read-only and loads its block    *
+ * index, or rebuilds it. Returns 0 on success, -1 on error.    *
+ * ------------------------------------------------------------ */
+int zlog_open(struct lsm303d_zlog *z, const char *file) {
+   struct stat st;
+   memset(z, 0, sizeof(struct lsm303d_zlog));
+   z->rdonly = 1;
+
+   z->fd = open(file, O_RDONLY);
+   if(z->fd < 0 || fstat(z->fd, &st) != 0 || st.st_size < sizeof(struct lsm303d_loghdr)) {
+      printf("Error: could not open sample archive %s\n", file);
+      if(z->fd >= 0) close(z->fd);
+      return(-1);
+   }
+   z->mapsize = st.st_size;
+   z->map = mmap(NULL, z->mapsize, PROT_READ, MAP_SHARED, z->fd, 0);
+   if(z->map == MAP_FAILED) {
+      printf("Error: could not map sample archive %s\n", file);
+      close(z->fd);
+      return(-1);
+   }
+   memcpy(&z->hdr, z->map, sizeof(z->hdr));
+   if(z->hdr.magic != LSM303D_LOG_MAGIC || z->hdr.version != LSM303D_LOG_VERSION
+      || !(z->hdr.flags & LSM303D_LOG_DELTA)) {
+      printf("Error: %s is not a version %d sample archive.\n", file, LSM303D_LOG_VERSION);
+      zlog_close(z);
+      return(-1);
+   }
+
+   /* ------------------------------------------------ */
+   /* a complete archive ends with index and trailer   */
+   /* ------------------------------------------------ */
+   const struct lsm303d_ztrailer *tr = (const struct lsm303d_ztrailer *)
+      (z->map + z->mapsize - sizeof(struct lsm303d_ztrailer));
+   if(z->mapsize >= sizeof(z->hdr) + sizeof(*tr) && tr->magic == LSM303D_ZINDEX_MAGIC
+      && tr->index + (uint64_t) tr->blocks * sizeof(struct lsm303d_zindex) + sizeof(*tr) == z->mapsize) {
+      z->blocks = z->maxblocks = tr->blocks;
+      z->index = malloc((tr->blocks ? tr->blocks : 1) * sizeof(struct lsm303d_zindex));
+      if(z->index == NULL) {
+         zlog_close(z);
+         return(-1);
+      }
+      memcpy(z->index, z->map + tr->index, tr->blocks * sizeof(struct lsm303d_zindex));
+   }
+   else if(zlog_scan(z) != 0) {
+      zlog_close(z);
+      return(-1);
+   }
+   return zlog_seek(z, 0);
+}
+
+/* ------------------------------------------------------------ *
+ * zlog_seek() positions the reader at sample n: a binary       *
+ * search in the block index, then decoding from the keyframe.  *
+ * Returns 0 on success, -1 if n is past the end.               *
+ * ------------------------------------------------------------ */
+int zlog_seek(struct lsm303d_zlog *z, uint64_t n) {
+   if(n >= z->hdr.count) {
+      z->cur = z->blocks;
+      z->left = 0;
+      return(n == 0 ? 0 : -1);
+   }
+   uint32_t lo = 0, hi = z->blocks - 1;
+   while(lo < hi) {
+      uint32_t mid = (lo + hi + 1) / 2;
+      if(z->index[mid].first <= n) lo = mid;
+      else hi = mid - 1;
+   }
+   const struct lsm303d_zblock *blk =
+      (const struct lsm303d_zblock *) (z->map + z->index[lo].offset);
+   z->cur  = lo;
+   z->pos  = 0;
+   z->left = blk->n;
+
+   struct lsm303draw raw;
+   for(uint64_t i = z->index[lo].first; i < n; i++)
+      if(zlog_decode(z, &raw) != 0) return(-1);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * zlog_next() decodes the next sample into raw. Returns 0, or  *
+ * -1 at the end of the archive or on a corrupt block.          *
+ * ------------------------------------------------------------ */
+int zlog_next(struct lsm303d_zlog *z, struct lsm303draw *raw) {
+   while(z->left == 0) {
+      if(z->cur + 1 >= z->blocks) return(-1);
+      z->cur++;
+      z->pos  = 0;
+      z->left = ((const struct lsm303d_zblock *) (z->map + z->index[z->cur].offset))->n;
+   }
+   if(zlog_decode(z, raw) != 0) {
+      printf("Error: corrupt archive block %u\n", z->cur);
+      return(-1);
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * zlog_close() completes a written archive: the last block,    *
+ * the block index with its trailer and the final header with  *
+ * the sample count. A reader unmaps the archive.               *
+ * ------------------------------------------------------------ */
+void zlog_close(struct lsm303d_zlog *z) {
+   if(!z->rdonly) {
+      struct lsm303d_ztrailer tr = { LSM303D_ZINDEX_MAGIC, 0, 0 };
+      if(zlog_flush(z) == 0) {
+         tr.blocks = z->blocks;
+         tr.index  = z->offset;
+         size_t len = z->blocks * sizeof(struct lsm303d_zindex);
+         if(write(z->fd, z->index, len) != len || write(z->fd, &tr, sizeof(tr)) != sizeof(tr)
+            || pwrite(z->fd, &z->hdr, sizeof(z->hdr), 0) != sizeof(z->hdr))
+            printf("Error: could not write the archive index.\n");
+      }
+      uint64_t raw = z->hdr.count * sizeof(struct lsm303draw) + sizeof(z->hdr);
+      uint64_t size = tr.index + z->blocks * sizeof(struct lsm303d_zindex) + sizeof(tr);
+      if(verbose == 1 && z->hdr.count > 0)
+         printf("Debug: Sample archive closed, %llu samples, %llu bytes, %.2f bytes/sample, "
+                "%.1fx smaller than the raw log\n", (unsigned long long) z->hdr.count,
+                (unsigned long long) size, (double) (size - sizeof(z->hdr)) / z->hdr.count,
+                (double) raw / size);
+   }
+   else if(z->map != NULL && z->map != MAP_FAILED) munmap((void *) z->map, z->mapsize);
+   free(z->index);
+   z->index = NULL;
+   z->map = NULL;
+   close(z->fd);
+}
@@ -0,0 +1,524 @@
+/* ------------------------------------------------------------ *
+ * file:        benchlsm303d.c                                  *
+ * purpose:     Benchmark of the driver hot paths: single and   *
+ *              burst register reads, sample acquisition, unit  *
+ *              conversion and heading computation, with the    *
+ *              throughput and p50/p99/p99.9 latency of each.   *
+ *              Runs on the simulated sensor by default, or on  *
+ *              a real bus with -b. Also times the batch heading*
+ *              kernels and SoA conversion passes on synthetic  *
+ *              samples, the fast_atan2() error bound, and all  *
+ *              headings against known level answers. -j        *
+ *              writes all results as JSON for regression runs. *
+ *                                                              *
+ * return:      0 on success, and -1 on errors.                 *
+ *                                                              *
+ * example:	./benchlsm303d -j > bench.json                  *
+ *		./benchlsm303d -b /dev/i2c-1 -m                 *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include "lsm303d.h"
+
+int verbose = 0;
+int jsonflag = 0;         // -j JSON output
+int mresflag = 0;         // -m acquisition at each M_RES setting
+char i2c_bus[256] = "sim"; // -b bus, default the simulator in virtual time
+int i2c_addr = 0x1d;      // -b @addr
+int nreads = 10000;       // -n register reads per hot path
+int nsamples = 200;       // -a samples per acquisition hot path
+int nkernel = 4000000;    // -s synthetic samples for the kernels
+
+#define BATCH  256        // CPU hot path calls per latency measurement
+#define POOL   1024       // acquired samples reused by the CPU hot paths
+#define MAXRES 16
+
+/* ------------------------------------------------------------ *
+ * Hot path result: latencies are per call, for the CPU paths   *
+ * the time of BATCH calls divided by BATCH.                    *
+ * ------------------------------------------------------------ */
+struct hotpath{
+   char name[32];
+   uint64_t calls;
+   int batch;
+   double per_sec;     // calls per second
+   double p50, p99, p999, max; // latency in ns
+};
+
+/* ------------------------------------------------------------ *
+ * Kernel result: one timed pass over nkernel samples           *
+ * ------------------------------------------------------------ */
+struct kernel{
+   const char *name;
+   double ms;          // pass time in ms
+   double ns;          // ns per sample
+   double gbs;         // GB/s, 0 = not reported
+   double diff;        // max difference to the reference, < 0 = none
+   const char *unit;   // unit of diff
+};
+
+struct hotpath hot[MAXRES];
+int nhot = 0;
+struct kernel kern[MAXRES];
+int nkern = 0;
+double atan2_err = 0;
+double level_err = 0;     // max heading error of the level check in degrees
+uint64_t *lat;            // latency of each measurement in ns
+struct lsm303draw raws[POOL];
+struct lsm303dsample smps[POOL];
+volatile float sink;      // keeps the heading results alive
+
+/* ------------------------------------------------------------ *
+ * usage() prints the programs commandline instructions.        *
+ * ------------------------------------------------------------ */
+void usage() {
+   static char const usage[] = "Usage: benchlsm303d [-b i2c-bus[@addr]] [-n reads] [-a samples] [-s samples] [-m] [-j] [-v]\n\
+\n\
+Command line parameters have the following format:\n\
+   -b   bus of the sensor hot paths, default sim (simulated sensor in virtual\n\
+        time, measures the driver CPU cost), example: -b /dev/i2c-1@0x1e\n\
+   -n   register reads per hot path, default 10000\n\
+   -a   samples per acquisition hot path at M_ODR 100 Hz, default 200\n\
+   -s   synthetic samples for the batch kernels, default 4000000\n\
+   -m   also time the acquisition at each magnetic resolution M_RES 0..3\n\
+   -j   write the results as JSON\n\
+   -h   display this message\n\
+   -v   enable debug output\n\
+\n\
+Usage examples:\n\
+./benchlsm303d\n\
+./benchlsm303d -j > bench.json\n\
+./benchlsm303d -b /dev/i2c-1 -n 2000 -a 500 -m\n\n";
+   printf(usage);
+}
+
+/* ------------------------------------------------------------ *
+ * parseargs() checks the commandline arguments with C getopt   *
+ * ------------------------------------------------------------ */
+void parseargs(int argc, char* argv[]) {
+   int arg;
+   opterr = 0;
+
+   while ((arg = (int) getopt (argc, argv, "a:b:jmn:s:hv")) != -1) {
+      switch (arg) {
+         case 'a':
+            nsamples = atoi(optarg); break;
+         case 'b':
+            if(strlen(optarg) >= sizeof(i2c_bus)) {
+               printf("Error: I2C bus argument to long.\n");
+               exit(-1);
+            }
+            strncpy(i2c_bus, optarg, sizeof(i2c_bus));
+            char *at = strchr(i2c_bus, '@');
+            if(at != NULL) {
+               *at = '\0';
+               i2c_addr = strtol(at + 1, NULL, 16);
+            }
+            break;
+         case 'j':
+            jsonflag = 1; break;
+         case 'm':
+            mresflag = 1; break;
+         case 'n':
+            nreads = atoi(optarg); break;
+         case 's':
+            nkernel = atoi(optarg); break;
+         case 'v':
+            verbose = 1; break;
+         case 'h':
+         case '?':
+         default:
+            usage(); exit(-1);
+      }
+   }
+   if(optind == argc - 1) nkernel = atoi(argv[optind]);  // former [samples] argument
+   else if(optind != argc) { usage(); exit(-1); }
+   if(nreads < 1 || nsamples < 1 || nkernel < 1) {
+      printf("Error: reads and samples must be at least 1.\n");
+      exit(-1);
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * cmp_u64() qsort order of the latencies                       *
+ * ------------------------------------------------------------ */
+static int cmp_u64(const void *a, const void *b) {
+   uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+   return (x > y) - (x < y);
+}
+
+/* ------------------------------------------------------------ *
+ * hot_run() times m measurements of batch calls of op(i), with *
+ * i counting the calls, and adds the result. Returns 0, or -1  *
+ * if a call failed.                                            *
+ * ------------------------------------------------------------ */
+static int hot_run(const char *name, int (*op)(int), int m, int batch) {
+   struct hotpath *h = &hot[nhot];
+   uint64_t total = 0;
+   for(int j=0; j<m; j++) {
+      uint64_t t0 = mono_ns();
+      for(int k=0; k<batch; k++)
+         if(op(j * batch + k) != 0) {
+            printf("Error: %s failed.\n", name);
+            return(-1);
+         }
+      lat[j] = mono_ns() - t0;
+      total += lat[j];
+   }
+   qsort(lat, m, sizeof(uint64_t), cmp_u64);
+   snprintf(h->name, sizeof(h->name), "%s", name);
+   h->calls   = (uint64_t) m * batch;
+   h->batch   = batch;
+   h->per_sec = (total > 0) ? h->calls * 1e9 / total : 0;
+   h->p50     = (double) lat[(m - 1) / 2] / batch;
+   h->p99     = (double) lat[(uint64_t) (m - 1) * 99 / 100] / batch;
+   h->p999    = (double) lat[(uint64_t) (m - 1) * 999 / 1000] / batch;
+   h->max     = (double) lat[m - 1] / batch;
+   nhot++;
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * The hot path operations                                      *
+ * ------------------------------------------------------------ */
+static int op_prdid(int i) {        // single register read
+   return (get_prdid() == PRD_ID) ? 0 : -1;
+}
+
+static int op_regs9(int i) {        // sample block burst, as lsm303d_read_raw()
+   uint8_t buf[9];
+   return lsm303d_read_regs(LSM303D_TEMP_OUT_L, buf, 9);
+}
+
+static int op_regs64(int i) {       // register map burst, as lsm303d_dump()
+   uint8_t buf[LSM303D_REGMAP_SIZE];
+   return lsm303d_read_regs(0x00, buf, LSM303D_REGMAP_SIZE);
+}
+
+static int op_read_raw(int i) {     // full sample acquisition
+   return lsm303d_read_raw(&raws[i % POOL]);
+}
+
+static int op_read(int i) {         // acquisition and conversion
+   struct lsm303ddata d;
+   return lsm303d_read(&d);
+}
+
+static int op_convert(int i) {
+   lsm303d_convert(&raws[i % POOL], &smps[i % POOL]);
+   return(0);
+}
+
+static int op_heading(int i) {      // two-axis heading
+   sink = get_heading(&smps[i % POOL].mag);
+   return(0);
+}
+
+static int op_heading_tc(int i) {   // tilt-compensated heading
+   sink = get_heading_tc(&smps[i % POOL]);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * bench_hotpaths() opens the sensor at M_ODR 100 Hz and times  *
+ * the bus, acquisition and CPU paths. The conversion and the   *
+ * headings work on the samples the acquisition read. Returns 0 *
+ * or -1 on error.                                              *
+ * ------------------------------------------------------------ */
+static int bench_hotpaths() {
+   int m = (nreads > nsamples) ? nreads : nsamples;
+   if(m < 10000) m = 10000;
+   if((lat = malloc(m * sizeof(uint64_t))) == NULL) return(-1);
+
+   lsm303d_cache_mode = 0;          // the sensor cache of getlsm303d stays untouched
+   if(lsm303d_bus_open(i2c_bus, i2c_addr) != 0) return(-1);
+   if(lsm303d_init() != 0 || set_cmfreq(5) != 0) return(-1);
+
+   if(hot_run("get_prdid", op_prdid, nreads, 1) != 0) return(-1);
+   if(hot_run("read_regs_9", op_regs9, nreads, 1) != 0) return(-1);
+   if(hot_run("read_regs_64", op_regs64, nreads, 1) != 0) return(-1);
+   if(hot_run("lsm303d_read_raw", op_read_raw, nsamples, 1) != 0) return(-1);
+   if(hot_run("lsm303d_read", op_read, nsamples, 1) != 0) return(-1);
+   for(int i=nsamples; i<POOL; i++) raws[i] = raws[i % nsamples];
+   if(hot_run("lsm303d_convert", op_convert, 10000, BATCH) != 0) return(-1);
+   if(hot_run("get_heading", op_heading, 10000, BATCH) != 0) return(-1);
+   if(hot_run("get_heading_tc", op_heading_tc, 10000, BATCH) != 0) return(-1);
+
+   /* the -m resolution modes of getlsm303d: acquisition per M_RES */
+   for(int mres=0; mresflag == 1 && mres<4; mres++) {
+      char name[32];
+      if(lsm303d_set_mres(mres) != 0 || shadow_commit() != 0) return(-1);
+      snprintf(name, sizeof(name), "lsm303d_read_raw_mres%d", mres);
+      if(hot_run(name, op_read_raw, nsamples, 1) != 0) return(-1);
+   }
+   lsm303d_powerdown();
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * rnd() uniform random float in -1..1, xorshift32              *
+ * ------------------------------------------------------------ */
+static uint32_t rndstate = 0x9E3779B9u;
+static float rnd() {
+   rndstate ^= rndstate << 13;
+   rndstate ^= rndstate >> 17;
+   rndstate ^= rndstate << 5;
+   return (float) rndstate / 2147483648.0f - 1.0f;
+}
+
+/* ------------------------------------------------------------ *
+ * angdiff() absolute difference of two headings in degrees,    *
+ * taking the 0/360 wrap into account.                          *
+ * ------------------------------------------------------------ */
+static double angdiff(double a, double b) {
+   double d = fabs(a - b);
+   return (d > 180) ? 360 - d : d;
+}
+
+/* ------------------------------------------------------------ *
+ * kernel_add() adds the result of a pass from t0 to t1         *
+ * ------------------------------------------------------------ */
+static void kernel_add(const char *name, uint64_t t0, uint64_t t1, double bytes,
+                       double diff, const char *unit) {
+   struct kernel *k = &kern[nkern++];
+   k->name = name;
+   k->ms   = (t1 - t0) / 1e6;
+   k->ns   = (double) (t1 - t0) / nkernel;
+   k->gbs  = bytes / (t1 - t0);
+   k->diff = diff;
+   k->unit = unit;
+}
+
+/* ------------------------------------------------------------ *
+ * bench_level() checks all heading paths against known answers *
+ * before anything is timed: a level, face-up board with the X  *
+ * axis at 0, 45 .. 315 degrees, in a field of 300 mGauss north *
+ * and 360 mGauss down. X east must read 90 degrees. Agreement  *
+ * between the paths alone would not catch a mirrored frame.    *
+ * Returns 0, or -1 if a heading is off by more than 0.1 deg.   *
+ * ------------------------------------------------------------ */
+static int bench_level() {
+   float saved_decl = lsm303d->declination;
+   lsm303d->declination = 0;
+
+   for(int i=0; i<8; i++) {
+      double psi = i * 45 * M_PI / 180;
+      struct lsm303dsample smp = { .acc = { 0, 0, 1000 } };
+      smp.mag.X = 300 * cos(psi);         // north is psi to the left of X,
+      smp.mag.Y = 300 * sin(psi);         // Y points left
+      smp.mag.Z = -360;                   // Z up, the field points down
+      struct lsm303ddata flat = { smp.mag.X, smp.mag.Y, smp.mag.Z };
+      int16_t rmx = lrint(smp.mag.X / LSM303D_MAG_SCALE_4G);
+      int16_t rmy = lrint(smp.mag.Y / LSM303D_MAG_SCALE_4G);
+      int16_t rmz = lrint(smp.mag.Z / LSM303D_MAG_SCALE_4G);
+      int16_t rax = 0, ray = 0, raz = lrint(1000 / LSM303D_ACC_SCALE_2G);
+      float deg[4];
+      deg[0] = get_heading(&flat);
+      deg[1] = get_heading_tc(&smp);
+      heading_batch_f32(&smp.mag.X, &smp.mag.Y, &smp.mag.Z, &smp.acc.X, &smp.acc.Y,
+                        &smp.acc.Z, &deg[2], 1, 0);
+      heading_batch_i16(&rmx, &rmy, &rmz, &rax, &ray, &raz, NULL, &deg[3], 1, 0);
+      for(int k=0; k<4; k++) {
+         double err = angdiff(deg[k], i * 45);
+         if(err > level_err) level_err = err;
+         if(verbose == 1) printf("Debug: level heading %d path %d: %.3f degrees\n", i * 45, k, deg[k]);
+      }
+   }
+   lsm303d->declination = saved_decl;
+   if(level_err > 0.1) {
+      printf("Error: level heading check failed, max error %.3f degrees.\n", level_err);
+      return(-1);
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * bench_kernels() times the batch heading kernels against the  *
+ * scalar path and the SoA conversion passes against per-sample *
+ * lsm303d_convert(), on n synthetic samples. Returns 0 or -1.  *
+ * ------------------------------------------------------------ */
+static int bench_kernels(int n) {
+   float saved_decl = lsm303d->declination;
+   struct lsm303d_calib saved_cal = lsm303d->cal;
+   lsm303d->declination = 7.5;
+
+   /* --------------------------------------------------------- *
+    * fast_atan2() error over the full circle, 1M angles        *
+    * --------------------------------------------------------- */
+   for(int i=0; i<1000000; i++) {
+      double a = -M_PI + 2 * M_PI * i / 1000000.0;
+      float y = sinf(a), x = cosf(a);
+      double err = fabs(fast_atan2(y, x) - atan2(y, x));
+      if(err > M_PI) err = 2 * M_PI - err;
+      if(err > atan2_err) atan2_err = err;
+   }
+
+   /* --------------------------------------------------------- *
+    * synthetic samples: raw magnetic field with a hard-iron    *
+    * offset, board tilted up to about 45 degrees               *
+    * --------------------------------------------------------- */
+   struct lsm303dsample *smp = malloc(n * sizeof(struct lsm303dsample));
+   struct lsm303d_soa raw;
+   if(soa_init(&raw, n) != 0) return(-1);
+   float *cvt = malloc(LSM303D_SOA_CH * raw.stride * sizeof(float));
+   int16_t *q15 = malloc(6 * raw.stride * sizeof(int16_t));
+   float *soa = malloc(6 * n * sizeof(float));
+   float *ref = malloc(n * sizeof(float));
+   float *f32 = malloc(n * sizeof(float));
+   float *i16 = malloc(n * sizeof(float));
+   if(smp == NULL || cvt == NULL || q15 == NULL || soa == NULL || ref == NULL ||
+      f32 == NULL || i16 == NULL) {
+      printf("Error: could not allocate %d samples.\n", n);
+      return(-1);
+   }
+   float moff[3] = { 120, -80, 40 };
+   int16_t *rmx = raw.mag[0], *rmy = raw.mag[1], *rmz = raw.mag[2];
+   int16_t *rax = raw.acc[0], *ray = raw.acc[1], *raz = raw.acc[2];
+   float *mx = soa, *my = soa + n, *mz = soa + 2*n;
+   float *ax = soa + 3*n, *ay = soa + 4*n, *az = soa + 5*n;
+
+   for(int i=0; i<n; i++) {
+      struct lsm303draw r = { .ts = i, .temp = 40 + 8 * rnd() };
+      r.mag[0] = 3000 * rnd() + moff[0];
+      r.mag[1] = 3000 * rnd() + moff[1];
+      r.mag[2] = 3000 * rnd() + moff[2];
+      r.acc[0] = 11000 * rnd();
+      r.acc[1] = 11000 * rnd();
+      r.acc[2] = 16384 * 0.8 + 2000 * rnd();
+      soa_push(&raw, &r);
+
+      smp[i].mag.X = (rmx[i] - moff[0]) * LSM303D_MAG_SCALE_4G;
+      smp[i].mag.Y = (rmy[i] - moff[1]) * LSM303D_MAG_SCALE_4G;
+      smp[i].mag.Z = (rmz[i] - moff[2]) * LSM303D_MAG_SCALE_4G;
+      smp[i].acc.X = rax[i] * LSM303D_ACC_SCALE_2G;
+      smp[i].acc.Y = ray[i] * LSM303D_ACC_SCALE_2G;
+      smp[i].acc.Z = raz[i] * LSM303D_ACC_SCALE_2G;
+      mx[i] = smp[i].mag.X; my[i] = smp[i].mag.Y; mz[i] = smp[i].mag.Z;
+      ax[i] = smp[i].acc.X; ay[i] = smp[i].acc.Y; az[i] = smp[i].acc.Z;
+   }
+
+   uint64_t t0 = mono_ns();
+   get_heading_batch(smp, ref, n);
+   uint64_t t1 = mono_ns();
+   heading_batch_f32(mx, my, mz, ax, ay, az, f32, n, lsm303d->declination);
+   uint64_t t2 = mono_ns();
+   heading_batch_i16(rmx, rmy, rmz, rax, ray, raz, moff, i16, n, lsm303d->declination);
+   uint64_t t3 = mono_ns();
+
+   double d32 = 0, d16 = 0;
+   for(int i=0; i<n; i++) {
+      if(angdiff(ref[i], f32[i]) > d32) d32 = angdiff(ref[i], f32[i]);
+      if(angdiff(ref[i], i16[i]) > d16) d16 = angdiff(ref[i], i16[i]);
+   }
+   kernel_add("get_heading_batch", t0, t1, 0, -1, NULL);
+   kernel_add("heading_batch_f32", t1, t2, 0, d32, "degrees");
+   kernel_add("heading_batch_i16", t2, t3, 0, d16, "degrees");
+
+   /* --------------------------------------------------------- *
+    * raw to unit conversion: per-sample AoS versus SoA passes  *
+    * --------------------------------------------------------- */
+   for(int i=0; i<3; i++) lsm303d->cal.mag_off[i] = moff[i] * lsm303d->cal.mag_sens[i];
+   memset(cvt, 0, LSM303D_SOA_CH * raw.stride * sizeof(float)); // fault the
+   memset(q15, 0, 6 * raw.stride * sizeof(int16_t));           // pages in
+   struct lsm303draw r = {0};
+   t0 = mono_ns();
+   for(int i=0; i<n; i++) {
+      r.mag[0] = rmx[i]; r.mag[1] = rmy[i]; r.mag[2] = rmz[i];
+      r.acc[0] = rax[i]; r.acc[1] = ray[i]; r.acc[2] = raz[i];
+      r.temp = raw.temp[i];
+      lsm303d_convert(&r, &smp[i]);
+   }
+   t1 = mono_ns();
+   soa_convert_f32(&raw, &lsm303d->cal, cvt);
+   t2 = mono_ns();
+   soa_convert_q15(&raw, &lsm303d->cal, q15);
+   t3 = mono_ns();
+
+   double df = 0;
+   for(int i=0; i<n; i++) {
+      double d = fabs(cvt[i] - smp[i].mag.X) + fabs(cvt[3 * raw.stride + i] - smp[i].acc.X);
+      if(d > df) df = d;
+   }
+   kernel_add("lsm303d_convert", t0, t1, 0, -1, NULL);
+   kernel_add("soa_convert_f32", t1, t2, (double) n * LSM303D_SOA_CH * (2 + 4), df, "units");
+   kernel_add("soa_convert_q15", t2, t3, (double) n * 6 * (2 + 2), -1, NULL);
+
+   soa_free(&raw); free(cvt); free(q15); free(smp); free(soa); free(ref); free(f32); free(i16);
+   lsm303d->cal = saved_cal;
+   lsm303d->declination = saved_decl;
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * print_text() prints the results as tables                    *
+ * ------------------------------------------------------------ */
+static void print_text() {
+   printf("Hot paths on %s@0x%02x, backend %s:\n", i2c_bus, i2c_addr, lsm303d->bus->name);
+   printf("  %-24s %9s %12s %10s %10s %10s %10s\n", "", "calls", "calls/s",
+          "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+   for(int i=0; i<nhot; i++)
+      printf("  %-24s %9llu %12.0f %10.1f %10.1f %10.1f %10.1f\n", hot[i].name,
+             (unsigned long long) hot[i].calls, hot[i].per_sec,
+             hot[i].p50, hot[i].p99, hot[i].p999, hot[i].max);
+   if(lsm303d->faults.errors > 0)
+      printf("  bus faults: %llu errors, %llu recovered\n",
+             (unsigned long long) lsm303d->faults.errors,
+             (unsigned long long) lsm303d->faults.recovered);
+
+   printf("Level heading check: max error %.5f degrees\n", level_err);
+   printf("fast_atan2 max error: %.2e rad (%.5f degrees)\n", atan2_err, atan2_err * 180 / M_PI);
+   printf("%d samples, raw %zu bytes AoS struct lsm303dsample, %d bytes SoA int16:\n",
+          nkernel, sizeof(struct lsm303dsample), LSM303D_SOA_CH * 2);
+   for(int i=0; i<nkern; i++) {
+      printf("  %-18s %8.2f ms %6.2f ns/sample", kern[i].name, kern[i].ms, kern[i].ns);
+      if(kern[i].gbs > 0) printf(" %6.2f GB/s", kern[i].gbs);
+      if(kern[i].diff >= 0) printf(", max diff %.5f %s", kern[i].diff, kern[i].unit);
+      printf("\n");
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * print_json() prints the results as one JSON object           *
+ * ------------------------------------------------------------ */
+static void print_json() {
+   printf("{\n  \"bus\": \"%s\",\n  \"addr\": \"0x%02x\",\n  \"backend\": \"%s\",\n",
+          i2c_bus, i2c_addr, lsm303d->bus->name);
+   printf("  \"hotpaths\": [\n");
+   for(int i=0; i<nhot; i++)
+      printf("    {\"name\":\"%s\",\"calls\":%llu,\"batch\":%d,\"calls_per_sec\":%.1f,"
+             "\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"p999_ns\":%.1f,\"max_ns\":%.1f}%s\n",
+             hot[i].name, (unsigned long long) hot[i].calls, hot[i].batch, hot[i].per_sec,
+             hot[i].p50, hot[i].p99, hot[i].p999, hot[i].max, (i < nhot - 1) ? "," : "");
+   printf("  ],\n  \"bus_errors\": %llu,\n  \"bus_recovered\": %llu,\n",
+          (unsigned long long) lsm303d->faults.errors,
+          (unsigned long long) lsm303d->faults.recovered);
+   printf("  \"level_max_err_deg\": %.6f,\n", level_err);
+   printf("  \"fast_atan2_max_err_rad\": %.3e,\n  \"kernel_samples\": %d,\n  \"kernels\": [\n",
+          atan2_err, nkernel);
+   for(int i=0; i<nkern; i++) {
+      printf("    {\"name\":\"%s\",\"ms\":%.3f,\"ns_per_sample\":%.3f", kern[i].name,
+             kern[i].ms, kern[i].ns);
+      if(kern[i].gbs > 0) printf(",\"gb_per_sec\":%.3f", kern[i].gbs);
+      if(kern[i].diff >= 0) printf(",\"max_diff\":%.6f,\"diff_unit\":\"%s\"", kern[i].diff, kern[i].unit);
+      printf("}%s\n", (i < nkern - 1) ? "," : "");
+   }
+   printf("  ]\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+   parseargs(argc, argv);
+   if(bench_level() != 0) exit(-1);
+   if(bench_hotpaths() != 0) exit(-1);
+   if(bench_kernels(nkernel) != 0) exit(-1);
+   if(jsonflag == 1) print_json();
+   else print_text();
+   lsm303d->bus->close(lsm303d->bus->priv);
+   free(lat);
+   exit(0);
+}
@@ -0,0 +1,222 @@
+/* ------------------------------------------------------------ *
+ * file:        cache_lsm303d.c                                 *
+ * purpose:     Persistent calibration and configuration cache. *
+ *              A small versioned binary file, memory-mapped at *
+ *              startup, holds one record per bus and address:  *
+ *              the calibration offsets and soft-iron matrix,   *
+ *              the declination and the last CTRL0..CTRL7 bytes *
+ *              written. Short runs such as cron driven -t reads *
+ *              skip the calibration, and the init writes if    *
+ *              the sensor still holds them.                    *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "lsm303d.h"
+
+/* ------------------------------------------------------------ *
+ * global variables, declared in lsm303d.h                      *
+ * ------------------------------------------------------------ */
+int lsm303d_cache_mode = 1;                  // 0 = off, 1 = on, 2 = invalidate
+
+static struct lsm303d_cachefile *cachemap = NULL;
+
+/* ------------------------------------------------------------ *
+ * cache_crc() FNV-1a checksum of a record, up to the crc field *
+ * ------------------------------------------------------------ */
+static uint32_t cache_crc(const struct lsm303d_cacherec *rec) {
+   const uint8_t *p = (const uint8_t *) rec;
+   uint32_t h = 2166136261u;
+   for(size_t i=0; i<offsetof(struct lsm303d_cacherec, crc); i++) {
+      h ^= p[i];
+      h *= 16777619u;
+   }
+   return h;
+}
+
+/* ------------------------------------------------------------ *
+ * cache_seal() updates the checksum after a record change      *
+ * ------------------------------------------------------------ */
+static void cache_seal(struct lsm303d_cacherec *rec) {
+   rec->crc = cache_crc(rec);
+}
+
+/* ------------------------------------------------------------ *
+ * cache_open() maps the cache file and selects the record for  *
+ * bus and addr. A missing, foreign or outdated file is reset,  *
+ * an unknown sensor takes the least recently used slot. Any    *
+ * failure only disables the cache. Several devices share one   *
+ * mapping, the record goes to the selected device. Returns 1   *
+ * if the record holds data (a cache hit), 0 if not, -1 without *
+ * a cache.                                                     *
+ * ------------------------------------------------------------ */
+int cache_open(const char *bus, int addr) {
+   if(lsm303d_cache_mode == 0) return(-1);
+
+   int fd = open(LSM303D_CACHE_FILE, O_RDWR | O_CREAT, 0644);
+   if(fd < 0) {
+      if(verbose == 1) printf("Debug: Cache [%s] unavailable, running without\n", LSM303D_CACHE_FILE);
+      return(-1);
+   }
+   flock(fd, LOCK_EX);   // serializes slot claims of concurrent runs
+
+   struct stat st;
+   int fresh = (fstat(fd, &st) != 0 || st.st_size != sizeof(struct lsm303d_cachefile));
+   if(fresh && (ftruncate(fd, 0) != 0 || ftruncate(fd, sizeof(struct lsm303d_cachefile)) != 0)) {
+      close(fd);
+      return(-1);
+   }
+   if(cachemap == NULL)
+      cachemap = mmap(NULL, sizeof(struct lsm303d_cachefile), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+   if(cachemap == MAP_FAILED) {
+      cachemap = NULL;
+      close(fd);
+      return(-1);
+   }
+   if(cachemap->magic != LSM303D_CACHE_MAGIC || cachemap->version != LSM303D_CACHE_VERSION
+      || cachemap->recsize != sizeof(struct lsm303d_cacherec)) {
+      if(verbose == 1) printf("Debug: Cache [%s] reset to version %d\n",
+                               LSM303D_CACHE_FILE, LSM303D_CACHE_VERSION);
+      memset(cachemap, 0, sizeof(struct lsm303d_cachefile));
+      cachemap->magic   = LSM303D_CACHE_MAGIC;
+      cachemap->version = LSM303D_CACHE_VERSION;
+      cachemap->recsize = sizeof(struct lsm303d_cacherec);
+   }
+
+   /* ---------------------------------------- */
+   /* find the record, or claim the LRU slot   */
+   /* ---------------------------------------- */
+   struct lsm303d_cacherec *rec = NULL, *lru = &cachemap->rec[0];
+   for(int i=0; i<LSM303D_CACHE_SLOTS; i++) {
+      struct lsm303d_cacherec *r = &cachemap->rec[i];
+      if(r->addr == addr && strncmp(r->bus, bus, sizeof(r->bus)) == 0) { rec = r; break; }
+      if(r->used < lru->used) lru = r;
+   }
+   if(rec != NULL && (rec->crc != cache_crc(rec) || lsm303d_cache_mode == 2)) {
+      if(verbose == 1) printf("Debug: Cache record [%s:0x%02X] %s\n", bus, addr,
+                               (lsm303d_cache_mode == 2) ? "invalidated" : "corrupt, cleared");
+      rec->flags = 0;
+      rec->ctrl_known = 0;
+   }
+   if(rec == NULL) {
+      rec = lru;
+      memset(rec, 0, sizeof(struct lsm303d_cacherec));
+      strncpy(rec->bus, bus, sizeof(rec->bus) - 1);
+      rec->addr = addr;
+   }
+   rec->used = time(NULL);
+   cache_seal(rec);
+   flock(fd, LOCK_UN);
+   close(fd);            // the mapping stays valid
+
+   lsm303d->cache = rec;
+   if(verbose == 1) printf("Debug: Cache record [%s:0x%02X] flags [0x%02X]\n", bus, addr, rec->flags);
+   return(rec->flags != 0);
+}
+
+/* ------------------------------------------------------------ *
+ * cache_close() writes the records back and unmaps the file,   *
+ * after the last device is done with its record.               *
+ * ------------------------------------------------------------ */
+void cache_close() {
+   if(cachemap == NULL) return;
+   msync(cachemap, sizeof(struct lsm303d_cachefile), MS_SYNC);
+   munmap(cachemap, sizeof(struct lsm303d_cachefile));
+   cachemap = NULL;
+   lsm303d->cache = NULL;
+}
+
+/* ------------------------------------------------------------ *
+ * cache_invalidate() clears the record of the open sensor      *
+ * ------------------------------------------------------------ */
+void cache_invalidate() {
+   if(lsm303d->cache == NULL) return;
+   lsm303d->cache->flags = 0;
+   lsm303d->cache->ctrl_known = 0;
+   cache_seal(lsm303d->cache);
+}
+
+/* ------------------------------------------------------------ *
+ * cache_store_regs() mirrors a register write into the record, *
+ * called for every write so the cached CTRL0..CTRL7 always are *
+ * the last values written to the sensor.                       *
+ * ------------------------------------------------------------ */
+void cache_store_regs(uint8_t reg, const uint8_t *buf, uint16_t len) {
+   if(lsm303d->cache == NULL) return;
+   if(reg > LSM303D_CTRL7 || reg + len <= LSM303D_CTRL0) return;
+   for(int i=0; i<len; i++) {
+      int r = reg + i - LSM303D_CTRL0;
+      if(r < 0 || r > 7) continue;
+      lsm303d->cache->ctrl[r] = buf[i];
+      lsm303d->cache->ctrl_known |= 1 << r;
+   }
+   if(lsm303d->cache->ctrl_known == 0xFF) lsm303d->cache->flags |= LSM303D_CACHE_CTRL;
+   cache_seal(lsm303d->cache);
+}
+
+/* ------------------------------------------------------------ *
+ * cache_ctrl_match() returns 1 if the last CTRL0..CTRL7 values *
+ * written to the sensor equal ctrl, else 0.                    *
+ * ------------------------------------------------------------ */
+int cache_ctrl_match(const uint8_t *ctrl) {
+   if(lsm303d->cache == NULL || !(lsm303d->cache->flags & LSM303D_CACHE_CTRL)) return(0);
+   return(memcmp(lsm303d->cache->ctrl, ctrl, 8) == 0);
+}
+
+/* ------------------------------------------------------------ *
+ * cache_store_cal() saves the calibration offsets and matrix   *
+ * ------------------------------------------------------------ */
+void cache_store_cal(const struct lsm303d_calib *cal) {
+   if(lsm303d->cache == NULL) return;
+   memcpy(lsm303d->cache->mag_off, cal->mag_off, sizeof(cal->mag_off));
+   memcpy(lsm303d->cache->mag_si, cal->mag_si, sizeof(cal->mag_si));
+   memcpy(lsm303d->cache->acc_off, cal->acc_off, sizeof(cal->acc_off));
+   lsm303d->cache->flags |= LSM303D_CACHE_CAL;
+   cache_seal(lsm303d->cache);
+}
+
+/* ------------------------------------------------------------ *
+ * cache_load_cal() restores a cached calibration into cal and  *
+ * the device offset[]. Returns 1 if one was cached, else 0.    *
+ * ------------------------------------------------------------ */
+int cache_load_cal(struct lsm303d_calib *cal) {
+   if(lsm303d->cache == NULL || !(lsm303d->cache->flags & LSM303D_CACHE_CAL)) return(0);
+   memcpy(cal->mag_off, lsm303d->cache->mag_off, sizeof(cal->mag_off));
+   memcpy(cal->mag_si, lsm303d->cache->mag_si, sizeof(cal->mag_si));
+   memcpy(cal->acc_off, lsm303d->cache->acc_off, sizeof(cal->acc_off));
+   memcpy(lsm303d->offset, cal->mag_off, sizeof(lsm303d->offset));
+   if(verbose == 1) printf("Debug: Cached calibration: offset X-[%.2f] Y-[%.2f] Z-[%.2f]\n",
+                            lsm303d->offset[0], lsm303d->offset[1], lsm303d->offset[2]);
+   return(1);
+}
+
+/* ------------------------------------------------------------ *
+ * cache_store_decl() saves the local declination               *
+ * ------------------------------------------------------------ */
+void cache_store_decl(float decl) {
+   if(lsm303d->cache == NULL) return;
+   lsm303d->cache->declination = decl;
+   lsm303d->cache->flags |= LSM303D_CACHE_DECL;
+   cache_seal(lsm303d->cache);
+}
+
+/* ------------------------------------------------------------ *
+ * cache_load_decl() restores a cached declination into decl.   *
+ * Returns 1 if one was cached, else 0.                         *
+ * ------------------------------------------------------------ */
+int cache_load_decl(float *decl) {
+   if(lsm303d->cache == NULL || !(lsm303d->cache->flags & LSM303D_CACHE_DECL)) return(0);
+   *decl = lsm303d->cache->declination;
+   return(1);
+}
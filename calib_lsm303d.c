@@ -0,0 +1,289 @@
+/* ------------------------------------------------------------ *
+ * file:        calib_lsm303d.c                                 *
+ * purpose:     Streaming hard- and soft-iron calibration of    *
+ *              the LSM303D magnetometer. Each sample is folded *
+ *              into the normal equations of an ellipsoid fit   *
+ *              (constant size sums, O(1) per sample), so the   *
+ *              fit can be solved again at any time as coverage *
+ *              improves, without storing the raw point cloud.  *
+ *                                                              *
+ *              Ellipsoid:  x'Qx + 2v'x = 1, 9 parameters       *
+ *              hard-iron:  c = -inv(Q) v                       *
+ *              soft-iron:  W = R sqrtm(Q / (1 + c'Qc))         *
+ *              corrected:  m' = W (m - c), |m'| = R            *
+ *                                                              *
+ *              With poor coverage, the same sums solve a       *
+ *              sphere fit (hard-iron only) instead.            *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "lsm303d.h"
+
+#define CAL_SCALE 1e-3  // sums are kept in gauss, values near 1
+
+/* ------------------------------------------------------------ *
+ * magcal_init() clears the sums and the fit result             *
+ * ------------------------------------------------------------ */
+void magcal_init(struct lsm303d_magcal *mc) {
+   memset(mc, 0, sizeof(struct lsm303d_magcal));
+   for(int i=0; i<3; i++) {
+      mc->mn[i] = INFINITY;
+      mc->mx[i] = -INFINITY;
+      mc->soft[i][i] = 1;
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * magcal_bin() direction bin 0..23 of the vector v: 8 sectors  *
+ * of 45 degrees in X/Y times 3 equal area bands in Z, so that  *
+ * a level rotation stays in the middle band. Returns -1 if v   *
+ * is shorter than half the radius r, its direction would be    *
+ * mostly noise or center error.                                *
+ * ------------------------------------------------------------ */
+static int magcal_bin(const float v[3], float r) {
+   float len = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+   if(len < 0.5f * r) return(-1);
+
+   int quad = (v[1] >= 0) ? ((v[0] >= 0) ? 0 : 1) : ((v[0] < 0) ? 2 : 3);
+   int half = (fabsf(v[1]) > fabsf(v[0])) ^ (quad & 1);
+   int band = (int) ((v[2] / len + 1.0f) * 1.5f);
+   if(band > 2) band = 2;
+   return(band * 8 + quad * 2 + half);
+}
+
+/* ------------------------------------------------------------ *
+ * magcal_add() folds one magnetic sample in milli Gauss, with  *
+ * the range sensitivity applied but no offset, into the sums.  *
+ * Returns 1 if the sample hit a new direction bin, i.e. the    *
+ * coverage improved and a new magcal_solve() is worthwhile.    *
+ * ------------------------------------------------------------ */
+int magcal_add(struct lsm303d_magcal *mc, const float *m) {
+   double x = m[0] * CAL_SCALE, y = m[1] * CAL_SCALE, z = m[2] * CAL_SCALE;
+   double phi[9] = { x*x, y*y, z*z, 2*x*y, 2*x*z, 2*y*z, 2*x, 2*y, 2*z };
+
+   for(int i=0; i<9; i++) {
+      for(int j=i; j<9; j++) mc->ata[i][j] += phi[i] * phi[j];
+      mc->atb[i] += phi[i];
+   }
+   mc->n++;
+
+   /* before a fit, the center and radius come from the min/max */
+   /* box, which needs some rotation before it means anything  */
+   float v[3], r = mc->radius;
+   if(!mc->valid) r = LSM303D_CAL_MINFIELD;
+   for(int i=0; i<3; i++) {
+      if(m[i] < mc->mn[i]) mc->mn[i] = m[i];
+      if(m[i] > mc->mx[i]) mc->mx[i] = m[i];
+      if(!mc->valid && (mc->mx[i] - mc->mn[i]) / 2 > r) r = (mc->mx[i] - mc->mn[i]) / 2;
+      v[i] = m[i] - ((mc->valid) ? mc->off[i] : (mc->mn[i] + mc->mx[i]) / 2);
+   }
+   int bin = magcal_bin(v, r);
+   if(bin < 0 || (mc->bins & (1u << bin))) return(0);
+   mc->bins |= 1u << bin;
+   mc->coverage = __builtin_popcount(mc->bins) / (float) LSM303D_CAL_BINS;
+   return(1);
+}
+
+/* ------------------------------------------------------------ *
+ * solve() Gaussian elimination with partial pivoting of the n  *
+ * by n system a x = b (n <= 9), a and b are overwritten.       *
+ * Returns 0 on success, -1 if the system is singular.          *
+ * ------------------------------------------------------------ */
+static int solve(double a[9][9], double b[9], double x[9], int n) {
+   for(int c=0; c<n; c++) {
+      int p = c;
+      for(int r=c+1; r<n; r++) if(fabs(a[r][c]) > fabs(a[p][c])) p = r;
+      if(fabs(a[p][c]) < 1e-12 * (fabs(a[0][0]) + 1e-300)) return(-1);
+      if(p != c) {
+         for(int k=0; k<n; k++) { double t = a[c][k]; a[c][k] = a[p][k]; a[p][k] = t; }
+         double t = b[c]; b[c] = b[p]; b[p] = t;
+      }
+      for(int r=c+1; r<n; r++) {
+         double f = a[r][c] / a[c][c];
+         for(int k=c; k<n; k++) a[r][k] -= f * a[c][k];
+         b[r] -= f * b[c];
+      }
+   }
+   for(int r=n-1; r>=0; r--) {
+      double s = b[r];
+      for(int k=r+1; k<n; k++) s -= a[r][k] * x[k];
+      x[r] = s / a[r][r];
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * eig3() eigen decomposition of the symmetric 3x3 matrix a by  *
+ * cyclic Jacobi rotations: a = v diag(w) v'. a is overwritten. *
+ * ------------------------------------------------------------ */
+static void eig3(double a[3][3], double v[3][3], double w[3]) {
+   memset(v, 0, 9 * sizeof(double));
+   v[0][0] = v[1][1] = v[2][2] = 1;
+
+   for(int sweep=0; sweep<50; sweep++) {
+      double off = fabs(a[0][1]) + fabs(a[0][2]) + fabs(a[1][2]);
+      if(off < 1e-15 * (fabs(a[0][0]) + fabs(a[1][1]) + fabs(a[2][2]))) break;
+      for(int p=0; p<2; p++) {
+         for(int q=p+1; q<3; q++) {
+            if(a[p][q] == 0) continue;
+            double th = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+            double t  = ((th >= 0) ? 1 : -1) / (fabs(th) + sqrt(th * th + 1));
+            double c  = 1 / sqrt(t * t + 1), s = t * c;
+            for(int k=0; k<3; k++) {    // a = J' a J
+               double akp = a[k][p], akq = a[k][q];
+               a[k][p] = c * akp - s * akq;
+               a[k][q] = s * akp + c * akq;
+            }
+            for(int k=0; k<3; k++) {
+               double apk = a[p][k], aqk = a[q][k];
+               a[p][k] = c * apk - s * aqk;
+               a[q][k] = s * apk + c * aqk;
+            }
+            for(int k=0; k<3; k++) {    // v = v J
+               double vkp = v[k][p], vkq = v[k][q];
+               v[k][p] = c * vkp - s * vkq;
+               v[k][q] = s * vkp + c * vkq;
+            }
+         }
+      }
+   }
+   for(int i=0; i<3; i++) w[i] = a[i][i];
+}
+
+/* ------------------------------------------------------------ *
+ * sym() reads element i,j of the upper triangle sums           *
+ * ------------------------------------------------------------ */
+static double sym(const struct lsm303d_magcal *mc, int i, int j) {
+   return (i <= j) ? mc->ata[i][j] : mc->ata[j][i];
+}
+
+/* ------------------------------------------------------------ *
+ * magcal_sphere() hard-iron only fit from the same sums:       *
+ * x^2+y^2+z^2 = 2ax + 2by + 2cz + d, with the moments of the   *
+ * design [2x 2y 2z 1] taken from the ellipsoid sums.           *
+ * ------------------------------------------------------------ */
+static int magcal_sphere(struct lsm303d_magcal *mc) {
+   double a[9][9], b[9], p[9], h[4][4], g[4];
+
+   for(int i=0; i<4; i++) {
+      for(int j=0; j<4; j++) {
+         if(i < 3 && j < 3) h[i][j] = sym(mc, 6 + i, 6 + j);
+         else if(i < 3)     h[i][j] = mc->atb[6 + i];
+         else if(j < 3)     h[i][j] = mc->atb[6 + j];
+         else               h[i][j] = mc->n;
+         a[i][j] = h[i][j];
+      }
+      g[i] = (i < 3) ? sym(mc, 0, 6 + i) + sym(mc, 1, 6 + i) + sym(mc, 2, 6 + i)
+                     : mc->atb[0] + mc->atb[1] + mc->atb[2];
+      b[i] = g[i];
+   }
+   if(solve(a, b, p, 4) != 0) return(-1);
+
+   double r2 = p[3] + p[0] * p[0] + p[1] * p[1] + p[2] * p[2];
+   if(r2 <= 0) return(-1);
+
+   /* residual sum((r^2 - psi'p)^2) = sum(r^4) - 2 p'g + p'Hp */
+   double res = 0;
+   for(int i=0; i<3; i++) for(int j=0; j<3; j++) res += sym(mc, i, j);
+   for(int i=0; i<4; i++) {
+      res -= 2 * p[i] * g[i];
+      for(int j=0; j<4; j++) res += p[i] * h[i][j] * p[j];
+   }
+   memset(mc->soft, 0, sizeof(mc->soft));
+   for(int i=0; i<3; i++) {
+      mc->off[i] = p[i] / CAL_SCALE;
+      mc->soft[i][i] = 1;
+   }
+   mc->radius  = sqrt(r2) / CAL_SCALE;
+   mc->fit_err = sqrt(fmax(res, 0) / mc->n) / (2 * r2);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * magcal_ellipsoid() full hard- and soft-iron fit. Fails if    *
+ * the sums are singular or the quadric is not an ellipsoid.    *
+ * ------------------------------------------------------------ */
+static int magcal_ellipsoid(struct lsm303d_magcal *mc) {
+   double a[9][9], b[9], p[9];
+
+   for(int i=0; i<9; i++) {
+      for(int j=0; j<9; j++) a[i][j] = sym(mc, i, j);
+      b[i] = mc->atb[i];
+   }
+   if(solve(a, b, p, 9) != 0) return(-1);
+
+   /* residual sum((phi'p - 1)^2) = p'AtA p - 2 p'Atb + n */
+   double res = mc->n;
+   for(int i=0; i<9; i++) {
+      res -= 2 * p[i] * mc->atb[i];
+      for(int j=0; j<9; j++) res += p[i] * sym(mc, i, j) * p[j];
+   }
+
+   double q[3][3] = { { p[0], p[3], p[4] },
+                      { p[3], p[1], p[5] },
+                      { p[4], p[5], p[2] } };
+   double v[3][3], w[3], c[3] = {0};
+   eig3(q, v, w);
+   if(w[0] <= 0 || w[1] <= 0 || w[2] <= 0) return(-1);
+
+   /* c = -inv(Q) v = -V diag(1/w) V' v */
+   for(int i=0; i<3; i++) {
+      double t = 0;
+      for(int k=0; k<3; k++) t += v[k][i] * p[6 + k];
+      for(int j=0; j<3; j++) c[j] -= v[j][i] * t / w[i];
+   }
+   /* k = 1 + c'Qc, then Q/k has unit radius */
+   double k = 1;
+   for(int i=0; i<3; i++) k -= c[i] * p[6 + i];
+   if(k <= 0) return(-1);
+
+   double r = pow(w[0] * w[1] * w[2] / (k * k * k), -1.0 / 6);
+   for(int i=0; i<3; i++) {
+      for(int j=0; j<3; j++) {
+         double s = 0;
+         for(int e=0; e<3; e++) s += v[i][e] * sqrt(w[e] / k) * v[j][e];
+         mc->soft[i][j] = r * s;
+      }
+      mc->off[i] = c[i] / CAL_SCALE;
+   }
+   mc->radius  = r / CAL_SCALE;
+   mc->fit_err = sqrt(fmax(res, 0) / mc->n) / (2 * k);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * magcal_solve() refines the fit from the current sums. The    *
+ * ellipsoid needs half of the direction bins, in all 3 bands.  *
+ * Below that, or if it fails, the sphere fit is used, which    *
+ * needs 2 bands: samples from a level rotation alone leave the *
+ * Z offset undetermined. Returns the fit level: 2 = ellipsoid, *
+ * 1 = sphere, 0 = no fit yet.                                  *
+ * ------------------------------------------------------------ */
+int magcal_solve(struct lsm303d_magcal *mc) {
+   int bands = ((mc->bins & 0x0000FF) != 0) + ((mc->bins & 0x00FF00) != 0) +
+               ((mc->bins & 0xFF0000) != 0);
+   mc->valid = 0;
+   if(mc->n >= LSM303D_CAL_MINSAMPLES && bands >= 2) {
+      if(bands == 3 && mc->coverage >= 0.5f && magcal_ellipsoid(mc) == 0) mc->valid = 2;
+      else if(magcal_sphere(mc) == 0) mc->valid = 1;
+   }
+   if(verbose == 1) printf("Debug: Calibration fit [%d] n [%.0f] coverage [%.0f%%] error [%.2f%%]\n",
+                           mc->valid, mc->n, mc->coverage * 100, mc->fit_err * 100);
+   return(mc->valid);
+}
+
+/* ------------------------------------------------------------ *
+ * magcal_apply() copies a valid fit into the conversion cal,   *
+ * and the hard-iron offset into the device offset[].           *
+ * ------------------------------------------------------------ */
+void magcal_apply(const struct lsm303d_magcal *mc, struct lsm303d_calib *cal) {
+   if(mc->valid == 0) return;
+   for(int i=0; i<3; i++) {
+      lsm303d->offset[i] = cal->mag_off[i] = mc->off[i];
+      for(int j=0; j<3; j++) cal->mag_si[i][j] = mc->soft[i][j];
+   }
+}
@@ -0,0 +1,173 @@
+/* ------------------------------------------------------------ *
+ * file:        capture_lsm303d.c                               *
+ * purpose:     High-rate accelerometer capture up to 1600 Hz.  *
+ *              Each FIFO watermark batch is read in one burst  *
+ *              straight into the next preallocated slots, of a *
+ *              memory buffer or of a mapped file, so the loop  *
+ *              makes no allocation, copy or file system call.  *
+ *              The file has the sample log header with flag    *
+ *              LSM303D_LOG_ACC, and 6 byte X Y Z records.      *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#define _GNU_SOURCE             // MAP_POPULATE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lsm303d.h"
+
+#define RECSIZE sizeof(int16_t[3])
+
+/* ------------------------------------------------------------ *
+ * capture_header() fills the log header of a capture with the  *
+ * current range, calibration and data rates.                   *
+ * ------------------------------------------------------------ */
+static void capture_header(struct lsm303d_loghdr *hdr, uint64_t period) {
+   log_header(hdr, period);
+   hdr->recsize = RECSIZE;
+   hdr->flags = LSM303D_LOG_ACC;
+}
+
+/* ------------------------------------------------------------ *
+ * capture_create() preallocates slots records, in file, or in  *
+ * memory if file is NULL. All pages are touched or populated   *
+ * here, so the capture takes no page faults. period is the     *
+ * AODR sample period in ns. Returns 0 on success, -1 on error. *
+ * ------------------------------------------------------------ */
+int capture_create(struct lsm303d_capture *cap, const char *file, uint64_t slots, uint64_t period) {
+   size_t size = sizeof(struct lsm303d_loghdr) + slots * RECSIZE;
+   memset(cap, 0, sizeof(struct lsm303d_capture));
+   cap->fd = -1;
+
+   if(file == NULL) {
+      cap->map = malloc(size);
+      if(cap->map == NULL) {
+         printf("Error: could not allocate %zu bytes for the capture.\n", size);
+         return(-1);
+      }
+      memset(cap->map, 0, size);
+   }
+   else {
+      cap->fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if(cap->fd < 0) {
+         printf("Error: could not create capture file %s\n", file);
+         return(-1);
+      }
+      int err = posix_fallocate(cap->fd, 0, size);
+      void *map = (err == 0) ? mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, cap->fd, 0) : MAP_FAILED;
+      if(map == MAP_FAILED) {
+         printf("Error: could not allocate %zu bytes for capture file %s\n", size, file);
+         close(cap->fd);
+         return(-1);
+      }
+      cap->map = map;
+   }
+   cap->mapsize = size;
+   cap->hdr = (struct lsm303d_loghdr *) cap->map;
+   cap->acc = (int16_t (*)[3]) (cap->map + sizeof(struct lsm303d_loghdr));
+   cap->slots = slots;
+   capture_header(cap->hdr, period);
+
+   if(verbose == 1) printf("Debug: Capture of %llu samples, %zu bytes %s\n",
+                            (unsigned long long) slots, size, file ? file : "in memory");
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * capture_drain() reads the pending FIFO samples into the next *
+ * slots. The first batch refreshes the header with the running *
+ * configuration, and dates record 0: its newest sample was     *
+ * just taken. A batch that finds the FIFO full counts as an    *
+ * overrun, stream mode may have overwritten older samples.     *
+ * Returns the sample count, 0 if the slots are full, -1 error. *
+ * ------------------------------------------------------------ */
+int capture_drain(struct lsm303d_capture *cap) {
+   struct lsm303d_loghdr *hdr = cap->hdr;
+   uint64_t n = hdr->count;
+   uint64_t left = cap->slots - n;
+   uint8_t src = 0;
+
+   if(left == 0) return(0);
+   int level = lsm303d_fifo_read(&cap->acc[n], (left < LSM303D_FIFO_DEPTH) ? left : LSM303D_FIFO_DEPTH, &src);
+   uint64_t now = mono_ns();
+   if(level <= 0) return(level);
+
+   if(src & LSM303D_FIFO_OVRN) cap->overruns++;
+   if(level > cap->max_level) cap->max_level = level;
+   if(n == 0) {
+      capture_header(hdr, hdr->period);
+      hdr->t0 = now - (level - 1) * hdr->period;
+   }
+   cap->batches++;
+   cap->t_last = now;
+   __atomic_store_n(&hdr->count, n + level, __ATOMIC_RELEASE);
+   return(level);
+}
+
+/* ------------------------------------------------------------ *
+ * capture_open() maps a capture file read-only and checks its  *
+ * header. Returns 0 on success, -1 on error.                   *
+ * ------------------------------------------------------------ */
+int capture_open(struct lsm303d_capture *cap, const char *file) {
+   struct stat st;
+   memset(cap, 0, sizeof(struct lsm303d_capture));
+   cap->rdonly = 1;
+
+   cap->fd = open(file, O_RDONLY);
+   if(cap->fd < 0) {
+      printf("Error: could not open capture file %s\n", file);
+      return(-1);
+   }
+   void *map = MAP_FAILED;
+   if(fstat(cap->fd, &st) == 0 && st.st_size >= sizeof(struct lsm303d_loghdr))
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, cap->fd, 0);
+   if(map == MAP_FAILED) {
+      printf("Error: %s is not a capture file.\n", file);
+      close(cap->fd);
+      return(-1);
+   }
+   cap->map = map;
+   cap->mapsize = st.st_size;
+   cap->hdr = (struct lsm303d_loghdr *) map;
+   cap->acc = (int16_t (*)[3]) (cap->map + sizeof(struct lsm303d_loghdr));
+   cap->slots = (st.st_size - sizeof(struct lsm303d_loghdr)) / RECSIZE;
+
+   struct lsm303d_loghdr *hdr = cap->hdr;
+   if(hdr->magic != LSM303D_LOG_MAGIC || hdr->version != LSM303D_LOG_VERSION
+      || hdr->hdrsize != sizeof(struct lsm303d_loghdr) || hdr->recsize != RECSIZE
+      || !(hdr->flags & LSM303D_LOG_ACC) || hdr->count > cap->slots) {
+      printf("Error: %s is not a version %d capture file.\n", file, LSM303D_LOG_VERSION);
+      capture_close(cap);
+      return(-1);
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * capture_close() syncs a written capture file and trims the   *
+ * unused slots, then unmaps it, or frees the memory buffer.    *
+ * ------------------------------------------------------------ */
+void capture_close(struct lsm303d_capture *cap) {
+   if(cap->map == NULL) return;
+   if(cap->fd < 0) {
+      free(cap->map);
+      cap->map = NULL;
+      return;
+   }
+   if(!cap->rdonly) {
+      size_t size = sizeof(struct lsm303d_loghdr) + cap->hdr->count * RECSIZE;
+      msync(cap->map, cap->mapsize, MS_SYNC);
+      if(ftruncate(cap->fd, size) != 0) printf("Error: could not trim the capture file.\n");
+      if(verbose == 1) printf("Debug: Capture closed, %llu samples, %zu bytes\n",
+                               (unsigned long long) cap->hdr->count, size);
+   }
+   munmap(cap->map, cap->mapsize);
+   close(cap->fd);
+   cap->map = NULL;
+}
@@ -0,0 +1,196 @@
+/* ------------------------------------------------------------ *
+ * file:        convert_lsm303d.c                               *
+ * purpose:     Range-aware conversion of raw LSM303D samples.  *
+ *              Buffered samples stay raw int16 in compact SoA  *
+ *              buffers, one array per channel. Conversion to   *
+ *              milli Gauss / milli g runs as one vectorizable  *
+ *              pass per channel with the per-range sensitivity *
+ *              and calibration, into float32 or Q15 output.    *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "lsm303d.h"
+
+/* ------------------------------------------------------------ *
+ * Sensitivity per LSB from the datasheet table 3, indexed by   *
+ * the CTRL6 MFS[1:0] and CTRL2 AFS[2:0] full scale codes.      *
+ * ------------------------------------------------------------ */
+static const float mag_sens[4] = { 0.080, 0.160, 0.320, 0.479 }; // mgauss: 2/4/8/12 gauss
+static const float acc_sens[5] = { 0.061, 0.122, 0.183, 0.244, 0.732 }; // mg: 2/4/6/8/16 g
+static const int mag_fs[4] = { 2000, 4000, 8000, 12000 };       // full scale in mgauss
+static const int acc_fs[5] = { 2000, 4000, 6000, 8000, 16000 }; // full scale in mg
+
+/* ------------------------------------------------------------ *
+ * lsm303d_calib_set() sets the full scale range codes and the  *
+ * per-axis sensitivities of cal, keeping its offsets and the   *
+ * soft-iron matrix. The mag hard-iron offset is taken from the *
+ * device offset[]. Returns 0 on success, -1 for an invalid     *
+ * range code.                                                  *
+ * ------------------------------------------------------------ */
+int lsm303d_calib_set(struct lsm303d_calib *cal, int mfs, int afs) {
+   if(mfs < 0 || mfs > 3 || afs < 0 || afs > 4) {
+      printf("Error: invalid full scale code MFS %d AFS %d\n", mfs, afs);
+      return(-1);
+   }
+   cal->mfs = mfs;
+   cal->afs = afs;
+   for(int i=0; i<3; i++) {
+      cal->mag_sens[i] = mag_sens[mfs];
+      cal->acc_sens[i] = acc_sens[afs];
+      cal->mag_off[i]  = lsm303d->offset[i];
+   }
+   if(verbose == 1) printf("Debug: Scale +/-%d mgauss %.3f/LSB, +/-%d mg %.3f/LSB\n",
+                            mag_fs[mfs], mag_sens[mfs], acc_fs[afs], acc_sens[afs]);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_get_scale() reads the full scale settings CTRL2 AFS  *
+ * and CTRL6 MFS back from the sensor, in one burst read into   *
+ * the register shadow, and updates the active calibration.     *
+ * Returns 0 or -1 on error.                                    *
+ * ------------------------------------------------------------ */
+int lsm303d_get_scale() {
+   if(shadow_fetch(LSM303D_CTRL2, LSM303D_CTRL6) != 0) return(-1);
+   int afs = (lsm303d->shadow.reg[LSM303D_CTRL2] >> LSM303D_AFS_SHIFT) & 0x07;
+   int mfs = (lsm303d->shadow.reg[LSM303D_CTRL6] >> LSM303D_MFS_SHIFT) & 0x03;
+   if(afs > 4) afs = 0;  // AFS 101..111 are not defined
+   return lsm303d_calib_set(&lsm303d->cal, mfs, afs);
+}
+
+/* ------------------------------------------------------------ *
+ * soa_init() allocates a raw SoA buffer for cap samples as one *
+ * block, each channel array starting on a cache line boundary.*
+ * Returns 0 on success, -1 on error.                           *
+ * ------------------------------------------------------------ */
+int soa_init(struct lsm303d_soa *soa, int cap) {
+   int stride = (cap + 31) & ~31;  // 32 int16 = one 64 byte cache line
+
+   memset(soa, 0, sizeof(struct lsm303d_soa));
+   if(cap < 1 || posix_memalign((void **) &soa->data, LSM303D_CACHELINE,
+                                LSM303D_SOA_CH * stride * sizeof(int16_t)) != 0) {
+      printf("Error: could not allocate %d SoA samples.\n", cap);
+      soa->data = NULL;
+      return(-1);
+   }
+   soa->cap    = cap;
+   soa->stride = stride;
+   for(int i=0; i<3; i++) {
+      soa->mag[i] = soa->data + i * stride;
+      soa->acc[i] = soa->data + (3 + i) * stride;
+   }
+   soa->temp = soa->data + 6 * stride;
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * soa_free() releases the SoA buffer                           *
+ * ------------------------------------------------------------ */
+void soa_free(struct lsm303d_soa *soa) {
+   free(soa->data);
+   soa->data = NULL;
+   soa->n = soa->cap = 0;
+}
+
+/* ------------------------------------------------------------ *
+ * soa_push() appends one raw sample. Samples come at the fixed *
+ * schedule or FIFO rate, so only the first timestamp is kept.  *
+ * Returns 0 on success, -1 if the buffer is full.              *
+ * ------------------------------------------------------------ */
+int soa_push(struct lsm303d_soa *soa, const struct lsm303draw *raw) {
+   int i = soa->n;
+   if(i >= soa->cap) return(-1);
+   if(i == 0) soa->t0 = raw->ts;
+   soa->mag[0][i] = raw->mag[0];
+   soa->mag[1][i] = raw->mag[1];
+   soa->mag[2][i] = raw->mag[2];
+   soa->acc[0][i] = raw->acc[0];
+   soa->acc[1][i] = raw->acc[1];
+   soa->acc[2][i] = raw->acc[2];
+   soa->temp[i]   = raw->temp;
+   soa->n = i + 1;
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * convert_f32() one channel to float32: out = in * sens - off  *
+ * ------------------------------------------------------------ */
+void convert_f32(const int16_t *restrict in, float *restrict out, int n,
+                 float sens, float off) {
+   for(int i=0; i<n; i++) out[i] = (float) in[i] * sens - off;
+}
+
+/* ------------------------------------------------------------ *
+ * convert_q15() one channel to Q15 fixed point with rounding:  *
+ * out = sat16(((in - off) * gain) >> 15), where off is in LSB  *
+ * and gain in Q15 (32768 = 1.0). Gains up to 1.9 cannot        *
+ * overflow the 32 bit product.                                 *
+ * ------------------------------------------------------------ */
+void convert_q15(const int16_t *restrict in, int16_t *restrict out, int n,
+                 int32_t gain, int16_t off) {
+   for(int i=0; i<n; i++) {
+      int32_t q = ((in[i] - off) * gain + 16384) >> 15;
+      q = (q > 32767) ? 32767 : q;
+      q = (q < -32768) ? -32768 : q;
+      out[i] = (int16_t) q;
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * soa_convert_f32() converts all samples of a raw SoA buffer   *
+ * with cal. out holds LSM303D_SOA_CH * soa->stride floats, in  *
+ * the buffer channel order: mag X Y Z in milli Gauss, acc X Y  *
+ * Z in milli g, temperature in degrees Celsius.                *
+ * ------------------------------------------------------------ */
+void soa_convert_f32(const struct lsm303d_soa *soa, const struct lsm303d_calib *cal,
+                     float *out) {
+   int s = soa->stride;
+   for(int i=0; i<3; i++) {
+      convert_f32(soa->mag[i], out + i * s, soa->n, cal->mag_sens[i], cal->mag_off[i]);
+      convert_f32(soa->acc[i], out + (3 + i) * s, soa->n, cal->acc_sens[i], cal->acc_off[i]);
+   }
+   convert_f32(soa->temp, out + 6 * s, soa->n, 1 / LSM303D_TEMP_LSB, -25.0f);
+
+   /* soft-iron correction mixes the magnetic channels, skipped */
+   /* while the matrix is the identity (no calibration applied) */
+   const float (*si)[3] = cal->mag_si;
+   if(si[0][0] == 1 && si[1][1] == 1 && si[2][2] == 1 && si[0][1] == 0 &&
+      si[0][2] == 0 && si[1][0] == 0 && si[1][2] == 0 && si[2][0] == 0 && si[2][1] == 0)
+      return;
+   float *restrict x = out, *restrict y = out + s, *restrict z = out + 2 * s;
+   for(int i=0; i<soa->n; i++) {
+      float mx = x[i], my = y[i], mz = z[i];
+      x[i] = si[0][0] * mx + si[0][1] * my + si[0][2] * mz;
+      y[i] = si[1][0] * mx + si[1][1] * my + si[1][2] * mz;
+      z[i] = si[2][0] * mx + si[2][1] * my + si[2][2] * mz;
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * soa_convert_q15() converts the magnetic and acceleration     *
+ * channels of a raw SoA buffer with cal into Q15, where 1.0 is *
+ * 32768 LSB at the nominal sensitivity of the range (e.g. 5243 *
+ * mgauss at +/-4 gauss). out holds 6 * soa->stride values, in  *
+ * the buffer channel order. The temperature stays raw, it is   *
+ * already fixed point (1/8 degree per LSB). Only the diagonal  *
+ * of the soft-iron matrix applies, as a per-axis gain.         *
+ * ------------------------------------------------------------ */
+void soa_convert_q15(const struct lsm303d_soa *soa, const struct lsm303d_calib *cal,
+                     int16_t *out) {
+   int s = soa->stride;
+   for(int i=0; i<3; i++) {
+      /* the Q15 gain is the axis sensitivity relative to the  */
+      /* nominal one, i.e. the soft-iron / scale correction     */
+      float mg = cal->mag_sens[i] * cal->mag_si[i][i] / mag_sens[cal->mfs];
+      float ag = cal->acc_sens[i] / acc_sens[cal->afs];
+      convert_q15(soa->mag[i], out + i * s, soa->n, lrintf(32768 * mg),
+                  lrintf(cal->mag_off[i] / cal->mag_sens[i]));
+      convert_q15(soa->acc[i], out + (3 + i) * s, soa->n, lrintf(32768 * ag),
+                  lrintf(cal->acc_off[i] / cal->acc_sens[i]));
+   }
+}
@@ -0,0 +1,54 @@
+/* ------------------------------------------------------------ *
+ * file:        dev_lsm303d.c                                   *
+ * purpose:     Per-device contexts. The driver state of each   *
+ *              sensor, transport, interrupt line, calibration, *
+ *              register shadow and cache record, lives in its  *
+ *              struct lsm303d_dev. Each thread selects the     *
+ *              device its driver calls work on, so one thread  *
+ *              per bus can run several sensors in parallel.    *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "lsm303d.h"
+
+/* ------------------------------------------------------------ *
+ * Context defaults: address 0x1d, INT2 carries DRDY and FTH,   *
+ * the range and calibration lsm303d_init() writes, and 3 bus   *
+ * retries after 1, 2 and 4 ms, the last one after a reset.     *
+ * ------------------------------------------------------------ */
+#define DEV_DEFAULTS {                                          \
+   .addr = 0x1d, .irqpin = 2,                                   \
+   .cal = { .mfs = 1, .afs = 0,                                 \
+            .mag_sens = { 0.160, 0.160, 0.160 },                \
+            .acc_sens = { 0.061, 0.061, 0.061 },                \
+            .mag_si   = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } } }, \
+   .recovery = { .retries = 3, .backoff = 1000000,              \
+                 .backoff_max = 100000000, .reset = 1,          \
+                 .stall = 4, .maxfail = 10 },                   \
+}
+
+/* ------------------------------------------------------------ *
+ * global variables, declared in lsm303d.h                      *
+ * ------------------------------------------------------------ */
+struct lsm303d_dev lsm303d_dev0 = DEV_DEFAULTS;       // default device
+__thread struct lsm303d_dev *lsm303d = &lsm303d_dev0; // device of this thread
+
+/* ------------------------------------------------------------ *
+ * lsm303d_dev_init() clears a context to the defaults, with no *
+ * transport open yet.                                          *
+ * ------------------------------------------------------------ */
+void lsm303d_dev_init(struct lsm303d_dev *dev) {
+   static const struct lsm303d_dev defaults = DEV_DEFAULTS;
+   *dev = defaults;
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_select() makes dev the device of all driver calls in *
+ * the calling thread.                                          *
+ * ------------------------------------------------------------ */
+void lsm303d_select(struct lsm303d_dev *dev) {
+   lsm303d = dev;
+}
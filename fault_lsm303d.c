@@ -0,0 +1,154 @@
+/* ------------------------------------------------------------ *
+ * file:        fault_lsm303d.c                                 *
+ * purpose:     Bus fault recovery. Failed transactions are     *
+ *              retried with exponential backoff and a final    *
+ *              transport reset, a sensor that stops delivering *
+ *              data is checked against the register shadow,    *
+ *              and after a brown-out the shadowed configuration*
+ *              is written again. Counters and recovery times   *
+ *              go to the lsm303d_faults of the device.         *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "lsm303d.h"
+
+#define BIT(reg) (1ULL << (reg))
+
+/* ------------------------------------------------------------ *
+ * fault_sleep() waits ns nanoseconds, the retry backoff        *
+ * ------------------------------------------------------------ */
+static void fault_sleep(uint64_t ns) {
+   struct timespec ts = { .tv_sec = ns / 1000000000ULL, .tv_nsec = ns % 1000000000ULL };
+   while(nanosleep(&ts, &ts) != 0);
+}
+
+/* ------------------------------------------------------------ *
+ * fault_latency() adds a recovery that began at t0             *
+ * ------------------------------------------------------------ */
+static void fault_latency(uint64_t t0) {
+   uint64_t lat = mono_ns() - t0;
+   lsm303d->faults.lat_sum += lat;
+   if(lat > lsm303d->faults.lat_max) lsm303d->faults.lat_max = lat;
+}
+
+/* ------------------------------------------------------------ *
+ * fault_retry() recovers a failed transaction: a read into     *
+ * rbuf, or a write of wbuf. Each retry waits for the backoff,  *
+ * which doubles up to backoff_max, the last retry follows a    *
+ * transport reset. Returns 0 if a retry succeeded, LSM303D_EIO *
+ * once all retries failed.                                     *
+ * ------------------------------------------------------------ */
+int fault_retry(uint8_t reg, uint8_t *rbuf, const uint8_t *wbuf, uint16_t len) {
+   struct lsm303d_transport *bus = lsm303d->bus;
+   const struct lsm303d_recovery *pol = &lsm303d->recovery;
+   struct lsm303d_faults *f = &lsm303d->faults;
+   uint64_t t0 = mono_ns();
+   uint64_t backoff = pol->backoff;
+
+   f->errors++;
+   for(int i=1; i<=pol->retries; i++) {
+      fault_sleep(backoff);
+      backoff = (2 * backoff < pol->backoff_max) ? 2 * backoff : pol->backoff_max;
+      if(i == pol->retries && pol->reset && bus->reset != NULL) {
+         f->resets++;
+         if(verbose == 1) printf("Debug: Bus fault, reset the %s transport\n", bus->name);
+         if(bus->reset(bus->priv) != 0) continue;
+      }
+      f->retries++;
+      stats_retry();
+      uint64_t t1 = mono_ns();
+      int res = (rbuf != NULL) ? bus->read_regs(bus->priv, reg, rbuf, len)
+                               : bus->write_regs(bus->priv, reg, wbuf, len);
+      stats_xfer(rbuf == NULL, len, mono_ns() - t1, res);
+      if(res == 0) {
+         f->recovered++;
+         fault_latency(t0);
+         if(verbose == 1) printf("Debug: Bus fault at register 0x%02X cleared after %d retries\n",
+                                  reg, i);
+         return(0);
+      }
+   }
+   f->failures++;
+   f->last_err = LSM303D_EIO;
+   printf("Error: I2C %s failure for register 0x%02X len %d after %d retries\n",
+          (rbuf != NULL) ? "read" : "write", reg, len, pol->retries);
+   return(LSM303D_EIO);
+}
+
+/* ------------------------------------------------------------ *
+ * fault_stall_ns() returns the data-ready timeout: stall       *
+ * periods of the shadowed M_ODR, or 1 second if it is unknown. *
+ * ------------------------------------------------------------ */
+uint64_t fault_stall_ns() {
+   if(!(lsm303d->shadow.known & BIT(LSM303D_CTRL5))) return 1000000000ULL;
+   int modr = (lsm303d->shadow.reg[LSM303D_CTRL5] >> LSM303D_MODR_SHIFT) & 0x07;
+   if(modr > 5) return 1000000000ULL;
+   return lsm303d->recovery.stall * (320000000ULL >> modr); // 3.125 Hz << modr
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_check() compares WHO_AM_I and CTRL0..CTRL7 with the  *
+ * shadow. After a brown-out, all shadowed registers are dirty  *
+ * again and go out in one commit. Returns 0 if the sensor has  *
+ * its configuration (again), or an LSM303D_E code.             *
+ * ------------------------------------------------------------ */
+int lsm303d_check() {
+   struct lsm303d_shadow *sh = &lsm303d->shadow;
+   uint8_t id = 0, ctrl[8];
+
+   if(lsm303d_read_regs(LSM303D_WHO_AM_I, &id, 1) != 0) return(LSM303D_EIO);
+   if(id != PRD_ID) {
+      printf("Error: WHO_AM_I 0x%02X, expected 0x%02X\n", id, PRD_ID);
+      lsm303d->faults.last_err = LSM303D_ENODEV;
+      return(LSM303D_ENODEV);
+   }
+   if(lsm303d_read_regs(LSM303D_CTRL0, ctrl, 8) != 0) return(LSM303D_EIO);
+
+   int lost = 0;
+   for(int i=0; i<8; i++) {
+      uint8_t mask = (i == 0) ? ~LSM303D_CTRL0_BOOT : 0xFF;
+      if((sh->known & BIT(LSM303D_CTRL0 + i))
+         && (ctrl[i] & mask) != (sh->reg[LSM303D_CTRL0 + i] & mask)) lost = 1;
+   }
+   if(lost == 0) return(0);
+
+   lsm303d->faults.reinits++;
+   if(verbose == 1) printf("Debug: CTRL registers lost, brown-out: write the configuration\n");
+   sh->dirty |= sh->known;
+   if(shadow_commit() != 0) return(LSM303D_EIO);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * fault_stall() handles a sensor without data-ready since t0.  *
+ * Returns 0 after a brown-out was repaired, LSM303D_ESTALL if  *
+ * the configuration is intact, or the error of the check.      *
+ * ------------------------------------------------------------ */
+int fault_stall(uint64_t t0) {
+   uint64_t reinits = lsm303d->faults.reinits;
+   lsm303d->faults.stalls++;
+   int res = lsm303d_check();
+   if(res != 0) return(res);
+   if(lsm303d->faults.reinits == reinits) {
+      lsm303d->faults.last_err = LSM303D_ESTALL;
+      return(LSM303D_ESTALL);
+   }
+   fault_latency(t0);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_strerror() returns the text of an LSM303D_E code     *
+ * ------------------------------------------------------------ */
+const char *lsm303d_strerror(int err) {
+   switch(err) {
+      case 0:              return "no error";
+      case LSM303D_EIO:    return "bus transaction failed";
+      case LSM303D_ENODEV: return "sensor does not answer WHO_AM_I";
+      case LSM303D_ESTALL: return "sensor delivers no data";
+      default:             return "unknown error";
+   }
+}
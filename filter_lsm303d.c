@@ -0,0 +1,188 @@
+/* ------------------------------------------------------------ *
+ * file:        filter_lsm303d.c                                *
+ * purpose:     Filter chain on raw samples: moving average,    *
+ *              running median against spikes, first-order IIR *
+ *              low-pass and N:1 decimation. All stages work in *
+ *              integer arithmetic on int16 samples with int32  *
+ *              sums and states, in fixed windows per channel.  *
+ *              The -c acquisition can sample fast and pass     *
+ *              only the filtered, decimated stream on.         *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lsm303d.h"
+
+/* ------------------------------------------------------------ *
+ * Stage names and the range of their argument                  *
+ * ------------------------------------------------------------ */
+static const struct {
+   const char *name;
+   enum lsm303d_filt_type type;
+   int min, max;
+} filt_names[] = {
+   { "avg", FILT_AVG, 1, LSM303D_FILT_WIN },
+   { "med", FILT_MED, 1, LSM303D_FILT_WIN - 1 },
+   { "iir", FILT_IIR, 1, 12 },
+   { "dec", FILT_DEC, 1, 1000 },
+};
+
+/* ------------------------------------------------------------ *
+ * filter_parse() builds a chain from a comma separated list of *
+ * stages name:n, e.g. "med:5,avg:8,dec:8". Returns 0 on        *
+ * success, -1 on a bad stage.                                  *
+ * ------------------------------------------------------------ */
+int filter_parse(struct lsm303d_filter *f, const char *spec) {
+   char buf[256];
+   char *save = NULL;
+
+   memset(f, 0, sizeof(struct lsm303d_filter));
+   f->dec = 1;
+   if(strlen(spec) >= sizeof(buf)) {
+      printf("Error: filter chain %s to long.\n", spec);
+      return(-1);
+   }
+   strcpy(buf, spec);
+   for(char *tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+      char *arg = strchr(tok, ':');
+      char *end = NULL;
+      int i, n = 0;
+      if(arg != NULL) {
+         *arg++ = '\0';
+         n = strtol(arg, &end, 10);
+      }
+      for(i=0; i<4 && strcmp(tok, filt_names[i].name) != 0; i++);
+      if(i == 4 || arg == NULL || *end != '\0' || n < filt_names[i].min || n > filt_names[i].max
+         || (filt_names[i].type == FILT_MED && n % 2 == 0)) {
+         printf("Error: invalid filter stage %s, use avg:1..%d, med:1..%d (odd), iir:1..12, dec:1..1000.\n",
+                tok, LSM303D_FILT_WIN, LSM303D_FILT_WIN - 1);
+         return(-1);
+      }
+      if(f->nstages == LSM303D_FILT_STAGES) {
+         printf("Error: more than %d filter stages.\n", LSM303D_FILT_STAGES);
+         return(-1);
+      }
+      f->stage[f->nstages].type = filt_names[i].type;
+      f->stage[f->nstages].n = n;
+      if(filt_names[i].type == FILT_DEC) f->dec *= n;
+      f->nstages++;
+      if(verbose == 1) printf("Debug: filter stage %d %s:%d\n", f->nstages, tok, n);
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * filter_reset() empties all windows, the next sample starts   *
+ * the chain again like the first one.                          *
+ * ------------------------------------------------------------ */
+void filter_reset(struct lsm303d_filter *f) {
+   for(int s=0; s<f->nstages; s++) {
+      struct lsm303d_stage *st = &f->stage[s];
+      st->fill = st->pos = 0;
+      st->status_m = st->status_a = 0;
+      memset(st->acc, 0, sizeof(st->acc));
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * div_round() divides with rounding to nearest, also for the   *
+ * negative sums, where C division truncates towards zero.      *
+ * ------------------------------------------------------------ */
+static int16_t div_round(int32_t sum, int n) {
+   return (int16_t) ((sum >= 0) ? (sum + n / 2) / n : (sum - n / 2) / n);
+}
+
+/* ------------------------------------------------------------ *
+ * stage_avg() replaces the oldest window value, the sum stays  *
+ * exact, so the average costs O(1) per channel. Until the      *
+ * window is full, it averages the samples it has.              *
+ * ------------------------------------------------------------ */
+static void stage_avg(struct lsm303d_stage *st, int16_t *x) {
+   int full = (st->fill == st->n);
+   for(int c=0; c<LSM303D_FILT_CH; c++) {
+      if(full) st->acc[c] -= st->win[c][st->pos];
+      st->acc[c] += x[c];
+      st->win[c][st->pos] = x[c];
+      x[c] = div_round(st->acc[c], full ? st->n : st->fill + 1);
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * stage_med() keeps each window sorted next to its arrival     *
+ * order: the oldest value leaves the sorted copy, the new one  *
+ * is inserted, O(n) per channel with n <= 31, no allocation.   *
+ * ------------------------------------------------------------ */
+static void stage_med(struct lsm303d_stage *st, int16_t *x) {
+   for(int c=0; c<LSM303D_FILT_CH; c++) {
+      int16_t *s = st->sorted[c];
+      int m = st->fill, i;
+      if(m == st->n) {
+         int16_t old = st->win[c][st->pos];
+         for(i=0; s[i] != old; i++);
+         for(; i<m-1; i++) s[i] = s[i+1];
+         m--;
+      }
+      for(i=m; i>0 && s[i-1] > x[c]; i--) s[i] = s[i-1];
+      s[i] = x[c];
+      st->win[c][st->pos] = x[c];
+      x[c] = s[(m + 1) / 2];
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * stage_iir() is the low-pass y += (x - y) >> k, with the      *
+ * state in 8 fraction bits so small steps do not get lost. The *
+ * first sample sets the state.                                 *
+ * ------------------------------------------------------------ */
+static void stage_iir(struct lsm303d_stage *st, int16_t *x) {
+   for(int c=0; c<LSM303D_FILT_CH; c++) {
+      int32_t in = (int32_t) x[c] * 256;
+      if(st->fill == 0) st->acc[c] = in;
+      else st->acc[c] += (in - st->acc[c]) >> st->n;
+      x[c] = (int16_t) ((st->acc[c] + 128) >> 8);
+   }
+   st->fill = 1;
+}
+
+/* ------------------------------------------------------------ *
+ * filter_run() passes raw through the chain. Returns 1 if raw  *
+ * now holds a filtered sample, or 0 if a dec stage held it     *
+ * back. A passed sample keeps the read time of the last input, *
+ * and the status bits of the samples a dec stage dropped, so   *
+ * overruns stay visible.                                       *
+ * ------------------------------------------------------------ */
+int filter_run(struct lsm303d_filter *f, struct lsm303draw *raw) {
+   int16_t x[LSM303D_FILT_CH] = { raw->mag[0], raw->mag[1], raw->mag[2],
+                                  raw->acc[0], raw->acc[1], raw->acc[2], raw->temp };
+   int out = 1;
+
+   for(int s=0; s<f->nstages && out; s++) {
+      struct lsm303d_stage *st = &f->stage[s];
+      switch(st->type) {
+         case FILT_AVG: stage_avg(st, x); break;
+         case FILT_MED: stage_med(st, x); break;
+         case FILT_IIR: stage_iir(st, x); continue;
+         case FILT_DEC:
+            st->status_m |= raw->status_m;
+            st->status_a |= raw->status_a;
+            if(++st->fill < st->n) out = 0;
+            else {
+               raw->status_m = st->status_m;
+               raw->status_a = st->status_a;
+               st->fill = st->status_m = st->status_a = 0;
+            }
+            continue;
+      }
+      st->pos = (st->pos + 1 == st->n) ? 0 : st->pos + 1;
+      if(st->fill < st->n) st->fill++;
+   }
+   for(int i=0; i<3; i++) {
+      raw->mag[i] = x[i];
+      raw->acc[i] = x[3 + i];
+   }
+   raw->temp = x[6];
+   return out;
+}
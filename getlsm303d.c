@@ -10,7 +10,7 @@
  *                                                              *
  * compile:	gcc -o getlsm303d i2c_lsm303d.c getlsm303d.c    *
  *                                                              *
- * example:	./getlsm303d -t -o lsm303d.htm                  *
+ * example:	./getlsm303d -c 5 -o lsm303d.log                *
  *                                                              *
  * author:      09/09/2021 Frank4DD                             *
  * ------------------------------------------------------------ */
@@ -22,39 +22,118 @@
 #include <string.h>
 #include <getopt.h>
 #include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <math.h>
 #include "lsm303d.h"
 
 /* ------------------------------------------------------------ *
  * Global variables and defaults                                *
  * ------------------------------------------------------------ */
 int verbose = 0;
-int outflag = 0;
+int outflag = 0;          // 1 = -o raw sample log, 2 = -o -z archive
+int zflag = 0;            // -z delta compressed archive
+int daemonflag = 0;       // -D publish samples to shared memory
+struct lsm303d_shm *shm = NULL; // -D shared memory segment
+char srv_path[108] = {0};  // -S unix domain socket, empty = no server
+struct lsm303d_srv srv;         // -S subscriber server
+int decl_flag = 0;        // -l given, else the cached declination applies
+int verifyflag = 0;       // -V read back each register commit
 int argflag = 0;          // 1=dump, 2=info, 3=reset, 4=data, 5=continuous
-                          // 6=set_ cont_read_freq
+                          // 6=set_ cont_read_freq, 7=FIFO stream, 8=calibrate
+                          // 9=high-rate accel capture, 10=replay
 int cm_status = 0;        // continuous read mode enabler on/off
 int cmfreq_mode = 0;      // continuous read frequency mode setting
+int fifo_wtm = 0;         // FIFO stream watermark level 1..31
+int cap_aodr = 0;         // -a capture AODR code 1..10
+int cap_abw = 0;          // -a capture anti-alias bandwidth ABW 0..3
+double cap_sec = 10;      // -n capture length in seconds
+char replay_file[256] = {0}; // -R recorded samples to replay
+double replay_speed = 0;  // -R replay speed, 0 = as fast as possible
 int noboost_status = 0;   // No Boost CAP setting
 int outres_mode = 0;      // output resolution mode
 char outres_set[4] = {0}; // set output resolution mode value
 char status[7]    = {0};  // device status
-char i2c_bus[256] = I2CBUS;
-char htmfile[256] = {0};
+char i2c_bus[LSM303D_MAX_DEVS][256];  // -b sensor buses
+char i2c_addr[LSM303D_MAX_DEVS][8];   // -b sensor addresses
+int ndevs = 0;                        // -b sensors given
+struct lsm303d_dev devs[LSM303D_MAX_DEVS]; // sensor contexts
+float decl_arg = 0;       // -l local declination value
+char irq_line[256] = {0};  // -g interrupt line, empty = status polling
+char logfile[256] = {0};  // -o binary sample log
+uint64_t log_limit = 0;    // -w log size in bytes before wrap, 0 = grow
+volatile sig_atomic_t stop = 0; // set by SIGINT/SIGTERM to end -c/-f loops
+uint32_t ring_size = LSM303D_RING_SIZE; // -q ring buffer slots for -c
+int retries = -1;         // -e bus retries per transaction, -1 = default
+uint64_t backoff = 0;     // -e first retry delay in ns, 0 = default
+char stats_file[256] = {0}; // -s statistics snapshot file, empty = none
+uint64_t stats_next = 0;  // time of the next -s snapshot
+struct lsm303d_ring ring[LSM303D_MAX_DEVS]; // -c acquisition to consumer samples, per sensor
+struct lsm303d_filter filt[LSM303D_MAX_DEVS]; // -F filter chain, per sensor
+
+/* ------------------------------------------------------------ *
+ * -c acquisition thread of one bus. Its sensors are read one   *
+ * after the other on each tick, all buses share the time grid. *
+ * ------------------------------------------------------------ */
+struct acqbus{
+   int ndev;
+   int dev[LSM303D_MAX_DEVS];   // indices into devs[] and ring[]
+   pthread_t thread;
+   struct lsm303d_sched sched;
+   int res;                     // thread result
+   int done;                    // thread finished
+};
+struct acqbus acq[LSM303D_MAX_DEVS];
+int nacq = 0;
+uint64_t grid_t0 = 0;           // first deadline of all buses
+
+/* ------------------------------------------------------------ *
+ * Sample period in ns for the -c M_ODR codes 0..5              *
+ * ------------------------------------------------------------ */
+static const uint64_t modr_period[6] = { 320000000, 160000000, 80000000,
+                                          40000000,  20000000,  10000000 };
 
 /* ------------------------------------------------------------ *
  * print_usage() prints the programs commandline instructions.  *
  * ------------------------------------------------------------ */
 void usage() {
-   static char const usage[] = "Usage: getlsm303d [-b i2c-bus] [-c 0..3] [-d] [-i] [-m mode] [-t] [-l decl] [-r] [-o htmlfile] [-v]\n\
+   static char const usage[] = "Usage: getlsm303d [-a aodr[:abw]] [-n sec] [-b i2c-bus[@addr]] [-c 0..5] [-D 0..5] [-d] [-f wtm] [-g line] [-i] [-k] [-m mode] [-t] [-l decl] [-r] [-o logfile] [-w MB] [-z] [-q slots] [-S socket] [-e retries[:ms]] [-s statsfile] [-F filters] [-R file[:speed]] [-x] [-V] [-v]\n\
 \n\
 Command line parameters have the following format:\n\
+   -a   high-rate accelerometer capture through the FIFO, AODR code and\n\
+        optional anti-alias filter bandwidth code ABW, examples:\n\
+             -a 8 = 400 Hz, -a 9 = 800 Hz, -a 10 = 1600 Hz\n\
+             -a 10:0 = 1600 Hz with 773 Hz ABW (default), 1 = 194 Hz,\n\
+             2 = 362 Hz, 3 = 50 Hz\n\
+        samples go into a preallocated -o capture file, or into memory and\n\
+        are printed after the capture. 1600 Hz needs a 400 kHz I2C bus\n\
+   -n   -a capture length in seconds, or until ctl-c, example: -n 60 (default 10)\n\
    -b   I2C bus to query, Example: -b /dev/i2c-1 (default)\n\
-   -c   start continuous read with a given frequency 0..3. examples:\n\
-             -c 0 = read at 1.5 Hz (1 sample every 1.5 seconds - default)\n\
-             -c 1 = read at 13 Hz (1 sample every 77 milliseconds)\n\
-             -c 2 = read at 25 Hz (1 sample every 40 milliseconds)\n\
-             -c 3 = read at 50 Hz (1 sample every 20 milliseconds)\n\
+        -b sim uses a simulated sensor, -b sim:1 runs it in real time\n\
+        @addr selects the sensor address 0x1d (default) or 0x1e, repeat -b\n\
+        for several sensors with -t/-c, example: -b /dev/i2c-1 -b /dev/i2c-1@0x1e\n\
+   -c   start continuous read with a given frequency 0..5, until ctl-c. examples:\n\
+             -c 0 = read at 3.125 Hz (1 sample every 320 milliseconds)\n\
+             -c 1 = read at 6.25 Hz (1 sample every 160 milliseconds)\n\
+             -c 2 = read at 12.5 Hz (1 sample every 80 milliseconds)\n\
+             -c 3 = read at 25 Hz (1 sample every 40 milliseconds)\n\
+             -c 4 = read at 50 Hz (1 sample every 20 milliseconds)\n\
+             -c 5 = read at 100 Hz (1 sample every 10 milliseconds)\n\
+        the accelerometer rate AODR is raised to at least the same rate\n\
+   -D   daemon mode: own the sensor, sample like -c, and publish the latest\n\
+        sample and heading to shared memory %s, until ctl-c/SIGTERM.\n\
+        -t then reads the daemon value instead of the sensor.\n\
    -d   dump the complete sensor register map content\n\
+   -f   stream accelerometer data at 100 Hz through the 32-level FIFO,\n\
+        draining it in one burst per watermark level 1..31, example: -f 16\n\
+   -g   wait for data-ready/FIFO watermark on a sensor interrupt pin wired to\n\
+        a GPIO line, instead of polling the status register (requires -t/-c/-f).\n\
+        format <gpiochip>:<line>[:<pin>], pin 1=INT1, 2=INT2 (default),\n\
+        example: -g /dev/gpiochip0:17, or -g sim with the simulated sensor\n\
    -i   print sensor information\n\
+   -k   calibrate the magnetometer hard- and soft-iron offsets, rotate the\n\
+        sensor through all orientations until the coverage reaches 90%%,\n\
+        or stop with ctl-c\n\
    -l   local declination offset value (requires -t/-c), example: -l 7.73\n\
         see http://www.ngdc.noaa.gov/geomag-web/#declination\n\
    -m   set sensor output resolution mode. arguments: 12/14/16/16h. examples:\n\
@@ -64,23 +143,60 @@ Command line parameters have the following format:\n\
              -m 16h  = output resolution 16 bit (7.92ms read time)\n\
    -r   reset sensor\n\
    -t   take a single measurement\n\
-   -o   output data to HTML table file (requires -t/-c), example: -o ./lsm303d.html\n\
+   -o   write raw samples to a binary log file (requires -t/-c/-a/-R), read it with\n\
+        loglsm303d, example: -o ./lsm303d.log\n\
+   -w   wrap the -o log at a size limit in MB, overwriting the oldest samples,\n\
+        example: -w 512 (default: grow without limit)\n\
+   -z   write the -o log as a delta compressed archive, about 8 bytes per\n\
+        sample instead of 24, no size limit\n\
+   -q   ring buffer slots between the -c acquisition and output threads,\n\
+        rounded up to a power of 2, example: -q 4096 (default 1024)\n\
+   -S   serve the -c/-D samples on a unix domain socket, example: -S %s\n\
+        clients send \"SUB <Hz> [bin|text] [skip|drop]\\n\" to subscribe\n\
+   -e   bus fault recovery: retries of a failed transaction, the last one\n\
+        after a bus re-open, and the first backoff in ms, doubling per retry,\n\
+        example: -e 5:2 (default 3:1), -e 0 gives up at the first failure.\n\
+        -b sim,nack=<rate>[:<len>],brownout=<sec> injects faults\n\
+   -s   bus and sample statistics of -c/-D: write a JSON snapshot to statsfile\n\
+        every second, and print the counters and latency histograms at the end,\n\
+        example: -s /tmp/lsm303d.stats\n\
+   -F   filter the -c/-D raw samples before the output, a comma separated\n\
+        chain of avg:n moving average, med:n running median (n odd),\n\
+        iir:k low-pass with gain 1/2^k, and dec:n keeping every n-th sample,\n\
+        example: -c 5 -F med:3,avg:10,dec:10 outputs 10 Hz from 100 Hz\n\
+   -R   replay a -o log, archive or -a capture, or a loglsm303d -r CSV, through\n\
+        the -F filters, conversion and heading, without the sensor. The cached\n\
+        calibration of the -b sensor replaces the recorded one. speed 0 runs as\n\
+        fast as possible (default), 1 at the original timing, n at n times,\n\
+        example: -R ./lsm303d.log:10 -F avg:10,dec:10 -o ./lsm303d-10hz.log\n\
+   -x   invalidate the cached calibration and configuration of the sensor\n\
+   -V   verify register writes: read each configuration commit back\n\
    -h   display this message\n\
    -v   enable debug output\n\
 \n\
 \n\
 Usage examples:\n\
 ./getlsm303d -b /dev/i2c-0 -i\n\
+./getlsm303d -b sim -t -v\n\
 ./getlsm303d -t -v\n\
 ./getlsm303d -c 1\n\
-./getlsm303d -t -l 7.73 -o ./lsm303d.html\n\n";
-   printf(usage);
+./getlsm303d -b /dev/i2c-1 -b /dev/i2c-1@0x1e -b /dev/i2c-3 -c 4\n\
+./getlsm303d -D 5 -l 7.73 &\n\
+./getlsm303d -D 5 -S /tmp/lsm303d.sock &\n\
+./getlsm303d -c 5 -l 7.73 -o ./lsm303d.log -w 512\n\
+./getlsm303d -c 5 -F med:5,iir:3,dec:4\n\
+./getlsm303d -a 10:0 -n 60 -o ./vibration.cap\n\
+./getlsm303d -R ./lsm303d.log -F med:5 > lsm303d.txt\n\
+./getlsm303d -b sim:1,nack=0.01:5,brownout=10 -c 5 -e 4:1\n\n";
+   printf(usage, LSM303D_SHM_NAME, LSM303D_SRV_PATH);
 }
 
 /* ------------------------------------------------------------ *
  * parseargs() checks the commandline arguments with C getopt   *
  * -d = argflag 1     -i = argflag 2       -r = argflag 3       *
  * -t = argflag 4     -c = argflag 5       -o = outflag 1       *
+ * -f = argflag 7     -k = argflag 8       -a = argflag 9       *
+ * -R = argflag 10                                              *
  * ------------------------------------------------------------ */
 void parseargs(int argc, char* argv[]) {
    int arg;
@@ -88,29 +204,70 @@ void parseargs(int argc, char* argv[]) {
 
    if(argc == 1) { usage(); exit(-1); }
 
-   while ((arg = (int) getopt (argc, argv, "b:c:dil:m:rto:hv")) != -1) {
+   while ((arg = (int) getopt (argc, argv, "a:b:c:D:de:F:f:g:ikl:m:n:rR:to:q:s:S:w:xzhVv")) != -1) {
       switch (arg) {
+         // arg -a high-rate accel capture, type: string aodr[:abw], example 10:0
+         case 'a':
+            if(verbose == 1) printf("Debug: arg -a, value %s\n", optarg);
+            argflag = 9;
+            char *rest;
+            cap_aodr = strtol(optarg, &rest, 10);
+            if(*rest == ':') cap_abw = strtol(rest + 1, &rest, 10);
+            if(*rest != '\0' || cap_aodr < 1 || cap_aodr > 10 || cap_abw < 0 || cap_abw > 3) {
+               printf("Error: capture arg must be aodr 1..10 with optional :abw 0..3.\n");
+               exit(-1);
+            }
+            break;
+
          // arg -b + I2C bus device name, type: string, example: "/dev/i2c-1"
          case 'b':
             if(verbose == 1) printf("Debug: arg -b, value %s\n", optarg);
-            if (strlen(optarg) >= sizeof(i2c_bus)) {
+            if (strlen(optarg) >= sizeof(i2c_bus[0])) {
                printf("Error: I2C bus argument to long.\n");
                exit(-1);
             }
-            strncpy(i2c_bus, optarg, sizeof(i2c_bus));
+            if (ndevs == LSM303D_MAX_DEVS) {
+               printf("Error: more than %d sensors.\n", LSM303D_MAX_DEVS);
+               exit(-1);
+            }
+            strncpy(i2c_bus[ndevs], optarg, sizeof(i2c_bus[0]));
+            strcpy(i2c_addr[ndevs], I2C_ADDR);
+            char *at = strchr(i2c_bus[ndevs], '@');
+            if (at != NULL) {
+               *at = '\0';
+               long addr = strtol(at + 1, NULL, 16);
+               if (addr != 0x1d && addr != 0x1e) {
+                  printf("Error: sensor address %s is not 0x1d or 0x1e.\n", at + 1);
+                  exit(-1);
+               }
+               snprintf(i2c_addr[ndevs], sizeof(i2c_addr[0]), "0x%02lx", addr);
+            }
+            ndevs++;
             break;
 
-         // arg -c starts continuous read with given frequency, type: int 0..3
+         // arg -c starts continuous read with given frequency, type: int 0..5
          case 'c':
             if(verbose == 1) printf("Debug: arg -c, value %s\n", optarg);
             argflag = 5;
             if (strlen(optarg) > 1) {
-               printf("Error: continuous read frequency mode arg must be between 0..3.\n");
+               printf("Error: continuous read frequency mode arg must be between 0..5.\n");
                exit(-1);
             }
             cmfreq_mode = atoi(optarg);
-            if(cmfreq_mode < 0 || cmfreq_mode > 3) {
-               printf("Error: continuous read frequency mode arg must be between 0..3.\n");
+            if(cmfreq_mode < 0 || cmfreq_mode > 5) {
+               printf("Error: continuous read frequency mode arg must be between 0..5.\n");
+               exit(-1);
+            }
+            break;
+
+         // arg -D daemon mode, the -c loop publishing to shared memory
+         case 'D':
+            if(verbose == 1) printf("Debug: arg -D, value %s\n", optarg);
+            argflag = 5;
+            daemonflag = 1;
+            cmfreq_mode = atoi(optarg);
+            if(strlen(optarg) > 1 || cmfreq_mode < 0 || cmfreq_mode > 5) {
+               printf("Error: daemon read frequency mode arg must be between 0..5.\n");
                exit(-1);
             }
             break;
@@ -121,18 +278,46 @@ void parseargs(int argc, char* argv[]) {
             argflag = 1;
             break;
 
+         // arg -f streams accel data through the FIFO, type: int 1..31
+         case 'f':
+            if(verbose == 1) printf("Debug: arg -f, value %s\n", optarg);
+            argflag = 7;
+            fifo_wtm = atoi(optarg);
+            if(fifo_wtm < 1 || fifo_wtm > LSM303D_FTH_MASK) {
+               printf("Error: FIFO watermark arg must be between 1..31.\n");
+               exit(-1);
+            }
+            break;
+
+         // arg -g + interrupt line, type: string, example: "/dev/gpiochip0:17"
+         case 'g':
+            if(verbose == 1) printf("Debug: arg -g, value %s\n", optarg);
+            if (strlen(optarg) >= sizeof(irq_line)) {
+               printf("Error: interrupt line argument to long.\n");
+               exit(-1);
+            }
+            strncpy(irq_line, optarg, sizeof(irq_line));
+            break;
+
          // arg -i prints sensor information
          case 'i':
             if(verbose == 1) printf("Debug: arg -i\n");
             argflag = 2;
             break;
 
+         // arg -k runs the magnetometer calibration
+         case 'k':
+            if(verbose == 1) printf("Debug: arg -k\n");
+            argflag = 8;
+            break;
+
          // arg -l sets local declination value, type: float example: 7.37
          case 'l':
             if(verbose == 1) printf("Debug: arg -l\n");
-            declination = atoi(optarg);
+            decl_arg = atof(optarg);
+            decl_flag = 1;
             // Check delination range, value should be between -30..30
-            if (declination < -30.0 || declination > 30.0) {
+            if (decl_arg < -30.0 || decl_arg > 30.0) {
                printf("Error: Cannot get valid -l declination (should be -30..30).\n");
                exit(-1);
             }
@@ -152,6 +337,16 @@ void parseargs(int argc, char* argv[]) {
             strncpy(outres_set, optarg, sizeof(outres_set));
             break;
 
+         // arg -n capture length in seconds, type: float
+         case 'n':
+            if(verbose == 1) printf("Debug: arg -n, value %s\n", optarg);
+            cap_sec = atof(optarg);
+            if(cap_sec <= 0 || cap_sec > 86400) {
+               printf("Error: capture length must be between 0..86400 seconds.\n");
+               exit(-1);
+            }
+            break;
+
          // arg -r
          // optional, resets sensor
          case 'r':
@@ -159,22 +354,113 @@ void parseargs(int argc, char* argv[]) {
             argflag = 3;
             break;
 
+         // arg -R replays recorded samples, type: string file[:speed]
+         case 'R':
+            if(verbose == 1) printf("Debug: arg -R, value %s\n", optarg);
+            argflag = 10;
+            if (strlen(optarg) >= sizeof(replay_file)) {
+               printf("Error: replay file argument to long.\n");
+               exit(-1);
+            }
+            strncpy(replay_file, optarg, sizeof(replay_file));
+            char *colon = strrchr(replay_file, ':');
+            if (colon != NULL) {
+               char *rest;
+               replay_speed = strtod(colon + 1, &rest);
+               if(rest == colon + 1 || *rest != '\0' || replay_speed < 0) {
+                  printf("Error: replay speed %s must be a number >= 0.\n", colon + 1);
+                  exit(-1);
+               }
+               *colon = '\0';
+            }
+            break;
+
          // arg -t reads the sensor data
          case 't':
             if(verbose == 1) printf("Debug: arg -t\n");
             argflag = 4;
             break;
 
-         // arg -o + dst HTML file, type: string, requires -t
-         // writes the sensor output to file. example: /tmp/sensor.htm
+         // arg -o + dst log file, type: string, requires -t/-c/-a/-R
+         // writes raw samples to a binary log. example: /tmp/sensor.log
          case 'o':
             outflag = 1;
             if(verbose == 1) printf("Debug: arg -o, value %s\n", optarg);
-            if (strlen(optarg) >= sizeof(htmfile)) {
-               printf("Error: html file argument to long.\n");
+            if (strlen(optarg) >= sizeof(logfile)) {
+               printf("Error: log file argument to long.\n");
                exit(-1);
             }
-            strncpy(htmfile, optarg, sizeof(htmfile));
+            strncpy(logfile, optarg, sizeof(logfile));
+            break;
+
+         // arg -w log size limit in MB, type: int
+         case 'w':
+            if(verbose == 1) printf("Debug: arg -w, value %s\n", optarg);
+            log_limit = strtoull(optarg, NULL, 10) << 20;
+            if(log_limit == 0) {
+               printf("Error: invalid log size limit %s.\n", optarg);
+               exit(-1);
+            }
+            break;
+
+         // arg -q ring buffer slots, type: int
+         case 'q':
+            if(verbose == 1) printf("Debug: arg -q, value %s\n", optarg);
+            ring_size = strtoul(optarg, NULL, 10);
+            if(ring_size < 2 || ring_size > 1048576) {
+               printf("Error: ring buffer slots must be between 2..1048576.\n");
+               exit(-1);
+            }
+            break;
+
+         // arg -F filter chain, type: string, requires -c/-D
+         case 'F':
+            if(verbose == 1) printf("Debug: arg -F, value %s\n", optarg);
+            if(filter_parse(&filt[0], optarg) != 0) exit(-1);
+            break;
+
+         // arg -s statistics snapshot file, type: string, requires -c/-D
+         case 's':
+            if(verbose == 1) printf("Debug: arg -s, value %s\n", optarg);
+            if (strlen(optarg) >= sizeof(stats_file) - 4) {
+               printf("Error: stats file argument to long.\n");
+               exit(-1);
+            }
+            strncpy(stats_file, optarg, sizeof(stats_file));
+            break;
+
+         // arg -S unix domain socket path, type: string, requires -c/-D
+         case 'S':
+            if(verbose == 1) printf("Debug: arg -S, value %s\n", optarg);
+            if (strlen(optarg) >= sizeof(srv_path)) {
+               printf("Error: socket path argument to long.\n");
+               exit(-1);
+            }
+            strncpy(srv_path, optarg, sizeof(srv_path));
+            break;
+
+         // arg -e bus fault retries[:backoff ms], type: int
+         case 'e':
+            if(verbose == 1) printf("Debug: arg -e, value %s\n", optarg);
+            char *end;
+            retries = strtol(optarg, &end, 10);
+            if(*end == ':') backoff = strtoull(end + 1, &end, 10) * 1000000ULL;
+            if(end == optarg || *end != '\0' || retries < 0 || retries > 20) {
+               printf("Error: -e retries must be between 0..20, with an optional :ms backoff.\n");
+               exit(-1);
+            }
+            break;
+
+         // arg -z compressed archive for -o
+         case 'z':
+            if(verbose == 1) printf("Debug: arg -z\n");
+            zflag = 1;
+            break;
+
+         // arg -x invalidates the cache record of the sensor
+         case 'x':
+            if(verbose == 1) printf("Debug: arg -x\n");
+            lsm303d_cache_mode = 2;
             break;
 
          // arg -h usage, type: flag, optional
@@ -182,9 +468,16 @@ void parseargs(int argc, char* argv[]) {
             usage(); exit(0);
             break;
 
+         // arg -V read back register writes, type: flag, optional
+         case 'V':
+            if(verbose == 1) printf("Debug: arg -V\n");
+            verifyflag = 1;
+            break;
+
          // arg -v verbose
          case 'v':
-            verbose = 1; break;
+            verbose = 1;
+            break;
 
          case '?':
             if(isprint (optopt))
@@ -200,11 +493,194 @@ void parseargs(int argc, char* argv[]) {
             break;
       }
    }
+   if(zflag == 1 && outflag == 1) {
+      if(log_limit != 0) {
+         printf("Error: the -z archive has no -w size limit.\n");
+         exit(-1);
+      }
+      outflag = 2;
+   }
+   if(srv_path[0] != '\0' && argflag != 5) {
+      printf("Error: the -S socket server requires -c or -D.\n");
+      exit(-1);
+   }
+   if(stats_file[0] != '\0' && argflag != 5) {
+      printf("Error: the -s statistics require -c or -D.\n");
+      exit(-1);
+   }
+   if(argflag == 9 && (outflag == 2 || log_limit != 0)) {
+      printf("Error: the -a capture file has no -z archive or -w size limit.\n");
+      exit(-1);
+   }
+   if(filt[0].nstages > 0 && argflag != 5 && argflag != 10) {
+      printf("Error: the -F filters require -c, -D or -R.\n");
+      exit(-1);
+   }
+   if(ndevs == 0) {
+      strcpy(i2c_bus[0], I2CBUS);
+      strcpy(i2c_addr[0], I2C_ADDR);
+      ndevs = 1;
+   }
+   if(argflag == 10 && irq_line[0] != '\0') {
+      printf("Error: the -R replay needs no -g interrupt line.\n");
+      exit(-1);
+   }
+   if(ndevs > 1 && ((argflag != 4 && argflag != 5) || daemonflag == 1 || outflag != 0
+                    || srv_path[0] != '\0' || irq_line[0] != '\0')) {
+      printf("Error: several sensors work with -t and -c only, without -D/-o/-S/-g.\n");
+      exit(-1);
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * sigstop() ends the continuous loops. It is installed without *
+ * SA_RESTART, so a blocked sleep or poll returns with EINTR.   *
+ * ------------------------------------------------------------ */
+void sigstop(int sig) {
+   stop = 1;
+}
+
+/* ------------------------------------------------------------ *
+ * cleanup() puts the sensors into power-down and releases the  *
+ * interrupt line and the buses, for a clean end of -c/-f loops.*
+ * ------------------------------------------------------------ */
+void cleanup() {
+   for(int i=0; i<ndevs; i++) {
+      lsm303d_select(&devs[i]);
+      if(lsm303d_powerdown() != 0) printf("Error: could not power down the sensor.\n");
+      if(lsm303d->irq != NULL) lsm303d->irq->close(lsm303d->irq->priv);
+      lsm303d->bus->close(lsm303d->bus->priv);
+   }
+   lsm303d_select(&devs[0]);
+   cache_close();
+   fflush(stdout);
+}
+
+/* ------------------------------------------------------------ *
+ * acquire() is the -c acquisition thread of one bus. It reads  *
+ * raw samples of the bus sensors on the absolute time grid and *
+ * pushes them through the -F filters into their rings, it      *
+ * never waits for the consumer. A full ring drops the sample.  *
+ * A read that fails after the fault recovery loses its sample, *
+ * the thread ends after maxfail of them in a row, or if the    *
+ * sensor is gone.                                              *
+ * ------------------------------------------------------------ */
+void *acquire(void *arg) {
+   struct acqbus *b = arg;
+   struct lsm303draw raw;
+   int fails[LSM303D_MAX_DEVS] = {0};
+
+   sched_start(&b->sched, modr_period[cmfreq_mode]);
+   b->sched.next = grid_t0;
+   while(!stop && b->res == 0) {
+      if(sched_wait(&b->sched) != 0) continue;
+      for(int i=0; i<b->ndev; i++) {
+         lsm303d_select(&devs[b->dev[i]]);
+         int err = lsm303d_read_raw(&raw);
+         if(err != 0) {
+            if(err == LSM303D_ENODEV || ++fails[i] >= lsm303d->recovery.maxfail) {
+               b->res = err;
+               break;
+            }
+            continue;
+         }
+         fails[i] = 0;
+         if(filt[b->dev[i]].nstages > 0 && filter_run(&filt[b->dev[i]], &raw) == 0) continue;
+         ring_push(&ring[b->dev[i]], &raw);
+      }
+   }
+   __atomic_store_n(&b->done, 1, __ATOMIC_RELEASE);
+   return NULL;
+}
+
+/* ------------------------------------------------------------ *
+ * print_faults() prints the fault counters of a sensor, if it  *
+ * had any bus error or data-ready timeout.                     *
+ * ------------------------------------------------------------ */
+void print_faults(const struct lsm303d_dev *dev) {
+   const struct lsm303d_faults *f = &dev->faults;
+   uint64_t n = f->recovered + f->reinits;
+   if(f->errors == 0 && f->stalls == 0) return;
+   if(ndevs > 1) printf("Sensor %s@0x%02x: ", dev->busname, dev->addr);
+   printf("Bus faults: %llu errors, %llu retries, %llu resets, %llu recovered, %llu failed,"
+          " %llu stalls, %llu brown-outs, recovery avg %.3f ms max %.3f ms\n",
+          (unsigned long long) f->errors, (unsigned long long) f->retries,
+          (unsigned long long) f->resets, (unsigned long long) f->recovered,
+          (unsigned long long) f->failures, (unsigned long long) f->stalls,
+          (unsigned long long) f->reinits, n ? f->lat_sum / 1e6 / n : 0.0, f->lat_max / 1e6);
+}
+
+/* ------------------------------------------------------------ *
+ * stats_tick() writes the -s snapshot once a second, or now at *
+ * the end with final = 1, which also prints the stats dump.    *
+ * ------------------------------------------------------------ */
+void stats_tick(int final) {
+   if(stats_file[0] == '\0') return;
+   uint64_t now = mono_ns();
+   if(final == 0 && now < stats_next) return;
+   stats_next = now + 1000000000ULL;
+   struct lsm303d_stats st;
+   stats_sum(&st);
+   stats_write(&st, stats_file);
+   if(final == 1) stats_print(&st);
+}
+
+/* ------------------------------------------------------------ *
+ * merge_output() prints the samples of several sensors, time-  *
+ * aligned: a sample belongs to the grid tick it was read at,   *
+ * and the sensors print in tick order with the tick time. A    *
+ * tick is printed once every sensor delivered it or a later    *
+ * one, so a skipped deadline delays the output by one tick.    *
+ * ------------------------------------------------------------ */
+void merge_output(int64_t rt_offset) {
+   struct lsm303draw raw[LSM303D_MAX_DEVS];
+   int have[LSM303D_MAX_DEVS] = {0};
+   int bus[LSM303D_MAX_DEVS];
+   uint64_t period = modr_period[cmfreq_mode];
+   long idle = period / 4000000;
+
+   for(int b=0; b<nacq; b++)
+      for(int i=0; i<acq[b].ndev; i++) bus[acq[b].dev[i]] = b;
+
+   while(1) {
+      int ready = 1, pending = 0;
+      uint64_t tick = UINT64_MAX;
+      for(int d=0; d<ndevs; d++) {
+         if(!have[d]) have[d] = (ring_pop(&ring[d], &raw[d]) == 0);
+         if(have[d]) {
+            uint64_t k = (raw[d].ts - grid_t0) / period;
+            if(k < tick) tick = k;
+            pending = 1;
+         }
+         else if(!__atomic_load_n(&acq[bus[d]].done, __ATOMIC_ACQUIRE) || ring_count(&ring[d]) > 0)
+            ready = 0;
+      }
+      if(!pending && ready) break;          // all buses finished
+      stats_tick(0);
+      if(!pending || !ready) {
+         delay(idle > 0 ? idle : 1);
+         continue;
+      }
+
+      int64_t ts = (int64_t) (grid_t0 + tick * period) + rt_offset;
+      for(int d=0; d<ndevs; d++) {
+         if(!have[d] || (raw[d].ts - grid_t0) / period != tick) continue;
+         struct lsm303dsample smp;
+         lsm303d_select(&devs[d]);
+         lsm303d_convert(&raw[d], &smp);
+         printf("%lld.%03lld %s@0x%02x Heading=%3.2f degrees Mag X=%.2f Y=%.2f Z=%.2f mGauss"
+                " Acc X=%.2f Y=%.2f Z=%.2f mg Temp=%.1f C\n",
+                (long long) (ts / 1000000000LL), (long long) (ts % 1000000000LL) / 1000000,
+                devs[d].busname, devs[d].addr, get_heading_tc(&smp), smp.mag.X, smp.mag.Y,
+                smp.mag.Z, smp.acc.X, smp.acc.Y, smp.acc.Z, smp.temp);
+         stats_sample(raw[d].ts);
+         have[d] = 0;
+      }
+   }
 }
 
 int main(int argc, char *argv[]) {
    int res = -1;       // res = function retcode: 0=OK, -1 = Error
-   declination = 0;    // local declination value
 
    /* ---------------------------------------------------------- *
     * Process the cmdline parameters                             *
@@ -218,12 +694,70 @@ int main(int argc, char *argv[]) {
    if(verbose == 1) printf("Debug: ts=[%lld] date=%s", (long long) tsnow, ctime(&tsnow));
 
    /* ----------------------------------------------------------- *
-    * Open the I2C bus and connect to the sensor i2c address 0x1d *
+    * "-t" with a running -D daemon takes its latest sample from  *
+    * shared memory, without touching the bus, if the daemon owns *
+    * the one requested sensor. A stale value, e.g. from a daemon *
+    * that hangs on a bus error, falls through.                   *
+    * ----------------------------------------------------------- */
+   if(argflag == 4 && ndevs == 1 && outflag == 0 && irq_line[0] == '\0'
+      && (shm = shm_attach(LSM303D_SHM_NAME)) != NULL) {
+      struct lsm303d_shmsample s;
+      int res = -1;
+      uint64_t age = 0;
+      if(strcmp(shm->bus, i2c_bus[0]) == 0 && shm->addr == (int) strtol(i2c_addr[0], NULL, 16)) {
+         uint64_t t0 = mono_ns();
+         res = shm_latest(shm, &s);
+         uint64_t t1 = mono_ns();
+         if(res == 0) {
+            age = t1 - s.smp.ts;
+            if(verbose == 1) printf("Debug: Daemon pid %d sample %llu age %.1f ms, read in %llu ns\n",
+                                     shm->pid, (unsigned long long) s.n, age / 1e6,
+                                     (unsigned long long) (t1 - t0));
+         }
+      }
+      else if(verbose == 1) printf("Debug: Daemon pid %d owns %s@0x%02x, reading the bus\n",
+                                    shm->pid, shm->bus, shm->addr);
+      if(res == 0 && age < 1000000000ULL + 2 * shm->period) {
+         float angle = s.heading;
+         if(decl_flag == 1) angle = fmodf(angle - shm->declination + decl_arg + 360, 360);
+         printf("%lld Heading=%3.2f degrees\n", (long long) tsnow, angle);
+         exit(0);
+      }
+      shm_detach(shm);
+      shm = NULL;
+   }
+
+   /* ----------------------------------------------------------- *
+    * "-D" claims the shared memory first, a second daemon must   *
+    * not reconfigure the sensor of a running one.                *
     * ----------------------------------------------------------- */
-   get_i2cbus(i2c_bus, I2C_ADDR);
+   uint64_t out_period = modr_period[cmfreq_mode];   // -c/-D output period after -F
+   if(filt[0].nstages > 0) out_period *= filt[0].dec;
+   if(daemonflag == 1 && (shm = shm_create(LSM303D_SHM_NAME, i2c_bus[0],
+                            (int) strtol(i2c_addr[0], NULL, 16), out_period)) == NULL)
+      exit(-1);
+   if(srv_path[0] != '\0' && srv_create(&srv, srv_path, out_period) != 0)
+      exit(-1);
 
-   struct lsm303ddata lsm303dd;
-   //lsm303d_init(&lsm303dd);
+   /* ----------------------------------------------------------- *
+    * Open the I2C buses and connect to the sensor i2c addresses, *
+    * 0x1d by default. The first sensor stays selected for the    *
+    * single sensor modes. A replay only opens the cache record.  *
+    * ----------------------------------------------------------- */
+   for(int i=ndevs-1; i>=0; i--) {
+      lsm303d_dev_init(&devs[i]);
+      lsm303d_select(&devs[i]);
+      lsm303d->shadow.verify = verifyflag;
+      if(retries >= 0) lsm303d->recovery.retries = retries;
+      if(backoff > 0) lsm303d->recovery.backoff = backoff;
+      if(argflag == 10) cache_open(i2c_bus[i], (int) strtol(i2c_addr[i], NULL, 16));
+      else get_i2cbus(i2c_bus[i], i2c_addr[i]);
+      if(irq_line[0] != '\0') get_irqline(irq_line);
+      lsm303d->declination = decl_arg;
+      if(decl_flag == 1) cache_store_decl(decl_arg);
+      else cache_load_decl(&lsm303d->declination);
+   }
+   if(shm != NULL) shm->declination = lsm303d->declination;
 
    /* ----------------------------------------------------------- *
     *  "-d" dump the register map content and exit the program    *
@@ -300,14 +834,49 @@ int main(int argc, char *argv[]) {
    /* ----------------------------------------------------------- *
     *  "-t" read single measurement, then exit the program        *
     * ----------------------------------------------------------- */
+   if(argflag == 4 && ndevs > 1) {
+      for(int i=0; i<ndevs; i++) {
+         struct lsm303draw raw;
+         struct lsm303dsample smp;
+         lsm303d_select(&devs[i]);
+         if(lsm303d_init() != 0) exit(-1);
+         if(lsm303d_read_raw(&raw) != 0) {
+            printf("Error: could not read data from sensor %s@0x%02x.\n", devs[i].busname, devs[i].addr);
+            exit(-1);
+         }
+         lsm303d_convert(&raw, &smp);
+         printf("%lld %s@0x%02x Heading=%3.2f degrees\n", (long long) tsnow,
+                devs[i].busname, devs[i].addr, get_heading_tc(&smp));
+      }
+      exit(0);
+   }
    if(argflag == 4) {
+      if(lsm303d_init() != 0) exit(-1);
+      if(lsm303d->irq != NULL && lsm303d_irq_route(LSM303D_P2_DRDYM) != 0) exit(-1);
 
-      res = lsm303d_read(&lsm303dd);
+      struct lsm303draw raw;
+      struct lsm303dsample smp;
+      res = lsm303d_read_raw(&raw);
       if(res != 0) {
          printf("Error: could not read data from the sensor.\n");
          exit(-1);
       }
-      float angle = get_heading(&lsm303dd);
+      if(outflag == 1) {
+         struct lsm303d_log log;
+         if(log_create(&log, logfile, log_limit, 0) != 0) exit(-1);
+         res = log_append(&log, &raw);
+         log_close(&log);
+         if(res != 0) exit(-1);
+      }
+      if(outflag == 2) {
+         struct lsm303d_zlog zlog;
+         if(zlog_create(&zlog, logfile, 0) != 0) exit(-1);
+         res = zlog_append(&zlog, &raw);
+         zlog_close(&zlog);
+         if(res != 0) exit(-1);
+      }
+      lsm303d_convert(&raw, &smp);
+      float angle = get_heading_tc(&smp);
       /* ----------------------------------------------------------- *
        * print the formatted output string to stdout (Example below) *
        * 1584280335 Heading=337.25 degrees                           *
@@ -321,11 +890,440 @@ int main(int argc, char *argv[]) {
     * ctl-c is received.                                          *
     * ----------------------------------------------------------- */
    if(argflag == 5) {
-      res = set_cmfreq(cmfreq_mode);
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = sigstop;
+      sigaction(SIGINT, &sa, NULL);
+      sigaction(SIGTERM, &sa, NULL);
+      setvbuf(stdout, NULL, _IOLBF, 0);
+
+      for(int i=0; i<ndevs; i++) {
+         lsm303d_select(&devs[i]);
+         if(lsm303d_init() != 0) exit(-1);
+         res = set_cmfreq(cmfreq_mode);
+         if(res != 0) {
+            printf("Error: could not set continuous mode %d.\n", cmfreq_mode);
+            exit(-1);
+         }
+         if(lsm303d->irq != NULL && lsm303d_irq_route(LSM303D_P2_DRDYM) != 0) exit(-1);
+         if(ring_init(&ring[i], ring_size) != 0) exit(-1);
+         if(i > 0) filt[i] = filt[0];
+
+         /* one acquisition thread per bus */
+         int b;
+         for(b=0; b<nacq && strcmp(devs[acq[b].dev[0]].busname, devs[i].busname) != 0; b++);
+         if(b == nacq) nacq++;
+         acq[b].dev[acq[b].ndev++] = i;
+      }
+      lsm303d_select(&devs[0]);
+
+      /* ---------------------------------------------------------- *
+       * The acquisition threads, one per bus, run on an absolute   *
+       * time grid that matches M_ODR. Deadlines that pass during a *
+       * slow read are counted as missed and skipped, the grid      *
+       * itself never moves. Conversion, heading and output run     *
+       * here, on the consumer side of the rings. Signals go to     *
+       * this thread only. With -o, raw samples go to the log       *
+       * instead of the text output.                                *
+       * ---------------------------------------------------------- */
+      struct lsm303d_log log;
+      struct lsm303d_zlog zlog;
+      if(outflag == 1 && log_create(&log, logfile, log_limit, out_period) != 0)
+         exit(-1);
+      if(outflag == 2 && zlog_create(&zlog, logfile, out_period) != 0)
+         exit(-1);
+      sigset_t sigs, oldsigs;
+      sigemptyset(&sigs);
+      sigaddset(&sigs, SIGINT);
+      sigaddset(&sigs, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+      grid_t0 = mono_ns() + modr_period[cmfreq_mode];
+      for(int b=0; b<nacq; b++) {
+         if(pthread_create(&acq[b].thread, NULL, acquire, &acq[b]) != 0) {
+            printf("Error: could not start the acquisition thread.\n");
+            exit(-1);
+         }
+      }
+      pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+      struct timespec rt;
+      clock_gettime(CLOCK_REALTIME, &rt);
+      int64_t rt_offset = (int64_t) rt.tv_sec * 1000000000LL + rt.tv_nsec - (int64_t) mono_ns();
+      srv.rt_offset = rt_offset;
+      uint64_t nsmp = 0;
+      long idle = out_period / 4000000;   // empty ring backoff in ms
+      struct lsm303draw raw;
+      struct lsm303dsample smp;
+      if(ndevs > 1) merge_output(rt_offset);
+      while(ndevs == 1) {
+         stats_tick(0);
+         if(ring_pop(&ring[0], &raw) != 0) {
+            if(__atomic_load_n(&acq[0].done, __ATOMIC_ACQUIRE) && ring_count(&ring[0]) == 0) break;
+            if(srv_path[0] != '\0') srv_wait(&srv, idle > 0 ? idle : 1);
+            else delay(idle > 0 ? idle : 1);
+            continue;
+         }
+         if(outflag != 0) {
+            if((outflag == 1 ? log_append(&log, &raw) : zlog_append(&zlog, &raw)) != 0) {
+               stop = 1;      // ends the acquisition thread too
+               res = -1;
+               break;
+            }
+         }
+         if(daemonflag == 1 || srv_path[0] != '\0') {
+            lsm303d_convert(&raw, &smp);
+            float heading = get_heading_tc(&smp);
+            if(daemonflag == 1) shm_publish(shm, &smp, heading);
+            if(srv_path[0] != '\0') srv_publish(&srv, nsmp, &smp, heading);
+            nsmp++;
+         }
+         if(outflag != 0 || daemonflag == 1 || srv_path[0] != '\0') {
+            stats_sample(raw.ts);
+            continue;
+         }
+         lsm303d_convert(&raw, &smp);
+         int64_t ts = (int64_t) raw.ts + rt_offset;
+         printf("%lld.%03lld Heading=%3.2f degrees Mag X=%.2f Y=%.2f Z=%.2f mGauss"
+                " Acc X=%.2f Y=%.2f Z=%.2f mg Temp=%.1f C\n",
+                (long long) (ts / 1000000000LL), (long long) (ts % 1000000000LL) / 1000000,
+                get_heading_tc(&smp), smp.mag.X, smp.mag.Y, smp.mag.Z,
+                smp.acc.X, smp.acc.Y, smp.acc.Z, smp.temp);
+         stats_sample(raw.ts);
+      }
+      for(int b=0; b<nacq; b++) {
+         struct lsm303d_sched *sched = &acq[b].sched;
+         pthread_join(acq[b].thread, NULL);
+         if(acq[b].res != 0) printf("Error: could not read data from the sensor, %s.\n",
+                                     lsm303d_strerror(acq[b].res));
+         if(res == 0) res = acq[b].res;
+         if(nacq > 1) printf("Bus %s: ", devs[acq[b].dev[0]].busname);
+         printf("Continuous read stop: %llu samples, %llu overruns, %llu missed deadlines, max wakeup lag %.3f ms\n",
+                (unsigned long long) sched->ticks, (unsigned long long) sched->overruns,
+                (unsigned long long) sched->missed, sched->max_lag / 1e6);
+      }
+      for(int i=0; i<ndevs; i++) {
+         if(ndevs > 1) printf("Sensor %s@0x%02x: ", devs[i].busname, devs[i].addr);
+         printf("Ring buffer: %u slots, max occupancy %llu, %llu overflows\n", ring[i].size,
+                (unsigned long long) ring[i].hiwater, (unsigned long long) ring[i].overflows);
+         ring_free(&ring[i]);
+         print_faults(&devs[i]);
+      }
+      if(outflag == 1) {
+         printf("Sample log: %s %llu records\n", logfile, (unsigned long long) log.hdr->count);
+         log_close(&log);
+      }
+      if(outflag == 2) {
+         printf("Sample archive: %s %llu samples\n", logfile, (unsigned long long) zlog.hdr.count);
+         zlog_close(&zlog);
+      }
+      if(daemonflag == 1) {
+         printf("Shared memory: %s %llu samples published\n", LSM303D_SHM_NAME,
+                (unsigned long long) shm->count);
+         shm_remove(shm, LSM303D_SHM_NAME);
+      }
+      if(srv_path[0] != '\0') {
+         printf("Socket server: %s %llu clients served, %llu dropped, %llu writes\n", srv_path,
+                (unsigned long long) srv.accepted, (unsigned long long) srv.dropped,
+                (unsigned long long) srv.writes);
+         srv_close(&srv);
+      }
+      stats_tick(1);
+      cleanup();
+      exit(res);
+   }
+
+   /* ----------------------------------------------------------- *
+    *  "-k" magnetometer calibration. Samples at 50 Hz are folded *
+    * into the calibration sums, the fit is refined whenever the  *
+    * coverage improves. Run until 90% coverage with an ellipsoid *
+    * fit, or until ctl-c is received.                            *
+    * ----------------------------------------------------------- */
+   if(argflag == 8) {
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = sigstop;
+      sigaction(SIGINT, &sa, NULL);
+      sigaction(SIGTERM, &sa, NULL);
+      setvbuf(stdout, NULL, _IOLBF, 0);
+
+      if(lsm303d_init() != 0) exit(-1);
+      if(set_cmfreq(4) != 0) exit(-1);
+      if(lsm303d->irq != NULL && lsm303d_irq_route(LSM303D_P2_DRDYM) != 0) exit(-1);
+
+      static const char *fit[3] = { "none", "sphere", "ellipsoid" };
+      struct lsm303d_magcal mc;
+      struct lsm303draw raw;
+      struct lsm303d_sched sched;
+      magcal_init(&mc);
+      sched_start(&sched, modr_period[4]);
+      printf("Calibration: rotate the sensor slowly through all orientations\n");
+      while(!stop) {
+         if(sched_wait(&sched) != 0) continue;
+         if(lsm303d_read_raw(&raw) != 0) {
+            printf("Error: could not read data from the sensor.\n");
+            break;
+         }
+         float m[3];
+         for(int i=0; i<3; i++) m[i] = lsm303d->cal.mag_sens[i] * raw.mag[i];
+         if(magcal_add(&mc, m) || (long) mc.n % 50 == 0) magcal_solve(&mc);
+         if((long) mc.n % 50 == 0)
+            printf("Calibration: %.0f samples, coverage %.0f%%, fit %s, error %.2f%%\n",
+                   mc.n, mc.coverage * 100, fit[mc.valid], mc.fit_err * 100);
+         if(mc.valid == 2 && mc.coverage >= 0.9f) break;
+      }
+      magcal_solve(&mc);
+      if(mc.valid > 0) {
+         magcal_apply(&mc, &lsm303d->cal);
+         cache_store_cal(&lsm303d->cal);
+      }
+      printf("Calibration result: fit %s, coverage %.0f%%, error %.2f%%, field %.1f mGauss\n",
+             fit[mc.valid], mc.coverage * 100, mc.fit_err * 100, mc.radius);
+      if(mc.valid > 0) {
+         printf("Hard-iron offset: X=%.2f Y=%.2f Z=%.2f mGauss\n", mc.off[0], mc.off[1], mc.off[2]);
+         printf("Soft-iron matrix:\n");
+         for(int i=0; i<3; i++)
+            printf("   %8.5f %8.5f %8.5f\n", mc.soft[i][0], mc.soft[i][1], mc.soft[i][2]);
+      }
+      cleanup();
+      exit(mc.valid > 0 ? 0 : -1);
+   }
+
+   /* ----------------------------------------------------------- *
+    *  "-f" stream accelerometer data through the FIFO. Each batch *
+    * is drained in two bus transactions once the watermark level *
+    * is filled, signalled by the INT2 FTH edge with -g. Run until *
+    * ctl-c is received.                                          *
+    * ----------------------------------------------------------- */
+   if(argflag == 7) {
+      int16_t acc[LSM303D_FIFO_DEPTH][3];
+      uint8_t fifo_src = 0;
+      long wait = 1000L * fifo_wtm / 100;   // watermark fill time at 100 Hz
+
+      res = lsm303d_fifo_start(LSM303D_FIFO_AODR, fifo_wtm);
       if(res != 0) {
-         printf("Error: could not set continuous mode %d.\n", cmfreq_mode);
+         printf("Error: could not start FIFO stream mode.\n");
          exit(-1);
       }
+      if(lsm303d->irq != NULL && lsm303d_irq_route(LSM303D_P2_FTH) != 0) exit(-1);
+      if(lsm303d_get_scale() != 0) exit(-1);
+      const float *sens = lsm303d->cal.acc_sens;
+      const float *off  = lsm303d->cal.acc_off;
+
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = sigstop;
+      sigaction(SIGINT, &sa, NULL);
+      sigaction(SIGTERM, &sa, NULL);
+
+      int n = 0;
+      while(!stop) {
+         /* with an interrupt line, sleep until the FTH edge, unless */
+         /* the previous batch already drained a full FIFO           */
+         if(lsm303d->irq == NULL) delay(wait);
+         else if(n < LSM303D_FIFO_DEPTH && lsm303d_irq_wait(1000) < 0) break;
+         n = lsm303d_fifo_read(acc, LSM303D_FIFO_DEPTH, &fifo_src);
+         if(n < 0) {
+            printf("Error: could not read the sensor FIFO.\n");
+            break;
+         }
+         if(fifo_src & LSM303D_FIFO_OVRN) printf("Warning: FIFO full, samples may be lost\n");
+         tsnow = time(NULL);
+         for(int i=0; i<n; i++) {
+            printf("%lld Accel X=%8.2f Y=%8.2f Z=%8.2f mg\n", (long long) tsnow,
+                   sens[0] * acc[i][0] - off[0], sens[1] * acc[i][1] - off[1],
+                   sens[2] * acc[i][2] - off[2]);
+         }
+      }
+      lsm303d_fifo_stop();
+      cleanup();
       exit(0);
    }
+
+   /* ----------------------------------------------------------- *
+    *  "-a" high-rate accelerometer capture. The FIFO is drained  *
+    * once per watermark fill, on a time grid of wtm sample       *
+    * periods, or on the INT2 FTH edge with -g, straight into the *
+    * preallocated capture. 8 free levels cover a late wakeup of  *
+    * 5 ms at 1600 Hz. Run for -n seconds or until ctl-c. Without *
+    * -o, the samples are printed after the capture ends.         *
+    * ----------------------------------------------------------- */
+   if(argflag == 9) {
+      uint64_t period = 320000000ULL >> (cap_aodr - 1);   // 3.125 Hz << (aodr - 1)
+      int wtm = LSM303D_CAPTURE_WTM;
+      res = 0;
+      struct lsm303d_capture cap;
+      struct lsm303d_sched sched;
+
+      uint64_t slots = (uint64_t) (cap_sec * 1e9 / period) + LSM303D_FIFO_DEPTH;
+      if(capture_create(&cap, outflag ? logfile : NULL, slots, period) != 0) exit(-1);
+      if(lsm303d_init() != 0) exit(-1);
+      if(lsm303d->irq != NULL && lsm303d_irq_route(LSM303D_P2_FTH) != 0) exit(-1);
+      if(lsm303d_set_abw(cap_abw) != 0 || lsm303d_fifo_start(cap_aodr, wtm) != 0) {
+         printf("Error: could not start the FIFO capture.\n");
+         exit(-1);
+      }
+
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = sigstop;
+      sigaction(SIGINT, &sa, NULL);
+      sigaction(SIGTERM, &sa, NULL);
+
+      printf("Capture: %.3f Hz for %.1f seconds, watermark %d\n", 1e9 / period, cap_sec, wtm);
+      uint64_t end = mono_ns() + (uint64_t) (cap_sec * 1e9);
+      int n = 0;
+      int timeout = LSM303D_FIFO_DEPTH * period / 1000000 + 1;   // FIFO full, lost edge
+      sched_start(&sched, wtm * period);
+      while(!stop && mono_ns() < end && cap.hdr->count < cap.slots) {
+         if(lsm303d->irq == NULL) {
+            if(sched_wait(&sched) != 0) continue;
+         }
+         else if(n < LSM303D_FIFO_DEPTH && lsm303d_irq_wait(timeout) < 0) break;
+         n = capture_drain(&cap);
+         if(n < 0) {
+            printf("Error: could not read the sensor FIFO.\n");
+            res = -1;
+            break;
+         }
+      }
+      lsm303d_fifo_stop();
+
+      uint64_t count = cap.hdr->count;
+      double span = (count > 1) ? (cap.t_last - cap.hdr->t0) / 1e9 : 0;
+      printf("Capture stop: %llu samples, %.3f Hz measured, %llu batches, max FIFO level %d,"
+             " %llu FIFO overruns, %llu missed deadlines\n", (unsigned long long) count,
+             span > 0 ? (count - 1) / span : 0.0, (unsigned long long) cap.batches,
+             cap.max_level, (unsigned long long) cap.overruns, (unsigned long long) sched.missed);
+      if(cap.overruns > 0) printf("Warning: the FIFO was full %llu times, samples were lost\n",
+                                  (unsigned long long) cap.overruns);
+      if(outflag == 1) printf("Capture file: %s %llu samples\n", logfile, (unsigned long long) count);
+      else {
+         static char obuf[1 << 16];
+         setvbuf(stdout, obuf, _IOFBF, sizeof(obuf));
+         const float *sens = lsm303d->cal.acc_sens;
+         const float *off  = lsm303d->cal.acc_off;
+         for(uint64_t i=0; i<count; i++) {
+            int64_t ts = (int64_t) (cap.hdr->t0 + i * period) + cap.hdr->rt_offset;
+            printf("%lld.%06lld Accel X=%8.2f Y=%8.2f Z=%8.2f mg\n", (long long) (ts / 1000000000LL),
+                   (long long) (ts % 1000000000LL) / 1000, sens[0] * cap.acc[i][0] - off[0],
+                   sens[1] * cap.acc[i][1] - off[1], sens[2] * cap.acc[i][2] - off[2]);
+         }
+      }
+      capture_close(&cap);
+      cleanup();
+      exit(res);
+   }
+
+   /* ----------------------------------------------------------- *
+    *  "-R" replays a recording through the -F filters, the raw   *
+    * conversion and the heading, like the -c consumer, with the  *
+    * ranges, calibration and declination of the recording. A     *
+    * cached calibration or declination replaces the recorded     *
+    * one, -l replaces any declination. speed 0 runs as fast as   *
+    * possible, a deterministic benchmark without the sensor,     *
+    * otherwise each sample waits for its recorded time, scaled   *
+    * by speed, on an absolute grid. The throughput goes to       *
+    * stderr, the output stays comparable. An -a capture holds    *
+    * accel data only and replays as accel lines, no heading.     *
+    * ----------------------------------------------------------- */
+   if(argflag == 10) {
+      struct lsm303d_replay rp;
+      res = 0;
+      if(replay_open(&rp, replay_file) != 0) exit(-1);
+      if(rp.kind == REPLAY_ACC && outflag != 0) {
+         printf("Error: %s is an accel capture, it has no samples for a -o log.\n", replay_file);
+         replay_close(&rp);
+         exit(-1);
+      }
+      if(rp.kind != REPLAY_CSV) log_calib(&rp.hdr, &lsm303d->cal);
+      if(cache_load_cal(&lsm303d->cal) == 1 && verbose == 1)
+         printf("Debug: Replay with the cached calibration offsets\n");
+      if(decl_flag == 0 && rp.kind != REPLAY_CSV) {
+         lsm303d->declination = rp.hdr.declination;
+         if(cache_load_decl(&lsm303d->declination) == 1 && verbose == 1)
+            printf("Debug: Replay with the cached declination %.2f\n", lsm303d->declination);
+      }
+
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = sigstop;
+      sigaction(SIGINT, &sa, NULL);
+      sigaction(SIGTERM, &sa, NULL);
+
+      struct lsm303d_log log;
+      struct lsm303d_zlog zlog;
+      uint64_t period = rp.hdr.period;
+      if(filt[0].nstages > 0) period *= filt[0].dec;
+      if(outflag == 1) {
+         if(log_create(&log, logfile, log_limit, period) != 0) exit(-1);
+         log.hdr->rt_offset = rp.hdr.rt_offset;
+         log.hdr->modr = rp.hdr.modr;
+         log.hdr->aodr = rp.hdr.aodr;
+      }
+      if(outflag == 2) {
+         if(zlog_create(&zlog, logfile, period) != 0) exit(-1);
+         zlog.hdr.rt_offset = rp.hdr.rt_offset;
+         zlog.hdr.modr = rp.hdr.modr;
+         zlog.hdr.aodr = rp.hdr.aodr;
+      }
+      static char obuf[1 << 16];
+      if(replay_speed > 0) setvbuf(stdout, NULL, _IOLBF, 0);
+      else setvbuf(stdout, obuf, _IOFBF, sizeof(obuf));
+
+      struct lsm303draw raw;
+      struct lsm303dsample smp;
+      uint64_t nin = 0, nout = 0, ts0 = 0;
+      uint64_t t0 = mono_ns();
+      while(!stop) {
+         int r = replay_next(&rp, &raw);
+         if(r != 0) {
+            if(r < 0) res = -1;
+            break;
+         }
+         if(nin++ == 0) ts0 = raw.ts;
+         if(replay_speed > 0) {
+            uint64_t due = t0 + (uint64_t) ((raw.ts > ts0 ? raw.ts - ts0 : 0) / replay_speed);
+            struct timespec ts = { .tv_sec = due / 1000000000ULL, .tv_nsec = due % 1000000000ULL };
+            if(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) continue;
+         }
+         if(filt[0].nstages > 0 && filter_run(&filt[0], &raw) == 0) continue;
+         nout++;
+         if(outflag != 0) {
+            if((outflag == 1 ? log_append(&log, &raw) : zlog_append(&zlog, &raw)) != 0) {
+               res = -1;
+               break;
+            }
+            continue;
+         }
+         lsm303d_convert(&raw, &smp);
+         int64_t ts = (int64_t) raw.ts + rp.hdr.rt_offset;
+         if(rp.kind == REPLAY_ACC) {        // no magnetic or temperature data
+            printf("%lld.%06lld Accel X=%8.2f Y=%8.2f Z=%8.2f mg\n", (long long) (ts / 1000000000LL),
+                   (long long) (ts % 1000000000LL) / 1000, smp.acc.X, smp.acc.Y, smp.acc.Z);
+            continue;
+         }
+         printf("%lld.%03lld Heading=%3.2f degrees Mag X=%.2f Y=%.2f Z=%.2f mGauss"
+                " Acc X=%.2f Y=%.2f Z=%.2f mg Temp=%.1f C\n",
+                (long long) (ts / 1000000000LL), (long long) (ts % 1000000000LL) / 1000000,
+                get_heading_tc(&smp), smp.mag.X, smp.mag.Y, smp.mag.Z,
+                smp.acc.X, smp.acc.Y, smp.acc.Z, smp.temp);
+      }
+      fflush(stdout);
+      double secs = (mono_ns() - t0) / 1e9;
+      fprintf(stderr, "Replay: %llu samples in, %llu out, %.3f s, %.0f samples/s\n",
+              (unsigned long long) nin, (unsigned long long) nout, secs,
+              secs > 0 ? nin / secs : 0.0);
+      if(outflag == 1) {
+         printf("Sample log: %s %llu records\n", logfile, (unsigned long long) log.hdr->count);
+         log_close(&log);
+      }
+      if(outflag == 2) {
+         printf("Sample archive: %s %llu samples\n", logfile, (unsigned long long) zlog.hdr.count);
+         zlog_close(&zlog);
+      }
+      replay_close(&rp);
+      cache_close();
+      fflush(stdout);
+      exit(res);
+   }
 }
@@ -9,12 +9,14 @@
  * Requires:	I2C development packages i2c-tools libi2c-dev   *
  *                                                              *
  * author:      13/09/2021 Frank4DD                             *
- * note:        LSM303D does not support auto-increment reads   *
+ * note:        Multi-byte access uses the LSM303D auto-increment *
+ *              (sub-address MSB=1) in one I2C_RDWR transaction *
  * ------------------------------------------------------------ */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 #include <sys/ioctl.h>
 #include <unistd.h>
@@ -24,161 +26,293 @@
 #include <math.h>
 #include "lsm303d.h"
 
+/* ------------------------------------------------------------ *
+ * i2c-dev backend state: bus file descriptor and the sensor    *
+ * address used in the I2C_RDWR messages, the bus device name   *
+ * for a re-open.                                               *
+ * ------------------------------------------------------------ */
+struct i2cdev{
+   struct lsm303d_transport tp;
+   int fd;             // I2C bus file descriptor
+   int addr;           // sensor I2C address
+   char path[256];     // bus device name
+};
+
 /* ------------------------------------------------------------ *
  * get_i2cbus() - Enables the I2C bus communication. RPi 2,3,4  *
  * use /dev/i2c-1, RPi 1 used i2c-0, NanoPi Neo also uses i2c-0 *
+ * The program ends if the sensor does not answer.              *
  * ------------------------------------------------------------ */
-void get_i2cbus(char *i2cbus, char *i2caddr) {
+void get_i2cbus(char *i2cbus, char *i2cstr) {
+   if(lsm303d_bus_open(i2cbus, (int)strtol(i2cstr, NULL, 16)) != 0) exit(-1);
+}
 
-   if((i2cfd = open(i2cbus, O_RDWR)) < 0) {
-      printf("Error failed to open I2C bus [%s].\n", i2cbus);
-      exit(-1);
-   }
-   if(verbose == 1) printf("Debug: I2C bus device: [%s]\n", i2cbus);
-   /* --------------------------------------------------------- *
-    * Set I2C device (LSM303D I2C address is 0x1d or 0x1e)      *
-    * --------------------------------------------------------- */
-   int addr = (int)strtol(i2caddr, NULL, 16);
-   if(verbose == 1) printf("Debug: Sensor address: [0x%02X]\n", addr);
+/* ------------------------------------------------------------ *
+ * lsm303d_bus_open() opens the transport to the sensor at addr *
+ * on i2cbus for the selected device and confirms the sensor    *
+ * answers. The bus name "sim" selects the simulated sensor,    *
+ * "sim:<n>" runs the simulator at n times real time (0 =       *
+ * virtual time). Fault injection options follow after commas:  *
+ * ",nack=<rate>[:<len>]" and ",brownout=<sec>". Returns 0 on   *
+ * success, -1 on error.                                        *
+ * ------------------------------------------------------------ */
+int lsm303d_bus_open(const char *i2cbus, int addr) {
+   strncpy(lsm303d->busname, i2cbus, sizeof(lsm303d->busname) - 1);
+   lsm303d->addr = addr;
 
-   if(ioctl(i2cfd, I2C_SLAVE, addr) != 0) {
-      printf("Error can't find sensor at address [0x%02X].\n", addr);
-      exit(-1);
+   if(strncmp(i2cbus, "sim", 3) == 0) {
+      struct lsm303d_simcfg cfg;
+      sim_defaults(&cfg);
+      if(i2cbus[3] == ':') cfg.speed = strtod(&i2cbus[4], NULL);
+      const char *opt = i2cbus;
+      while((opt = strchr(opt, ',')) != NULL) {
+         opt++;
+         if(strncmp(opt, "nack=", 5) == 0) {
+            char *end;
+            cfg.nack_rate = strtof(opt + 5, &end);
+            if(*end == ':') cfg.nack_len = atoi(end + 1);
+         }
+         else if(strncmp(opt, "brownout=", 9) == 0) cfg.brownout = strtod(opt + 9, NULL);
+      }
+      cfg.seed += addr - 0x1d;  // a second simulated sensor has its own noise
+      lsm303d->bus = sim_open(&cfg);
    }
+   else lsm303d->bus = i2cdev_open(i2cbus, addr);
+
+   if(lsm303d->bus == NULL) return(-1);
+   if(verbose == 1) printf("Debug: I2C bus device: [%s] backend [%s]\n", i2cbus, lsm303d->bus->name);
+   shadow_reset();
+
    /* --------------------------------------------------------- *
     * I2C communication test is the only way to confirm success *
     * --------------------------------------------------------- */
-   if(get_prdid(addr) == 0) {
-      printf("Error: No response from I2C. addr [0x%02X]?\n", addr);
-      exit(-1);
+   char id = get_prdid();
+   if(id != PRD_ID) {
+      if(id == 0) printf("Error: No response from I2C. addr [0x%02X]?\n", addr);
+      else printf("Error: WHO_AM_I 0x%02X at addr [0x%02X], expected 0x%02X\n",
+                  (uint8_t) id, addr, PRD_ID);
+      lsm303d->bus->close(lsm303d->bus->priv);
+      lsm303d->bus = NULL;
+      return(-1);
    }
    if(verbose == 1) printf("Debug: Got data @addr: [0x%02X]\n", addr);
+
+   /* --------------------------------------------------------- *
+    * The cache record saves the calibration and redundant CTRL *
+    * writes, it does not identify the sensor. It is opened     *
+    * after the probe, a failed probe must not claim a slot and *
+    * evict the record of a real sensor.                        *
+    * --------------------------------------------------------- */
+   cache_open(i2cbus, addr);
+   return(0);
 }
 
 /* --------------------------------------------------------------- *
- * get_prdid() returns the LSM303D product id from register 0x20.  *
+ * i2cdev_read() reads len bytes starting at register reg in a     *
+ * single I2C_RDWR combined transaction: the sub-address write     *
+ * and the data read are joined by a repeated start. For len > 1,  *
+ * the sub-address MSB is set so the sensor auto-increments. One   *
+ * syscall and one bus turnaround, regardless of the burst length. *
  * --------------------------------------------------------------- */
-char get_prdid() {
-   char reg = LSM303D_WHO_AM_I;
-   char buf = 0;
-   if(write(i2cfd, &reg, 1) != 1) {
-      printf("Error: I2C write failure for register 0x%02X\n", reg);
+static int i2cdev_read(void *priv, uint8_t reg, uint8_t *buf, uint16_t len) {
+   struct i2cdev *dev = priv;
+   uint8_t sub = reg;
+   if(len > 1) sub |= LSM303D_AUTO_INC;
+
+   struct i2c_msg msgs[2] = {
+      { .addr = dev->addr, .flags = 0,        .len = 1,   .buf = &sub },
+      { .addr = dev->addr, .flags = I2C_M_RD, .len = len, .buf = buf  }
+   };
+   struct i2c_rdwr_ioctl_data xfer = { .msgs = msgs, .nmsgs = 2 };
+
+   if(ioctl(dev->fd, I2C_RDWR, &xfer) != 2) {
+      if(verbose == 1) printf("Debug: I2C read failure for register 0x%02X len %d\n", reg, len);
+      return(-1);
    }
+   return(0);
+}
 
-   if(read(i2cfd, &buf, 1) != 1) {
-      printf("Error: I2C read failure for register 0x%02X\n", reg);
+/* --------------------------------------------------------------- *
+ * i2cdev_write() writes len bytes starting at register reg. Sub-  *
+ * address and data go out as one I2C message, with the auto-      *
+ * increment bit set for multi-byte writes to contiguous registers *
+ * --------------------------------------------------------------- */
+static int i2cdev_write(void *priv, uint8_t reg, const uint8_t *buf, uint16_t len) {
+   struct i2cdev *dev = priv;
+   uint8_t data[LSM303D_REGMAP_SIZE + 1];
+   if(len > LSM303D_REGMAP_SIZE) {
+      printf("Error: I2C write length %d exceeds register map\n", len);
+      return(-1);
    }
-   return buf;
+   data[0] = reg;
+   if(len > 1) data[0] |= LSM303D_AUTO_INC;
+   memcpy(&data[1], buf, len);
+
+   struct i2c_msg msg = { .addr = dev->addr, .flags = 0, .len = len + 1, .buf = data };
+   struct i2c_rdwr_ioctl_data xfer = { .msgs = &msg, .nmsgs = 1 };
+
+   if(ioctl(dev->fd, I2C_RDWR, &xfer) != 1) {
+      if(verbose == 1) printf("Debug: I2C write failure for register 0x%02X len %d\n", reg, len);
+      return(-1);
+   }
+   return(0);
 }
 
 /* --------------------------------------------------------------- *
- * lsm303d_set() initialize the magnetization in normal direction  *
+ * i2cdev_reset() re-opens the bus device. The adapter driver runs *
+ * its own SCL recovery on a stuck bus, userspace can only drop    *
+ * the file and bind the sensor address again. The old descriptor  *
+ * stays if the re-open fails.                                     *
  * --------------------------------------------------------------- */
-void lsm303d_set() {
-//   char  buf[2] = {MMC3416_CTL0_ADDR, 0x80}; // set bit-8 in reg 0x07
-//   if(verbose == 1) printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[1], buf[0]);
-//   if(write(i2cfd, buf, 2) != 2) {
-//      printf("Error: I2C write failure for register 0x%02X\n", buf[0]);
-//      exit(-1);
-//   }
-//   delay(60);                    // wait >50ms for the CAP charge to finish
-//
-//   buf[0] = MMC3416_CTL0_ADDR;   // ctl-0 register 0x07
-//   buf[1] = 0x20;                // bit-6: send SET CMD
-//   if(verbose == 1) printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[1], buf[0]);
-//   if(write(i2cfd, buf, 2) != 2) {
-//      printf("Error: I2C write failure for register 0x%02X\n", buf[0]);
-//      exit(-1);
-//   }
+static int i2cdev_reset(void *priv) {
+   struct i2cdev *dev = priv;
+   int fd = open(dev->path, O_RDWR);
+   if(fd < 0) return(-1);
+   if(ioctl(fd, I2C_SLAVE, dev->addr) != 0) {
+      close(fd);
+      return(-1);
+   }
+   close(dev->fd);
+   dev->fd = fd;
+   return(0);
 }
 
 /* --------------------------------------------------------------- *
- * lsm303d_reset()  reverses magnetization (180 degrees opposed)   *
+ * i2cdev_close() closes the bus and frees the backend state.      *
  * --------------------------------------------------------------- */
-void lsm303d_reset() {
-//   char  buf[2] = {MMC3416_CTL0_ADDR, 0x80}; // set bit-8 in reg 0x07
-//   if(verbose == 1) printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[1], buf[0]);
-//   if(write(i2cfd, buf, 2) != 2) {
-//      printf("Error: I2C write failure for register 0x%02X\n", buf[0]);
-//      exit(-1);
-//   }
-//   delay(60);                    // wait >50ms for the CAP charge to finish
-//
-//   buf[0] = MMC3416_CTL0_ADDR;   // ctl-0 register 0x07
-//   buf[1] = 0x40;                // bit-6: send RESET CMD
-//   if(verbose == 1) printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[1], buf[0]);
-//   if(write(i2cfd, buf, 2) != 2) {
-//      printf("Error: I2C write failure for register 0x%02X\n", buf[0]);
-//      exit(-1);
-//   }
+static void i2cdev_close(void *priv) {
+   struct i2cdev *dev = priv;
+   close(dev->fd);
+   free(dev);
 }
 
 /* --------------------------------------------------------------- *
- * lsm303d_init() identifies the initial sensor offset, runs the   *
- * SET/RESET function for Null Field output temp compensation, and *
- * clears the sensor residual from strong external magnet exposure *
+ * i2cdev_open() opens a Linux i2c-dev bus, binds the sensor addr  *
+ * and returns the transport, or NULL on error.                    *
  * --------------------------------------------------------------- */
-void lsm303d_init(struct lsm303ddata *lsm303dd) {
-   float ds1[3] = {0, 0, 0};
-   float ds2[3] = {0, 0, 0};
+struct lsm303d_transport *i2cdev_open(const char *i2cbus, int addr) {
+   struct i2cdev *dev = calloc(1, sizeof(struct i2cdev));
+   if(dev == NULL) return NULL;
 
-   if(verbose == 1) printf("Debug: lsm303d_init(): ...\n");
+   if((dev->fd = open(i2cbus, O_RDWR)) < 0) {
+      printf("Error failed to open I2C bus [%s].\n", i2cbus);
+      free(dev);
+      return NULL;
+   }
+   /* --------------------------------------------------------- *
+    * Set I2C device (LSM303D I2C address is 0x1d or 0x1e)      *
+    * --------------------------------------------------------- */
+   if(verbose == 1) printf("Debug: Sensor address: [0x%02X]\n", addr);
+   if(ioctl(dev->fd, I2C_SLAVE, addr) != 0) {
+      printf("Error can't find sensor at address [0x%02X].\n", addr);
+      close(dev->fd);
+      free(dev);
+      return NULL;
+   }
+   dev->addr          = addr;
+   strncpy(dev->path, i2cbus, sizeof(dev->path) - 1);
+   dev->tp.name       = "i2c-dev";
+   dev->tp.read_regs  = i2cdev_read;
+   dev->tp.write_regs = i2cdev_write;
+   dev->tp.reset      = i2cdev_reset;
+   dev->tp.close      = i2cdev_close;
+   dev->tp.priv       = dev;
+   return &dev->tp;
+}
 
-   /* ------------------------------------------------------------ *
-    * Magnetic Resolution M_RES=11 (00 = low res, 11 = high-res)   *
-    * Magnetic Output Data Rate M_ODR=001 6.25 Hz ODR (max 50hz)   *
-    * ------------------------------------------------------------ */
-   char buf[2] = {LSM303D_CTRL5, 0x64};
-   if(verbose == 1) printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[1], buf[0]);
-   if(write(i2cfd, buf, 2) != 2) {
-      printf("Error: I2C write failure for register 0x%02X\n", buf[0]);
-      exit(-1);
+/* --------------------------------------------------------------- *
+ * lsm303d_read_regs() reads len bytes starting at register reg    *
+ * through the active transport, a failure goes to fault_retry().  *
+ * Returns 0 on success, LSM303D_EIO on error.                     *
+ * --------------------------------------------------------------- */
+int lsm303d_read_regs(uint8_t reg, uint8_t *buf, uint16_t len) {
+   uint64_t t0 = mono_ns();
+   int res = lsm303d->bus->read_regs(lsm303d->bus->priv, reg, buf, len);
+   stats_xfer(0, len, mono_ns() - t0, res);
+   if(res == 0) return(0);
+   return fault_retry(reg, buf, NULL, len);
+}
+
+/* --------------------------------------------------------------- *
+ * lsm303d_write_regs() writes len bytes starting at register reg  *
+ * through the active transport, a failure goes to fault_retry().  *
+ * Returns 0 on success, LSM303D_EIO on error.                     *
+ * --------------------------------------------------------------- */
+int lsm303d_write_regs(uint8_t reg, const uint8_t *buf, uint16_t len) {
+   if(verbose == 1) {
+      for(int i=0; i<len; i++)
+         printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[i], reg+i);
    }
+   uint64_t t0 = mono_ns();
+   int res = lsm303d->bus->write_regs(lsm303d->bus->priv, reg, buf, len);
+   stats_xfer(1, len, mono_ns() - t0, res);
+   if(res != 0 && fault_retry(reg, NULL, buf, len) != 0) return(LSM303D_EIO);
+   cache_store_regs(reg, buf, len);
+   return(0);
+}
+
+/* --------------------------------------------------------------- *
+ * get_prdid() returns the LSM303D product id from register 0x0F.  *
+ * --------------------------------------------------------------- */
+char get_prdid() {
+   uint8_t buf = 0;
+   lsm303d_read_regs(LSM303D_WHO_AM_I, &buf, 1);
+   return buf;
+}
+
+/* --------------------------------------------------------------- *
+ * lsm303d_init() writes the default configuration to CTRL0..CTRL7 *
+ * through the register shadow, skipping the write if the cached   *
+ * configuration matches the sensor, clears the offset, and loads  *
+ * the ranges and the cached calibration of the selected sensor.   *
+ * --------------------------------------------------------------- */
+int lsm303d_init() {
+   if(verbose == 1) printf("Debug: lsm303d_init(): ...\n");
 
    /* ------------------------------------------------------------ *
-    * Magnetic full-scale selection MFS=01 +/- 4 gauss (default)   *
+    * CTRL0..CTRL7 are contiguous and go out in one burst write:   *
+    * CTRL0: FIFO disabled                                         *
+    * CTRL1: Acceleration data rate AODR=0101 50 Hz, XYZ enabled   *
+    * CTRL2: Acceleration full-scale AFS=000 +/- 2 g, 773 Hz AA    *
+    * CTRL3, CTRL4: no interrupts routed to INT1 and INT2          *
+    * CTRL5: TEMP_EN=1 temperature sensor on                       *
+    *        Magnetic Resolution M_RES=11 (00=low res, 11=high-res)*
+    *        Magnetic Output Data Rate M_ODR=001 6.25 Hz (max 50hz)*
+    * CTRL6: Magnetic full-scale selection MFS=01 +/- 4 gauss      *
+    * CTRL7: MLP=0 low power mode off; MD=00 continuous-conversion *
     * ------------------------------------------------------------ */
-   buf[0] = LSM303D_CTRL6;
-   buf[1] = 0x20;
-   if(verbose == 1) printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[1], buf[0]);
-   if(write(i2cfd, buf, 2) != 2) {
-      printf("Error: I2C write failure for register 0x%02X\n", buf[0]);
-      exit(-1);
-   }
+   uint8_t buf[8] = {0x00, 0x57, 0x00, 0x00, 0x00, 0xE4, 0x20, 0x00};
 
    /* ------------------------------------------------------------ *
-    * MLP=0 low power mode off; MD=00 continuous-conversion mode   *
+    * If the cache says these values were the last ones written,   *
+    * one readback seeds the shadow, and the commit below only     *
+    * writes what a power cycle changed. Without it, all 8 bytes   *
+    * go out in one burst.                                         *
     * ------------------------------------------------------------ */
-   buf[0] = LSM303D_CTRL7;
-   buf[1] = 0x00;
-   if(verbose == 1) printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[1], buf[0]);
-   if(write(i2cfd, buf, 2) != 2) {
-      printf("Error: I2C write failure for register 0x%02X\n", buf[0]);
-      exit(-1);
+   if(cache_ctrl_match(buf) && shadow_fetch(LSM303D_CTRL0, LSM303D_CTRL7) != 0) return(-1);
+   for(int i=0; i<8; i++) shadow_set(LSM303D_CTRL0 + i, 0xFF, buf[i]);
+   if(lsm303d->shadow.dirty == 0) {
+      if(verbose == 1) printf("Debug: lsm303d_init(): CTRL0..CTRL7 unchanged, skip write\n");
    }
+   else if(shadow_commit() != 0) return(-1);
+   lsm303d->acc_ready = 0;
 
-   offset[0] = 0; offset[1] = 0; offset[2] = 0; // clear offset
+   lsm303d->offset[0] = 0; lsm303d->offset[1] = 0; lsm303d->offset[2] = 0; // clear offset
+   lsm303d_calib_set(&lsm303d->cal, 1, 0);      // MFS=01, AFS=000 as written
+   cache_load_cal(&lsm303d->cal);               // cached calibration, if any
    if(verbose == 1) printf("Debug: lsm303d_init(): done\n");
+   return(0);
 }
 
 /* --------------------------------------------------------------- *
- * lsm303d_dump() dumps the complete register map data (15 bytes). *
+ * lsm303d_dump() dumps the complete register map data (64 bytes). *
  * --------------------------------------------------------------- */
 int lsm303d_dump() {
    /* ------------------------------------------------------ *
     * Read 64 bytes sensor reg data starting at 0x00         *
     * ------------------------------------------------------ */
-   char buf[64] = {0};
-   for(int i=0; i<64; i++) {
-      if(write(i2cfd, &i, 1) != 1) {
-         printf("Error: I2C write failure for register 0x%02X\n", i);
-         exit(-1);
-      }
-      if(read(i2cfd, &buf[i], 1) !=1) {
-         printf("Error: I2C read failure for register 0x%02X\n", i);
-         exit(-1);
-      }
-   }
+   uint8_t buf[LSM303D_REGMAP_SIZE] = {0};
+   if(lsm303d_read_regs(0x00, buf, LSM303D_REGMAP_SIZE) != 0) return(-1);
 
    /* ------------------------------------------------------ *
     * Display Register table                                 *
@@ -236,7 +370,7 @@ int lsm303d_dump() {
       }
       printf(": 0x%02X 0b"BYTE_TO_BINARY_PATTERN"\n", buf[i], BYTE_TO_BINARY(buf[i]));
    }
-   exit(0);
+   return(0);
 }
 
 /* --------------------------------------------------------------- *
@@ -251,7 +385,7 @@ int lsm303d_swreset() {
 //      exit(-1);
 //   }
 //   if(verbose == 1) printf("Debug: Sensor SW Reset complete\n");
-   exit(0);
+   return(0);
 }
 
 /* ------------------------------------------------------------ *
@@ -295,217 +429,346 @@ void lsm303d_info(struct lsm303dinf *lsm303di) {
 }
 
 /* --------------------------------------------------------------- *
- * set_cmfreq() set the continuous read frequency in register 0x07 *
+ * set_cmfreq() set the magnetic output data rate M_ODR in CTRL5   *
+ * bits 4..2: 0=3.125Hz 1=6.25Hz 2=12.5Hz 3=25Hz 4=50Hz 5=100Hz    *
+ * and the acceleration data rate AODR to at least the same rate,  *
+ * see lsm303d_set_rate(). Both go out in one shadow commit.       *
  * --------------------------------------------------------------- */
 int set_cmfreq(int new_mode) {
+   if(new_mode < 0 || new_mode > 5) return(-1);
+   if(verbose == 1) printf("Debug: Set  Read Freq: [0x%02X]\n", new_mode);
+
    /* ---------------------------------------- */
-   /* Check current freq from ctl-0 register   */
+   /* Set the new rates in the shadow, which   */
+   /* reads CTRL1 and CTRL5 only if unknown    */
    /* ---------------------------------------- */
-//   if(verbose == 1) printf("Debug: Set  Read Freq: [0x%02X]\n", new_mode);
-//   char reg = MMC3416_CTL0_ADDR;
-//   char regdata = 0;
-//   if(write(i2cfd, &reg, 1) != 1) {
-//      printf("Error: I2C write failure for register 0x%02X\n", reg);
-//      exit(-1);
-//   }
-//   if(read(i2cfd, &regdata, 1) != 1) {
-//      printf("Error: I2C read failure for register 0x%02X\n", reg);
-//      exit(-1);
-//   }
-//   if(verbose == 1) printf("Debug: Read data byte: [0x%02X] from [0x%02X]\n", regdata, reg);
-//
-//   /* ---------------------------------------- */
-//   /* frequency mode from reg 0x07 bit-2 and 3 */
-//   /* ---------------------------------------- */
-//   int current_mode = ((regdata >> 2) & 0x03);
-//   if(verbose == 1) printf("Debug: Cont Read Freq: [0x%02X]\n", current_mode);
-//
-//   /* ---------------------------------------- */
-//   /* Check if update is needed, or just exit  */
-//   /* ---------------------------------------- */
-//   if(new_mode == current_mode) {
-//      if(verbose == 1) printf("Debug: New freq = current freq, no change.\n");
-//      return(0);
-//   }
-// 
-//   /* ---------------------------------------- */
-//   /* Set new freq bits 2, 3 in ctl-0 register */
-//   /* ---------------------------------------- */
-//   regdata |= 1 << 0;       // bit-0: 1 start measuring
-//   regdata |= 1 << 1;       // bit-1: 1 enable continous mode = on
-//
-//   if(new_mode == 0) {
-//      regdata &= ~(1 << 2); // bit-2: 0
-//      regdata &= ~(1 << 3); // bit-3: 0
-//   }
-//   else if(new_mode == 1) {
-//      regdata |= 1 << 2;    // bit-2: 1
-//      regdata &= ~(1 << 3); // bit-3: 0
-//   }
-//   else if(new_mode == 2) {
-//      regdata &= ~(1 << 2); // bit-2: 0
-//      regdata |= 1 << 3;    // bit-3: 1
-//   }
-//   else if(new_mode == 3) {
-//      regdata |= 1 << 2;    // bit-2: 1
-//      regdata |= 1 << 3;    // bit-3: 1
-//   }
-//   regdata |= 1 << 5;       // bit-5: Set the data
-//
-//   /* ---------------------------------------- */
-//   /* write new setting to ctl-0 register 0x07 */
-//   /* ---------------------------------------- */
-//   char buf[2] = {0};
-//   buf[0] = reg;
-//   buf[1] = regdata;
-//   if(verbose == 1) printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[1], buf[0]);
-//   if(write(i2cfd, buf, 2) != 2) {
-//      printf("Error: I2C write failure for register 0x%02X\n", buf[0]);
-//      return(-1);
-//   }
-//
-//   /* ---------------------------------------- */
-//   /* read the changed data back from register */
-//   /* ---------------------------------------- */
-//   if(write(i2cfd, &reg, 1) != 1) {
-//      printf("Error: I2C write failure for register 0x%02X\n", reg);
-//   }
-//
-//   regdata = 0;
-//   if(read(i2cfd, &regdata, 1) != 1) {
-//      printf("Error: I2C read failure for register 0x%02X\n", reg);
-//   }
-//   if(verbose == 1) printf("Debug: Read data byte: [0x%02X] from [0x%02X]\n", regdata, reg);
-//   /* cont read frequency mode from reg 0x07 bit-2 and 3 */
-//   current_mode = ((regdata >> 2) & 0x03);
-//   if(new_mode != current_mode) {
-//      if(verbose == 1) printf("Debug: Update failed. New mode %d\n", current_mode);
-//      return -1;
-//   }
-//   if(verbose == 1) printf("Debug: Update sucess. New mode %d\n", current_mode);
+   if(lsm303d_set_rate(new_mode) != 0) return(-1);
+
+   /* ---------------------------------------- */
+   /* Check if update is needed, or just exit  */
+   /* ---------------------------------------- */
+   if(lsm303d->shadow.dirty == 0) {
+      if(verbose == 1) printf("Debug: New freq = current freq, no change.\n");
+      return(0);
+   }
+
+   /* ---------------------------------------- */
+   /* Write M_ODR and AODR, one commit; it     */
+   /* reads back if verify is enabled          */
+   /* ---------------------------------------- */
+   if(shadow_commit() != 0) {
+      if(verbose == 1) printf("Debug: Update failed. New mode %d\n", new_mode);
+      return -1;
+   }
+   if(verbose == 1) printf("Debug: Update sucess. New mode %d\n", new_mode);
+   return(0);
+}
+
+
+/* ------------------------------------------------------------ *
+ *  acc_period() returns the shadowed AODR sample period in ns, *
+ *  or 0 if the accelerometer is off or its rate is unknown.    *
+ * ------------------------------------------------------------ */
+static uint64_t acc_period() {
+   if(!(lsm303d->shadow.known & (1ULL << LSM303D_CTRL1))) return(0);
+   int aodr = lsm303d->shadow.reg[LSM303D_CTRL1] >> LSM303D_AODR_SHIFT;
+   if(aodr < 1 || aodr > 10) return(0);
+   return 320000000ULL >> (aodr - 1);              // 3.125 Hz << (aodr - 1)
+}
+
+/* ------------------------------------------------------------ *
+ *  lsm303d_read_raw() - wait for and read one raw 9-axis       *
+ *  snapshot of magnetic, acceleration and temperature data in  *
+ *  two burst transactions, each led by its status register:    *
+ *  TEMP_OUT_L..OUT_Z_H_M (0x05..0x0D, 9 bytes incl. STATUS_M)  *
+ *  and STATUS_A..OUT_Z_H_A (0x27..0x2D, 7 bytes). The mag block*
+ *  is polled until ZYXMDA, then the latest accel data is read. *
+ *  The first read after lsm303d_init() or a brown-out also     *
+ *  polls the accel block until ZYXADA. Later, a status_a       *
+ *  without ZYXADA marks acc[] as stale, it repeats the values  *
+ *  of the previous sample. A sample read across a repaired     *
+ *  brown-out is discarded and read again. raw->ts is the       *
+ *  CLOCK_MONOTONIC time of the read.                           *
+ * ------------------------------------------------------------ */
+int lsm303d_read_raw(struct lsm303draw *raw) {
+   uint8_t mblk[9] = {0};
+   uint8_t ablk[7] = {0};
+   uint64_t errors = lsm303d->faults.errors;
+   uint64_t reinits = lsm303d->faults.reinits;
+   uint64_t t0 = 0;
+   int res;
+
+   while(1) {
+      /* ---------------------------------------- */
+      /* Check status "data ready" in STATUS_M.   */
+      /* Without it for the stall time, or after  */
+      /* a bus fault, the sensor may have browned */
+      /* out and lost its configuration.          */
+      /* ---------------------------------------- */
+      while(1) {
+         if((res = lsm303d_read_regs(LSM303D_TEMP_OUT_L, mblk, 9)) != 0) return(res);
+         if(verbose == 1) printf("Debug: Read data byte: [0x%02X] from [0x%02X]\n",
+                                  mblk[2], LSM303D_STATUS_M);
+         if(mblk[2] & LSM303D_ZYXMDA) break;
+         uint64_t now = mono_ns(), stall = fault_stall_ns();
+         if(t0 == 0) t0 = now;
+         else if(now - t0 > stall) {
+            if((res = fault_stall(t0)) != 0) return(res);
+            t0 = 0;
+            continue;
+         }
+         if(lsm303d->irq != NULL) {                     // wait for DRDY on INT
+            if(lsm303d_irq_wait(stall < 1000000000ULL ? stall / 1000000 + 1 : 1000) < 0) return(-1);
+         }
+         else delay(10);  // wait time
+      }
+      raw->ts = mono_ns();
+
+      /* ---------------------------------------- */
+      /* Until the accelerometer delivered its    */
+      /* first sample, its output registers hold  */
+      /* zeros: wait for ZYXADA, one AODR period  */
+      /* at a time.                               */
+      /* ---------------------------------------- */
+      uint64_t aper = acc_period();
+      t0 = 0;
+      while(1) {
+         if((res = lsm303d_read_regs(LSM303D_STATUS_A, ablk, 7)) != 0) return(res);
+         if((ablk[0] & LSM303D_ZYXADA) || lsm303d->acc_ready || aper == 0) break;
+         uint64_t now = mono_ns(), stall = lsm303d->recovery.stall * aper;
+         if(stall < fault_stall_ns()) stall = fault_stall_ns();
+         if(t0 == 0) t0 = now;
+         else if(now - t0 > stall) {
+            if((res = fault_stall(t0)) != 0) return(res);
+            t0 = 0;
+            continue;
+         }
+         delay(aper / 1000000 + 1);
+         raw->ts = mono_ns();
+      }
+      if(lsm303d->faults.errors != errors && (res = lsm303d_check()) != 0) return(res);
+      if(lsm303d->faults.reinits == reinits) break;
+
+      /* ---------------------------------------- */
+      /* The configuration was written again, the */
+      /* blocks may come from the rebooted sensor */
+      /* ---------------------------------------- */
+      if(verbose == 1) printf("Debug: Brown-out repaired, discard the sample and read again\n");
+      reinits = lsm303d->faults.reinits;
+      errors = lsm303d->faults.errors;
+      lsm303d->acc_ready = 0;
+      t0 = 0;
+   }
+   if(ablk[0] & LSM303D_ZYXADA) lsm303d->acc_ready = 1;
+   stats_overrun(mblk[2], ablk[0]);
+   if(verbose == 1) {
+      for(int i=0; i<9; i++)
+         printf("Debug: Read data byte: [0x%02X] from [0x%02X]\n", mblk[i], LSM303D_TEMP_OUT_L+i);
+      for(int i=0; i<7; i++)
+         printf("Debug: Read data byte: [0x%02X] from [0x%02X]\n", ablk[i], LSM303D_STATUS_A+i);
+   }
+
+   /* ---------------------------------------- */
+   /* Combine LSB/MSB into 16-bit values. The  */
+   /* temperature is 12 bit two's complement.  */
+   /* ---------------------------------------- */
+   raw->temp     = (int16_t) ((mblk[1] << 12) | (mblk[0] << 4)) >> 4;
+   raw->status_m = mblk[2];
+   raw->mag[0]   = (int16_t) (mblk[4] << 8 | mblk[3]); // X
+   raw->mag[1]   = (int16_t) (mblk[6] << 8 | mblk[5]); // Y
+   raw->mag[2]   = (int16_t) (mblk[8] << 8 | mblk[7]); // Z
+   raw->status_a = ablk[0];
+   raw->acc[0]   = (int16_t) (ablk[2] << 8 | ablk[1]); // X
+   raw->acc[1]   = (int16_t) (ablk[4] << 8 | ablk[3]); // Y
+   raw->acc[2]   = (int16_t) (ablk[6] << 8 | ablk[5]); // Z
    return(0);
 }
 
+/* ------------------------------------------------------------ *
+ *  lsm303d_convert() - convert a raw sample to Milli Gauss,    *
+ *  milli g and degrees Celsius, with the active range and      *
+ *  calibration of the device. The temperature sensor is not    *
+ *  factory trimmed, 0 LSB is taken as 25 degrees C.            *
+ * ------------------------------------------------------------ */
+void lsm303d_convert(const struct lsm303draw *raw, struct lsm303dsample *smp) {
+   smp->ts    = raw->ts;
+   const struct lsm303d_calib *cal = &lsm303d->cal;
+   float m[3];
+   for(int i=0; i<3; i++) m[i] = cal->mag_sens[i] * (float) raw->mag[i] - cal->mag_off[i];
+   smp->mag.X = cal->mag_si[0][0] * m[0] + cal->mag_si[0][1] * m[1] + cal->mag_si[0][2] * m[2];
+   smp->mag.Y = cal->mag_si[1][0] * m[0] + cal->mag_si[1][1] * m[1] + cal->mag_si[1][2] * m[2];
+   smp->mag.Z = cal->mag_si[2][0] * m[0] + cal->mag_si[2][1] * m[1] + cal->mag_si[2][2] * m[2];
+   smp->acc.X = cal->acc_sens[0] * (float) raw->acc[0] - cal->acc_off[0];
+   smp->acc.Y = cal->acc_sens[1] * (float) raw->acc[1] - cal->acc_off[1];
+   smp->acc.Z = cal->acc_sens[2] * (float) raw->acc[2] - cal->acc_off[2];
+   smp->temp  = 25.0f + raw->temp / LSM303D_TEMP_LSB;
+}
 
 /* ------------------------------------------------------------ *
  *  lsm303d_read() - take a single data read over the XYZ axis  *
  *  convert to Milli Gauss, and store under the lsm303d object. *
  * ------------------------------------------------------------ */
 int lsm303d_read(struct lsm303ddata *lsm303dd) {
+   struct lsm303draw raw;
+   struct lsm303dsample smp;
+   if(lsm303d_read_raw(&raw) != 0) return(-1);
+   lsm303d_convert(&raw, &smp);
+   *lsm303dd = smp.mag;
+   if(verbose == 1) printf("Debug: Measured value: X-[%3.02f] Y-[%3.02f] Z-[%3.02f]\n",
+                            lsm303dd->X, lsm303dd->Y, lsm303dd->Z);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_powerdown() sets AODR=0000 accel power-down in CTRL1 *
+ * and MD=10 magnetic power-down in CTRL7. With CTRL2..CTRL6 in *
+ * the shadow, both go out in one burst.                        *
+ * ------------------------------------------------------------ */
+int lsm303d_powerdown() {
+   if(verbose == 1) printf("Debug: Sensor power-down\n");
+   if(lsm303d_set_aodr(0) != 0) return(-1);
+   if(lsm303d_set_md(LSM303D_MD_POWERDOWN) != 0) return(-1);
+   return shadow_commit();
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_fifo_start() enables the 32-level acceleration FIFO  *
+ * in stream mode. aodr is the CTRL1 AODR code (6 = 100 Hz) and *
+ * wtm the watermark level 1..31 signalled in FIFO_SRC FTH.     *
+ * CTRL0 and CTRL1 are contiguous and share one burst write,    *
+ * FIFO_CTRL follows; unchanged registers are not written.      *
+ * ------------------------------------------------------------ */
+int lsm303d_fifo_start(int aodr, int wtm) {
+   if(aodr < 1 || aodr > 10 || wtm < 1 || wtm > LSM303D_FTH_MASK) {
+      printf("Error: invalid FIFO setting aodr %d watermark %d\n", aodr, wtm);
+      return(-1);
+   }
+   if(verbose == 1) printf("Debug: FIFO stream mode, aodr [%d] watermark [%d]\n", aodr, wtm);
+
    /* ---------------------------------------- */
-   /* Request new measurement through reg 0x07 */
+   /* FM=010 stream mode, FTH = watermark      */
    /* ---------------------------------------- */
-//   char buf[2] = {0};
-//   buf[0] = MMC3416_CTL0_ADDR;   // ctl-0 register 0x07
-//   buf[1] = 0x01;                // bit-0: 1 request a new measurement
-//   if(verbose == 1) printf("Debug: Write databyte: [0x%02X] to   [0x%02X]\n", buf[1], buf[0]);
-//   if(write(i2cfd, buf, 2) != 2) {
-//      printf("Error: I2C write failure for register 0x%02X\n", buf[0]);
-//      return(-1);
-//   }
-//   if(verbose == 1) printf("Debug: Wait for measurement:\n");
-//
-//   /* ---------------------------------------- */
-//   /* Check status "result ready" in reg 0x06  */
-//   /* ---------------------------------------- */
-//   char reg = MMC3416_STATUS_ADDR;
-//   char regdata = 0;
-//   while(1) {
-//      if(write(i2cfd, &reg, 1) != 1) {
-//         printf("Error: I2C write failure for register 0x%02X\n", reg);
-//      }
-//
-//      if(read(i2cfd, &regdata, 1) != 1) {
-//         printf("Error: I2C read failure for register 0x%02X\n", reg);
-//      }
-//      if(verbose == 1) printf("Debug: Read data byte: [0x%02X] from [0x%02X]\n", regdata, reg);
-//
-//      //if the last bit is 1, data is ready
-//      if((regdata & 0x01) == 1) break;
-//      delay(10);  // wait time
-//   }
-//   if(verbose == 1) printf("Debug: measurement is ready.\n");
-//
-//   /* ---------------------------------------- */
-//   /* Data is ready to read from 0x00..0x05    */
-//   /* ---------------------------------------- */
-//   reg = MMC3416_XOUT_LSB_ADDR;
-//   if(write(i2cfd, &reg, 1) != 1) {
-//      printf("Error: I2C write failure for register 0x%02X\n", reg);
-//   }
-//   char measure[6] = {0, 0, 0, 0, 0, 0};
-//   if(read(i2cfd, measure, 6) != 6) {
-//      printf("Error: I2C read failure for register 0x%02X\n", reg);
-//   }
-//   if(verbose == 1) {
-//      for(int i=0; i<6; i++) {
-//         printf("Debug: Read data byte: [0x%02X] from [0x%02X]\n", measure[i], reg+i);
-//      }
-//   }
-//
-//   /* ---------------------------------------- */
-//   /* Combine LSB/MSB into 16-bit value X Y Z  */
-//   /* ---------------------------------------- */
-//   uint16_t measured_data[3];
-//   measured_data[0] = measure[1] << 8 | measure[0]; // X
-//   measured_data[1] = measure[3] << 8 | measure[2]; // Y
-//   measured_data[2] = measure[5] << 8 | measure[4]; // Z
-//
-//   /* ---------------------------------------- */
-//   /* Convert raw X Y Z data to milli Gauss    */
-//   /* ---------------------------------------- */
-//   lsm303dd->X = 0.48828125 * (float) measured_data[0] - offset[0];
-//   lsm303dd->Y = 0.48828125 * (float) measured_data[1] - offset[1];
-//   lsm303dd->Z = 0.48828125 * (float) measured_data[2] - offset[2];
-//   if(verbose == 1) printf("Debug: Measured value: X-[%3.02f] Y-[%3.02f] Z-[%3.02f]\n",
-//                            lsm303dd->X, lsm303dd->Y, lsm303dd->Z);
-//
-   return(0);
+   uint8_t fifo_ctrl = (LSM303D_FM_STREAM << LSM303D_FM_SHIFT) | wtm;
+   if(shadow_set(LSM303D_FIFO_CTRL, 0xFF, fifo_ctrl) != 0) return(-1);
+
+   /* ---------------------------------------- */
+   /* CTRL0: FIFO_EN FTH_EN, CTRL1: AODR, XYZ  */
+   /* ---------------------------------------- */
+   if(shadow_set(LSM303D_CTRL0, 0xFF, LSM303D_CTRL0_FIFO_EN | LSM303D_CTRL0_FTH_EN) != 0)
+      return(-1);
+   if(shadow_set(LSM303D_CTRL1, 0xFF, (aodr << LSM303D_AODR_SHIFT) | LSM303D_AXES_EN) != 0)
+      return(-1);
+   return shadow_commit();
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_fifo_read() drains all pending acceleration samples, *
+ * at most max, into acc[] and returns their count (-1 = error) *
+ * FIFO_SRC gives the fill level, then one burst read collects  *
+ * all samples: with the FIFO enabled, the auto-increment rolls *
+ * over from OUT_Z_H_A back to OUT_X_L_A. Two transactions per  *
+ * batch regardless of the batch size. If src is not NULL, it   *
+ * returns the FIFO_SRC byte; FIFO_OVRN there means the FIFO    *
+ * was full and older samples may have been overwritten.        *
+ * ------------------------------------------------------------ */
+int lsm303d_fifo_read(int16_t (*acc)[3], int max, uint8_t *src) {
+   uint8_t fifo_src = 0;
+   uint8_t data[LSM303D_FIFO_DEPTH * 6];
+
+   if(lsm303d_read_regs(LSM303D_FIFO_SRC, &fifo_src, 1) != 0) return(-1);
+   if(src != NULL) *src = fifo_src;
+
+   int level = fifo_src & LSM303D_FSS_MASK;
+   if(fifo_src & LSM303D_FIFO_OVRN) level = LSM303D_FIFO_DEPTH;
+   if(fifo_src & LSM303D_FIFO_EMPTY) level = 0;
+   if(level > max) level = max;
+   if(verbose == 1) printf("Debug: FIFO_SRC [0x%02X] level [%d]\n", fifo_src, level);
+   if(level == 0) return(0);
+
+   if(lsm303d_read_regs(LSM303D_OUT_X_L_A, data, level * 6) != 0) return(-1);
+   for(int i=0; i<level; i++) {
+      acc[i][0] = (int16_t) (data[i*6+1] << 8 | data[i*6+0]); // X
+      acc[i][1] = (int16_t) (data[i*6+3] << 8 | data[i*6+2]); // Y
+      acc[i][2] = (int16_t) (data[i*6+5] << 8 | data[i*6+4]); // Z
+   }
+   return(level);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_fifo_stop() returns the FIFO to bypass mode, which   *
+ * also clears its content, and disables FIFO_EN.               *
+ * ------------------------------------------------------------ */
+int lsm303d_fifo_stop() {
+   if(shadow_set(LSM303D_FIFO_CTRL, 0xFF, LSM303D_FM_BYPASS << LSM303D_FM_SHIFT) != 0)
+      return(-1);
+   if(shadow_set(LSM303D_CTRL0, 0xFF, 0x00) != 0) return(-1);
+   return shadow_commit();
+}
+
+/* ------------------------------------------------------- *
+ * heading_wrap() adds the local declination and wraps the *
+ * heading into [0, 360) degrees. The float add can round  *
+ * a small negative angle up to 360, which becomes 0.      *
+ * ------------------------------------------------------- */
+static float heading_wrap(float deg) {
+   deg += lsm303d->declination;
+   if(deg >= 360) deg -= 360;
+   if(deg < 0) deg += 360;
+   if(deg >= 360) deg = 0;
+   return deg;
 }
 
 /* ------------------------------------------------------- *
  * get_heading() convert two-axis value to compass heading *
+ * for a board that is held flat and face-up. The sensor   *
+ * axes are X forward, Y left, Z up, so with X east the    *
+ * field points along +Y and the heading is 90 degrees.    *
  * ------------------------------------------------------- */
 float get_heading(struct lsm303ddata *lsm303dd) {
-   float temp0 = 0; // partial result 0
-   float temp1 = 0; // partial result 1
-   float deg = 0;   // final result
-
-//   /* -------------------------------------------- */
-//   /* Calculate heading from magnetic field data.  */
-//   /* each quadrant has its own formula. Quadrant1 */
-//   /* -------------------------------------------- */
-//   if (lsm303dd->X < 0) {
-//      if (lsm303dd->Y > 0) { //Quadrant 1
-//         temp0 = lsm303dd->Y;
-//         temp1 = -lsm303dd->X;
-//         deg = 90 - atan(temp0 / temp1) * (180 / 3.14159);
-//      }
-//      else { //Quadrant 2
-//         temp0 = -lsm303dd->Y;
-//         temp1 = -lsm303dd->X;
-//         deg = 90 + atan(temp0 / temp1) * (180 / 3.14159);
-//      }
-//   }
-//   else { 
-//      if (lsm303dd->Y < 0) { //Quadrant 3
-//         temp0 = -lsm303dd->Y;
-//         temp1 = lsm303dd->X;
-//         deg = 270 - atan(temp0 / temp1) * (180 / 3.14159);
-//      }
-//      else { //Quadrant 4
-//         temp0 = lsm303dd->Y;
-//         temp1 = lsm303dd->X;
-//         deg = 270 + atan(temp0 / temp1) * (180 / 3.14159);
-//      }
-//   }
-//   deg += declination;
-//   if (declination > 0) {
-//      if (deg > 360) deg -= 360;
-//   } else {
-//      if (deg < 0) deg += 360;
-//   }
-   return deg;
+   float deg = atan2f(lsm303dd->Y, lsm303dd->X) * (180 / M_PI);
+   return heading_wrap(deg);
+}
+
+/* ------------------------------------------------------- *
+ * get_heading_tc() tilt-compensated eCompass heading. The *
+ * AN4248 formulas work in the body frame X forward, Y     *
+ * right, Z down, with the gravity vector G. The LSM303D   *
+ * axes are X forward, Y left, Z up, and at rest the accel *
+ * measures the specific force, 1 g up, so:                *
+ *   G = (-Ax, Ay, Az)   B = (Mx, -My, -Mz)                *
+ * Roll and pitch come from G, then B is rotated back into *
+ * the horizontal plane before taking the heading:         *
+ *   roll  = atan2(Gy, Gz)                                 *
+ *   pitch = atan(-Gx / (Gy sin(roll) + Gz cos(roll)))     *
+ *   Bh_x  = Bx cos(p) + By sin(p) sin(r) + Bz sin(p) cos(r)*
+ *   Bh_y  = Bz sin(r) - By cos(r)                         *
+ *   heading = atan2(Bh_y, Bh_x)                           *
+ * A single sample is usable at any attitude, except near  *
+ * pitch +/-90 degrees where the heading is undefined.     *
+ * ------------------------------------------------------- */
+float get_heading_tc(const struct lsm303dsample *smp) {
+   float gx = -smp->acc.X, gy = smp->acc.Y, gz = smp->acc.Z;
+   float bx = smp->mag.X, by = -smp->mag.Y, bz = -smp->mag.Z;
+
+   float roll  = atan2f(gy, gz);
+   float sr    = sinf(roll);
+   float cr    = cosf(roll);
+   float pitch = atanf(-gx / (gy * sr + gz * cr));
+   float sp    = sinf(pitch);
+   float cp    = cosf(pitch);
+
+   float bhx = bx * cp + by * sp * sr + bz * sp * cr;
+   float bhy = bz * sr - by * cr;
+   float deg = atan2f(bhy, bhx) * (180 / M_PI);
+   return heading_wrap(deg);
+}
+
+/* ------------------------------------------------------- *
+ * get_heading_batch() tilt-compensated headings for an    *
+ * array of n joint samples, results go to deg[].          *
+ * ------------------------------------------------------- */
+void get_heading_batch(const struct lsm303dsample *smp, float *deg, int n) {
+   for(int i=0; i<n; i++) deg[i] = get_heading_tc(&smp[i]);
 }
 
 /* ------------------------------------------------------- * 
@@ -525,3 +788,52 @@ int delay(long msec) {
 
    return res;
 }
+
+/* ------------------------------------------------------- *
+ * mono_ns() returns CLOCK_MONOTONIC in nanoseconds.       *
+ * ------------------------------------------------------- */
+uint64_t mono_ns() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* ------------------------------------------------------- *
+ * sched_start() starts a fixed-rate schedule. Deadlines   *
+ * are absolute: start + n * period, so sleep and wakeup   *
+ * jitter never accumulates into drift over long runs.     *
+ * ------------------------------------------------------- */
+void sched_start(struct lsm303d_sched *s, uint64_t period) {
+   memset(s, 0, sizeof(struct lsm303d_sched));
+   s->period = period;
+   s->next   = mono_ns() + period;
+}
+
+/* ------------------------------------------------------- *
+ * sched_wait() sleeps until the next deadline with        *
+ * clock_nanosleep(TIMER_ABSTIME). If the work since the   *
+ * last tick overran one or more deadlines, they count as  *
+ * missed and the schedule skips ahead on its time grid.   *
+ * Returns 0 at the deadline, -1 if a signal interrupted.  *
+ * ------------------------------------------------------- */
+int sched_wait(struct lsm303d_sched *s) {
+   uint64_t now = mono_ns();
+   if(now >= s->next + s->period) {
+      uint64_t k = (now - s->next) / s->period;
+      s->overruns++;
+      s->missed += k;
+      stats_missed(k);
+      s->next   += k * s->period;
+   }
+
+   struct timespec ts;
+   ts.tv_sec  = s->next / 1000000000ULL;
+   ts.tv_nsec = s->next % 1000000000ULL;
+   if(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) return(-1);
+
+   now = mono_ns();
+   if(now > s->next && now - s->next > s->max_lag) s->max_lag = now - s->next;
+   s->ticks++;
+   s->next += s->period;
+   return(0);
+}
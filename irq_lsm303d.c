@@ -0,0 +1,181 @@
+/* ------------------------------------------------------------ *
+ * file:        irq_lsm303d.c                                   *
+ * purpose:     Interrupt driven data-ready wakeups for the     *
+ *              LSM303D. Routes DRDY and FIFO watermark events  *
+ *              to INT1/INT2 through CTRL3/CTRL4, and blocks in *
+ *              poll() on a GPIO line event fd obtained from    *
+ *              the gpiochip character device, instead of       *
+ *              polling the status registers.                   *
+ *                                                              *
+ * Requires:	Linux gpiochip character device (/dev/gpiochipN)*
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <linux/gpio.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include "lsm303d.h"
+
+/* ------------------------------------------------------------ *
+ * gpio backend state: the line event fd is the pollable fd.    *
+ * ------------------------------------------------------------ */
+struct gpioirq{
+   struct lsm303d_irqline line;
+   int chipfd;         // gpiochip device file descriptor
+};
+
+/* ------------------------------------------------------------ *
+ * gpio_irq_ack() reads one rising edge event from the line fd  *
+ * ------------------------------------------------------------ */
+static int gpio_irq_ack(void *priv) {
+   struct gpioirq *irq = priv;
+   struct gpioevent_data event;
+   if(read(irq->line.fd, &event, sizeof(event)) != sizeof(event)) {
+      printf("Error: GPIO line event read failure\n");
+      return(-1);
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * gpio_irq_close() releases the line and closes the gpiochip   *
+ * ------------------------------------------------------------ */
+static void gpio_irq_close(void *priv) {
+   struct gpioirq *irq = priv;
+   close(irq->line.fd);
+   close(irq->chipfd);
+   free(irq);
+}
+
+/* ------------------------------------------------------------ *
+ * gpio_irq_open() requests rising edge events for one line of  *
+ * a gpiochip device, and returns the line or NULL on error.    *
+ * The LSM303D INT pins are push-pull, active high by default.  *
+ * ------------------------------------------------------------ */
+struct lsm303d_irqline *gpio_irq_open(const char *chip, int offset) {
+   struct gpioirq *irq = calloc(1, sizeof(struct gpioirq));
+   if(irq == NULL) return NULL;
+
+   if((irq->chipfd = open(chip, O_RDONLY)) < 0) {
+      printf("Error failed to open GPIO chip [%s].\n", chip);
+      free(irq);
+      return NULL;
+   }
+
+   struct gpioevent_request req;
+   memset(&req, 0, sizeof(req));
+   req.lineoffset  = offset;
+   req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+   req.eventflags  = GPIOEVENT_REQUEST_RISING_EDGE;
+   strncpy(req.consumer_label, "getlsm303d", sizeof(req.consumer_label) - 1);
+
+   if(ioctl(irq->chipfd, GPIO_GET_LINEEVENT_IOCTL, &req) < 0) {
+      printf("Error can't get events for GPIO line [%s:%d].\n", chip, offset);
+      close(irq->chipfd);
+      free(irq);
+      return NULL;
+   }
+   irq->line.name  = "gpio";
+   irq->line.fd    = req.fd;
+   irq->line.ack   = gpio_irq_ack;
+   irq->line.close = gpio_irq_close;
+   irq->line.priv  = irq;
+   return &irq->line;
+}
+
+/* ------------------------------------------------------------ *
+ * get_irqline() opens the interrupt line from the -g argument  *
+ * "<gpiochip>:<line>[:<pin>]", e.g. /dev/gpiochip0:17, or the  *
+ * simulated line "sim[:<pin>]". pin is the sensor INT pin 1/2  *
+ * wired to the line, default INT2. Only INT2 carries the FIFO  *
+ * watermark, INT1 supports data-ready only.                    *
+ * ------------------------------------------------------------ */
+void get_irqline(char *spec) {
+   if(lsm303d_irq_open(spec) != 0) exit(-1);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_irq_open() opens the interrupt line spec, in the     *
+ * get_irqline() format, for the selected device. Returns 0 on  *
+ * success, -1 on error.                                        *
+ * ------------------------------------------------------------ */
+int lsm303d_irq_open(const char *spec) {
+   char chip[256] = {0};
+   char *sep = strchr(spec, ':');
+
+   if(strncmp(spec, "sim", 3) == 0) {
+      if(sep != NULL) lsm303d->irqpin = atoi(sep + 1);
+   }
+   else {
+      if(sep == NULL || (size_t)(sep - spec) >= sizeof(chip)) {
+         printf("Error: GPIO line argument must be <gpiochip>:<line>[:<pin>].\n");
+         return(-1);
+      }
+      strncpy(chip, spec, sep - spec);
+      char *pinsep = strchr(sep + 1, ':');
+      if(pinsep != NULL) lsm303d->irqpin = atoi(pinsep + 1);
+   }
+   if(lsm303d->irqpin != 1 && lsm303d->irqpin != 2) {
+      printf("Error: sensor interrupt pin must be 1 or 2.\n");
+      return(-1);
+   }
+
+   if(chip[0] == '\0') lsm303d->irq = sim_irq_open(lsm303d->bus, lsm303d->irqpin);
+   else lsm303d->irq = gpio_irq_open(chip, atoi(sep + 1));
+   if(lsm303d->irq == NULL) return(-1);
+   if(verbose == 1) printf("Debug: IRQ line: [%s] backend [%s] INT%d\n",
+                            spec, lsm303d->irq->name, lsm303d->irqpin);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_irq_route() routes events to the INT pin wired to    *
+ * the interrupt line. events are CTRL4 P2_* bits; for INT1 the *
+ * data-ready bits translate to their CTRL3 P1_* positions.     *
+ * Returns 0 on success, -1 on error.                           *
+ * ------------------------------------------------------------ */
+int lsm303d_irq_route(uint8_t events) {
+   uint8_t reg = LSM303D_CTRL4;
+   if(lsm303d->irqpin == 1) {
+      if(events & (LSM303D_P2_FTH | LSM303D_P2_OVERRUN)) {
+         printf("Error: FIFO watermark interrupt requires INT2.\n");
+         return(-1);
+      }
+      reg = LSM303D_CTRL3;
+      events = ((events & LSM303D_P2_DRDYA) ? LSM303D_P1_DRDYA : 0) |
+               ((events & LSM303D_P2_DRDYM) ? LSM303D_P1_DRDYM : 0);
+   }
+   if(verbose == 1) printf("Debug: Route INT%d events [0x%02X]\n", lsm303d->irqpin, events);
+   if(shadow_set(reg, 0xFF, events) != 0) return(-1);
+   return shadow_commit();
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_irq_wait() blocks in poll() until the interrupt line *
+ * fires or timeout ms expire. Returns 1 if the line fired, 0   *
+ * on timeout and -1 on error. Callers check the sensor status  *
+ * before waiting, so an edge raised before the wait is not     *
+ * missed; the timeout is the fallback for a lost edge.         *
+ * ------------------------------------------------------------ */
+int lsm303d_irq_wait(int timeout) {
+   struct pollfd pfd = { .fd = lsm303d->irq->fd, .events = POLLIN };
+   int res;
+
+   do { res = poll(&pfd, 1, timeout); }
+   while (res < 0 && errno == EINTR);
+
+   if(res < 0) {
+      printf("Error: poll failure on the interrupt line\n");
+      return(-1);
+   }
+   if(res == 0) return(0);
+   if(lsm303d->irq->ack(lsm303d->irq->priv) != 0) return(-1);
+   return(1);
+}
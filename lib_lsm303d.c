@@ -0,0 +1,183 @@
+/* ------------------------------------------------------------ *
+ * file:        lib_lsm303d.c                                   *
+ * purpose:     Application API of liblsm303d.a/liblsm303d.so.  *
+ *              Each call takes the device handle, selects it   *
+ *              for the calling thread and restores the former  *
+ *              selection, so handles can be used from several  *
+ *              threads and next to the driver functions.       *
+ *              Errors return -1, an LSM303D_E code or NULL,    *
+ *              the library never exits.                        *
+ *                                                              *
+ * compile:	make liblsm303d.a liblsm303d.so                 *
+ *                                                              *
+ * example:	dev = lsm303d_open("/dev/i2c-1", 0x1d);         *
+ *		lsm303d_configure(dev, 5, -1, -1);              *
+ *		lsm303d_read_batch(dev, smp, 100);              *
+ *		lsm303d_heading_batch(dev, smp, deg, 100);      *
+ *		lsm303d_close(dev);                             *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "lsm303d.h"
+
+/* ------------------------------------------------------------ *
+ * global variables, declared in lsm303d.h. The programs define *
+ * their own, applications set it to 1 for debug output.        *
+ * ------------------------------------------------------------ */
+int verbose = 0;
+
+/* ------------------------------------------------------------ *
+ * lib_enter() selects dev and returns the former selection for *
+ * lib_leave(), which restores it.                              *
+ * ------------------------------------------------------------ */
+static struct lsm303d_dev *lib_enter(struct lsm303d_dev *dev) {
+   struct lsm303d_dev *prev = lsm303d;
+   lsm303d_select(dev);
+   return prev;
+}
+
+static void lib_leave(struct lsm303d_dev *prev) {
+   lsm303d_select(prev);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_open() connects to the sensor at addr (0x1d or 0x1e) *
+ * on bus, e.g. "/dev/i2c-1" or "sim", and initializes it with  *
+ * the cached calibration and declination. Returns the device   *
+ * handle, or NULL on error.                                    *
+ * ------------------------------------------------------------ */
+struct lsm303d_dev *lsm303d_open(const char *bus, int addr) {
+   struct lsm303d_dev *dev = malloc(sizeof(struct lsm303d_dev));
+   if(dev == NULL) return NULL;
+   lsm303d_dev_init(dev);
+
+   struct lsm303d_dev *prev = lib_enter(dev);
+   if(lsm303d_bus_open(bus, addr) != 0) {
+      lib_leave(prev);
+      free(dev);
+      return NULL;
+   }
+   if(lsm303d_init() != 0) {
+      dev->bus->close(dev->bus->priv);
+      lib_leave(prev);
+      free(dev);
+      return NULL;
+   }
+   cache_load_decl(&dev->declination);
+   lib_leave(prev);
+   return dev;
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_configure() sets the magnetic data rate M_ODR 0..5   *
+ * (3.125..100 Hz), with AODR at least as fast, and the full    *
+ * scale codes MFS 0..3 and AFS 0..4. -1 keeps a setting. The   *
+ * changes go out in one commit.                                *
+ * Returns 0 on success, -1 on error.                           *
+ * ------------------------------------------------------------ */
+int lsm303d_configure(struct lsm303d_dev *dev, int modr, int mfs, int afs) {
+   struct lsm303d_dev *prev = lib_enter(dev);
+   int res = 0;
+   if(modr != -1 && lsm303d_set_rate(modr) != 0) res = -1;
+   if(mfs != -1 && lsm303d_set_mfs(mfs) != 0) res = -1;
+   if(afs != -1 && lsm303d_set_afs(afs) != 0) res = -1;
+   if(res == 0) res = shadow_commit();
+   lib_leave(prev);
+   return res;
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_set_declination() sets the local declination in      *
+ * degrees that the headings include, and caches it.            *
+ * ------------------------------------------------------------ */
+void lsm303d_set_declination(struct lsm303d_dev *dev, float decl) {
+   struct lsm303d_dev *prev = lib_enter(dev);
+   dev->declination = decl;
+   cache_store_decl(decl);
+   lib_leave(prev);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_set_verify() turns the readback of each register     *
+ * commit on (1) or off (0, the default). A mismatch fails the  *
+ * commit that caused it.                                       *
+ * ------------------------------------------------------------ */
+void lsm303d_set_verify(struct lsm303d_dev *dev, int on) {
+   dev->shadow.verify = (on != 0);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_read_raw_batch() reads n new raw samples into raw,   *
+ * each one waits for the next magnetic data-ready, so n        *
+ * samples take n periods of M_ODR. Returns n, or the LSM303D_E *
+ * code of the read that failed after the fault recovery.       *
+ * ------------------------------------------------------------ */
+int lsm303d_read_raw_batch(struct lsm303d_dev *dev, struct lsm303draw *raw, int n) {
+   struct lsm303d_dev *prev = lib_enter(dev);
+   int i, res = 0;
+   for(i=0; i<n && (res = lsm303d_read_raw(&raw[i])) == 0; i++);
+   lib_leave(prev);
+   return (i == n) ? n : res;
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_read_batch() reads n new samples into smp, converted *
+ * to milli Gauss, milli g and Celsius with the calibration of  *
+ * the device. Returns n, or the LSM303D_E code on error.       *
+ * ------------------------------------------------------------ */
+int lsm303d_read_batch(struct lsm303d_dev *dev, struct lsm303dsample *smp, int n) {
+   struct lsm303d_dev *prev = lib_enter(dev);
+   struct lsm303draw raw;
+   int i, res = 0;
+   for(i=0; i<n && (res = lsm303d_read_raw(&raw)) == 0; i++) lsm303d_convert(&raw, &smp[i]);
+   lib_leave(prev);
+   return (i == n) ? n : res;
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_heading_batch() computes the tilt-compensated        *
+ * headings of n samples into deg, with the declination of the  *
+ * device. NAN marks a sample without gravity. Returns n.       *
+ * ------------------------------------------------------------ */
+int lsm303d_heading_batch(struct lsm303d_dev *dev, const struct lsm303dsample *smp, float *deg, int n) {
+   struct lsm303d_dev *prev = lib_enter(dev);
+   get_heading_batch(smp, deg, n);
+   lib_leave(prev);
+   return n;
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_set_recovery() replaces the bus fault recovery       *
+ * policy of the device.                                        *
+ * ------------------------------------------------------------ */
+void lsm303d_set_recovery(struct lsm303d_dev *dev, const struct lsm303d_recovery *pol) {
+   dev->recovery = *pol;
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_get_faults() copies the fault counters of the device *
+ * into f. The copy is not atomic against a thread reading the  *
+ * device at the same time.                                     *
+ * ------------------------------------------------------------ */
+void lsm303d_get_faults(struct lsm303d_dev *dev, struct lsm303d_faults *f) {
+   *f = dev->faults;
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_close() puts the sensor into power-down, closes its  *
+ * interrupt line and bus, and frees the handle. The cache file *
+ * stays mapped for other handles until the process ends.       *
+ * Returns 0, or -1 if the power-down failed.                   *
+ * ------------------------------------------------------------ */
+int lsm303d_close(struct lsm303d_dev *dev) {
+   struct lsm303d_dev *prev = lib_enter(dev);
+   int res = lsm303d_powerdown();
+   if(dev->irq != NULL) dev->irq->close(dev->irq->priv);
+   dev->bus->close(dev->bus->priv);
+   lib_leave(prev == dev ? &lsm303d_dev0 : prev);
+   free(dev);
+   return res;
+}
@@ -0,0 +1,247 @@
+/* ------------------------------------------------------------ *
+ * file:        log_lsm303d.c                                   *
+ * purpose:     Append-only binary sample log. Raw samples are  *
+ *              copied into a memory-mapped, preallocated file, *
+ *              so the capture loop makes no system call per    *
+ *              sample. The file grows in LSM303D_LOG_CHUNK     *
+ *              steps, or wraps around at a size limit. The     *
+ *              header keeps ranges, data rate and calibration  *
+ *              for the conversion by the loglsm303d reader.    *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#define _GNU_SOURCE             // mremap()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lsm303d.h"
+
+_Static_assert(sizeof(struct lsm303d_loghdr) == 256, "log header is 256 bytes");
+_Static_assert(sizeof(struct lsm303draw) == 24, "log record is 24 bytes");
+
+/* ------------------------------------------------------------ *
+ * log_map() maps size bytes of the log file, replacing an      *
+ * existing mapping. Returns 0 on success, -1 on error.         *
+ * ------------------------------------------------------------ */
+static int log_map(struct lsm303d_log *log, size_t size) {
+   void *map;
+   if(log->map == NULL)
+      map = mmap(NULL, size, log->rdonly ? PROT_READ : PROT_READ | PROT_WRITE,
+                 MAP_SHARED, log->fd, 0);
+   else
+      map = mremap(log->map, log->mapsize, size, MREMAP_MAYMOVE);
+   if(map == MAP_FAILED) {
+      printf("Error: could not map %zu bytes of the sample log.\n", size);
+      return(-1);
+   }
+   log->map = map;
+   log->mapsize = size;
+   log->hdr = (struct lsm303d_loghdr *) map;
+   log->rec = (struct lsm303draw *) ((uint8_t *) map + sizeof(struct lsm303d_loghdr));
+   log->slots = (size - sizeof(struct lsm303d_loghdr)) / sizeof(struct lsm303draw);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * log_grow() extends the file by one chunk, or up to the wrap  *
+ * size. The space is allocated, not sparse, so a full disk     *
+ * shows up here and not as a SIGBUS on a later record store.   *
+ * ------------------------------------------------------------ */
+static int log_grow(struct lsm303d_log *log) {
+   size_t size = log->mapsize + LSM303D_LOG_CHUNK;
+   if(log->hdr->cap != 0) {
+      size_t max = sizeof(struct lsm303d_loghdr) + log->hdr->cap * sizeof(struct lsm303draw);
+      if(size > max) size = max;
+   }
+   int err = posix_fallocate(log->fd, log->mapsize, size - log->mapsize);
+   if(err != 0) {
+      printf("Error: could not extend the sample log to %zu bytes: %s\n", size, strerror(err));
+      return(-1);
+   }
+   if(verbose == 1) printf("Debug: Sample log grows to %zu bytes\n", size);
+   return log_map(log, size);
+}
+
+/* ------------------------------------------------------------ *
+ * log_header() fills a log header with the ranges and the      *
+ * calibration of the device, the data rate codes from the     *
+ * register shadow, the declination, and period, the sample     *
+ * period in ns. It is shared by the raw and delta formats.     *
+ * ------------------------------------------------------------ */
+void log_header(struct lsm303d_loghdr *hdr, uint64_t period) {
+   memset(hdr, 0, sizeof(struct lsm303d_loghdr));
+   hdr->magic   = LSM303D_LOG_MAGIC;
+   hdr->version = LSM303D_LOG_VERSION;
+   hdr->hdrsize = sizeof(struct lsm303d_loghdr);
+   hdr->recsize = sizeof(struct lsm303draw);
+   hdr->mfs     = lsm303d->cal.mfs;
+   hdr->afs     = lsm303d->cal.afs;
+   hdr->modr    = (lsm303d->shadow.reg[LSM303D_CTRL5] >> LSM303D_MODR_SHIFT) & 0x07;
+   hdr->aodr    = lsm303d->shadow.reg[LSM303D_CTRL1] >> LSM303D_AODR_SHIFT;
+   hdr->period  = period;
+   hdr->declination = lsm303d->declination;
+   memcpy(hdr->mag_sens, lsm303d->cal.mag_sens, sizeof(hdr->mag_sens));
+   memcpy(hdr->mag_off, lsm303d->cal.mag_off, sizeof(hdr->mag_off));
+   memcpy(hdr->acc_sens, lsm303d->cal.acc_sens, sizeof(hdr->acc_sens));
+   memcpy(hdr->acc_off, lsm303d->cal.acc_off, sizeof(hdr->acc_off));
+   memcpy(hdr->mag_si, lsm303d->cal.mag_si, sizeof(hdr->mag_si));
+
+   struct timespec rt;
+   clock_gettime(CLOCK_REALTIME, &rt);
+   hdr->rt_offset = (int64_t) rt.tv_sec * 1000000000LL + rt.tv_nsec - (int64_t) mono_ns();
+}
+
+/* ------------------------------------------------------------ *
+ * log_calib() sets cal to the ranges and the calibration that  *
+ * a log header recorded, the reverse of log_header().          *
+ * ------------------------------------------------------------ */
+void log_calib(const struct lsm303d_loghdr *hdr, struct lsm303d_calib *cal) {
+   cal->mfs = hdr->mfs;
+   cal->afs = hdr->afs;
+   memcpy(cal->mag_sens, hdr->mag_sens, sizeof(hdr->mag_sens));
+   memcpy(cal->mag_off, hdr->mag_off, sizeof(hdr->mag_off));
+   memcpy(cal->acc_sens, hdr->acc_sens, sizeof(hdr->acc_sens));
+   memcpy(cal->acc_off, hdr->acc_off, sizeof(hdr->acc_off));
+   memcpy(cal->mag_si, hdr->mag_si, sizeof(hdr->mag_si));
+}
+
+/* ------------------------------------------------------------ *
+ * log_create() starts a new log in file. limit is the file     *
+ * size in bytes at which records wrap around, 0 = no limit.    *
+ * period is the sample period in ns, see log_header().         *
+ * Returns 0 on success, -1 on error.                           *
+ * ------------------------------------------------------------ */
+int log_create(struct lsm303d_log *log, const char *file, uint64_t limit, uint64_t period) {
+   uint64_t cap = 0;
+   memset(log, 0, sizeof(struct lsm303d_log));
+
+   if(limit != 0) {
+      if(limit < sizeof(struct lsm303d_loghdr) + sizeof(struct lsm303draw)) {
+         printf("Error: sample log limit %llu bytes is too small.\n", (unsigned long long) limit);
+         return(-1);
+      }
+      cap = (limit - sizeof(struct lsm303d_loghdr)) / sizeof(struct lsm303draw);
+   }
+
+   log->fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if(log->fd < 0) {
+      printf("Error: could not create sample log %s\n", file);
+      return(-1);
+   }
+   size_t size = sizeof(struct lsm303d_loghdr);
+   int err = posix_fallocate(log->fd, 0, size);
+   if(err != 0 || log_map(log, size) != 0) {
+      printf("Error: could not allocate sample log %s\n", file);
+      close(log->fd);
+      return(-1);
+   }
+
+   log_header(log->hdr, period);
+   log->hdr->flags = (cap != 0) ? LSM303D_LOG_WRAP : 0;
+   log->hdr->cap   = cap;
+
+   if(verbose == 1) printf("Debug: Sample log [%s] created, %llu slots%s\n", file,
+                            (unsigned long long) cap, (cap != 0) ? " with wrap" : " (no limit)");
+   return log_grow(log);
+}
+
+/* ------------------------------------------------------------ *
+ * log_append() stores one raw sample. Only a chunk growth      *
+ * makes system calls, once per LSM303D_LOG_CHUNK bytes. The    *
+ * count is published after the record, for live readers.      *
+ * Returns 0 on success, -1 on error.                           *
+ * ------------------------------------------------------------ */
+int log_append(struct lsm303d_log *log, const struct lsm303draw *raw) {
+   uint64_t n = log->hdr->count;
+   uint64_t slot = (log->hdr->cap != 0) ? n % log->hdr->cap : n;
+   if(slot >= log->slots && log_grow(log) != 0) return(-1);
+   log->rec[slot] = *raw;
+   __atomic_store_n(&log->hdr->count, n + 1, __ATOMIC_RELEASE);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * log_open() maps an existing log read-only and checks its     *
+ * header. Returns 0 on success, -1 on error, 1 for a delta     *
+ * compressed archive, which zlog_open() reads, 2 for an accel  *
+ * capture, which capture_open() reads.                         *
+ * ------------------------------------------------------------ */
+int log_open(struct lsm303d_log *log, const char *file) {
+   struct stat st;
+   memset(log, 0, sizeof(struct lsm303d_log));
+   log->rdonly = 1;
+
+   log->fd = open(file, O_RDONLY);
+   if(log->fd < 0) {
+      printf("Error: could not open sample log %s\n", file);
+      return(-1);
+   }
+   if(fstat(log->fd, &st) != 0 || st.st_size < sizeof(struct lsm303d_loghdr)) {
+      printf("Error: %s is not a sample log.\n", file);
+      close(log->fd);
+      return(-1);
+   }
+   if(log_map(log, st.st_size) != 0) {
+      close(log->fd);
+      return(-1);
+   }
+   struct lsm303d_loghdr *hdr = log->hdr;
+   if(hdr->magic == LSM303D_LOG_MAGIC && (hdr->flags & LSM303D_LOG_DELTA)) {
+      log_close(log);
+      return(1);
+   }
+   if(hdr->magic == LSM303D_LOG_MAGIC && (hdr->flags & LSM303D_LOG_ACC)) {
+      log_close(log);
+      return(2);
+   }
+   if(hdr->magic != LSM303D_LOG_MAGIC || hdr->version != LSM303D_LOG_VERSION
+      || hdr->hdrsize != sizeof(struct lsm303d_loghdr)
+      || hdr->recsize != sizeof(struct lsm303draw)) {
+      printf("Error: %s is not a version %d sample log.\n", file, LSM303D_LOG_VERSION);
+      log_close(log);
+      return(-1);
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * log_record() returns the i-th oldest record still in the log *
+ * or NULL past the last one. After a wrap, the oldest record   *
+ * sits right after the newest one.                             *
+ * ------------------------------------------------------------ */
+const struct lsm303draw *log_record(const struct lsm303d_log *log, uint64_t i) {
+   uint64_t count = __atomic_load_n(&log->hdr->count, __ATOMIC_ACQUIRE);
+   uint64_t cap = log->hdr->cap;
+   uint64_t kept = (cap != 0 && count > cap) ? cap : count;
+   if(i >= kept) return NULL;
+   uint64_t slot = count - kept + i;
+   if(cap != 0) slot %= cap;
+   if(slot >= log->slots) return NULL;    // written after our mapping
+   return &log->rec[slot];
+}
+
+/* ------------------------------------------------------------ *
+ * log_close() flushes a written log and trims the unused part  *
+ * of the last chunk, then unmaps the file.                     *
+ * ------------------------------------------------------------ */
+void log_close(struct lsm303d_log *log) {
+   if(log->map == NULL) return;
+   if(!log->rdonly) {
+      uint64_t used = log->hdr->count;
+      if(log->hdr->cap != 0 && used > log->hdr->cap) used = log->hdr->cap;
+      size_t size = sizeof(struct lsm303d_loghdr) + used * sizeof(struct lsm303draw);
+      msync(log->map, log->mapsize, MS_SYNC);
+      if(ftruncate(log->fd, size) != 0) printf("Error: could not trim the sample log.\n");
+      if(verbose == 1) printf("Debug: Sample log closed, %llu records, %zu bytes\n",
+                               (unsigned long long) log->hdr->count, size);
+   }
+   munmap(log->map, log->mapsize);
+   close(log->fd);
+   log->map = NULL;
+}
@@ -0,0 +1,256 @@
+/* ------------------------------------------------------------ *
+ * file:        loglsm303d.c                                    *
+ * purpose:     Reader for the binary sample logs, the delta    *
+ *              archives and the accel captures written by      *
+ *              getlsm303d -o, -o -z and -a -o. Exports the     *
+ *              records as CSV or                               *
+ *              JSON, converted to units with the ranges and    *
+ *              calibration from the log header, or as raw      *
+ *              sensor counts.                                  *
+ *                                                              *
+ * return:      0 on success, and -1 on errors.                 *
+ *                                                              *
+ * example:	./loglsm303d -j lsm303d.log > lsm303d.json      *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <math.h>
+#include "lsm303d.h"
+
+int verbose = 0;
+int jsonflag = 0;         // 1 = JSON, 0 = CSV
+int rawflag = 0;          // 1 = raw counts, 0 = units
+int infoflag = 0;         // 1 = header only
+uint64_t start = 0;       // -s first sample to export
+uint64_t count = UINT64_MAX; // -n samples to export
+int zipped = 0;           // 1 = delta compressed archive
+int accflag = 0;          // 1 = high-rate accel capture
+struct lsm303d_log rawlog;
+struct lsm303d_zlog zlog;
+struct lsm303d_capture capture;
+
+/* ------------------------------------------------------------ *
+ * usage() prints the programs commandline instructions.        *
+ * ------------------------------------------------------------ */
+void usage() {
+   static char const usage[] = "Usage: loglsm303d [-i] [-j] [-r] [-s first] [-n count] [-v] logfile\n\
+\n\
+Command line parameters have the following format:\n\
+   -i   print the log header information only\n\
+   -j   export JSON instead of CSV\n\
+   -r   export raw sensor counts instead of milli Gauss, milli g and Celsius\n\
+   -s   start the export at sample number first, archives seek by block index\n\
+   -n   export at most count samples\n\
+   -h   display this message\n\
+   -v   enable debug output\n\
+\n\
+Usage examples:\n\
+./loglsm303d -i lsm303d.log\n\
+./loglsm303d lsm303d.log > lsm303d.csv\n\
+./loglsm303d -j -r lsm303d.log > lsm303d.json\n\
+./loglsm303d -s 360000 -n 6000 lsm303d.lza\n\
+./loglsm303d vibration.cap > vibration.csv\n\n";
+   printf(usage);
+}
+
+/* ------------------------------------------------------------ *
+ * parseargs() checks the commandline arguments with C getopt   *
+ * ------------------------------------------------------------ */
+void parseargs(int argc, char* argv[]) {
+   int arg;
+   opterr = 0;
+
+   while ((arg = (int) getopt (argc, argv, "ijn:rs:hv")) != -1) {
+      switch (arg) {
+         case 'i':
+            infoflag = 1; break;
+         case 'j':
+            jsonflag = 1; break;
+         case 'n':
+            count = strtoull(optarg, NULL, 10); break;
+         case 'r':
+            rawflag = 1; break;
+         case 's':
+            start = strtoull(optarg, NULL, 10); break;
+         case 'v':
+            verbose = 1; break;
+         case 'h':
+         case '?':
+         default:
+            usage(); exit(-1);
+      }
+   }
+   if(optind != argc - 1) { usage(); exit(-1); }
+}
+
+/* ------------------------------------------------------------ *
+ * next_record() returns the next sample of the log or archive, *
+ * or NULL at the end. n counts from the -s start sample.       *
+ * ------------------------------------------------------------ */
+static const struct lsm303draw *next_record(uint64_t n) {
+   static struct lsm303draw raw;
+   if(accflag == 1) return NULL;
+   if(zipped == 0) return log_record(&rawlog, start + n);
+   return (zlog_next(&zlog, &raw) == 0) ? &raw : NULL;
+}
+
+/* ------------------------------------------------------------ *
+ * print_info() prints the log header                           *
+ * ------------------------------------------------------------ */
+static void print_info(const struct lsm303d_loghdr *hdr) {
+   uint64_t kept = (hdr->cap != 0 && hdr->count > hdr->cap) ? hdr->cap : hdr->count;
+   time_t t0 = hdr->rt_offset / 1000000000LL;
+   const struct lsm303draw *first = next_record(0);
+   if(first != NULL) t0 = (first->ts + hdr->rt_offset) / 1000000000LL;
+   if(accflag == 1 && hdr->count > 0) t0 = (hdr->t0 + hdr->rt_offset) / 1000000000LL;
+
+   printf("----------------------------------------------\n");
+   printf("LSM303D sample %s version %d\n", accflag ? "accel capture" : zipped ? "archive" : "log",
+          hdr->version);
+   printf("----------------------------------------------\n");
+   printf("     First sample = %s", ctime(&t0));
+   printf("          Records = %llu written, %llu kept\n",
+          (unsigned long long) hdr->count, (unsigned long long) kept);
+   if(hdr->flags & LSM303D_LOG_WRAP)
+      printf("       Wrap limit = %llu records\n", (unsigned long long) hdr->cap);
+   if(zipped == 1)
+      printf("     Delta blocks = %u, %.2f bytes/sample\n", zlog.blocks, hdr->count ?
+             (double) (zlog.mapsize - sizeof(struct lsm303d_loghdr)) / hdr->count : 0.0);
+   if(hdr->period != 0)
+      printf("    Sample period = %.3f ms (%.3f Hz)\n", hdr->period / 1e6, 1e9 / hdr->period);
+   else printf("    Sample period = single reads\n");
+   printf("   Range MFS, AFS = %d, %d (M_ODR %d, AODR %d)\n", hdr->mfs, hdr->afs,
+          hdr->modr, hdr->aodr);
+   printf("  Mag sensitivity = %.3f %.3f %.3f mGauss/LSB\n",
+          hdr->mag_sens[0], hdr->mag_sens[1], hdr->mag_sens[2]);
+   printf("  Acc sensitivity = %.3f %.3f %.3f mg/LSB\n",
+          hdr->acc_sens[0], hdr->acc_sens[1], hdr->acc_sens[2]);
+   printf("  Hard-iron offset = X=%.2f Y=%.2f Z=%.2f mGauss\n",
+          hdr->mag_off[0], hdr->mag_off[1], hdr->mag_off[2]);
+   printf("      Declination = %.2f degrees\n", hdr->declination);
+}
+
+/* ------------------------------------------------------------ *
+ * export_capture() exports the accel capture records, dated by *
+ * their position on the AODR time grid.                        *
+ * ------------------------------------------------------------ */
+static uint64_t export_capture(const struct lsm303d_loghdr *hdr) {
+   uint64_t i;
+   if(jsonflag == 1) printf("[\n");
+   else printf("time,acc_x,acc_y,acc_z\n");
+   for(i=0; i < count && start + i < hdr->count; i++) {
+      const int16_t *a = capture.acc[start + i];
+      int64_t ts = (int64_t) (hdr->t0 + (start + i) * hdr->period) + hdr->rt_offset;
+      long long sec = ts / 1000000000LL, usec = (ts % 1000000000LL) / 1000;
+      if(rawflag == 1 && jsonflag == 1)
+         printf("%s{\"time\":%lld.%06lld,\"acc\":[%d,%d,%d]}", (i > 0) ? ",\n" : "",
+                sec, usec, a[0], a[1], a[2]);
+      else if(rawflag == 1)
+         printf("%lld.%06lld,%d,%d,%d\n", sec, usec, a[0], a[1], a[2]);
+      else {
+         float x = hdr->acc_sens[0] * a[0] - hdr->acc_off[0];
+         float y = hdr->acc_sens[1] * a[1] - hdr->acc_off[1];
+         float z = hdr->acc_sens[2] * a[2] - hdr->acc_off[2];
+         if(jsonflag == 1)
+            printf("%s{\"time\":%lld.%06lld,\"acc\":[%.2f,%.2f,%.2f]}", (i > 0) ? ",\n" : "",
+                   sec, usec, x, y, z);
+         else printf("%lld.%06lld,%.2f,%.2f,%.2f\n", sec, usec, x, y, z);
+      }
+   }
+   if(jsonflag == 1) printf("%s]\n", (i > 0) ? "\n" : "");
+   return i;
+}
+
+int main(int argc, char *argv[]) {
+   parseargs(argc, argv);
+   int res = log_open(&rawlog, argv[optind]);
+   if(res < 0) exit(-1);
+   if(res == 1) {
+      zipped = 1;
+      if(zlog_open(&zlog, argv[optind]) != 0) exit(-1);
+   }
+   if(res == 2) {
+      accflag = 1;
+      if(capture_open(&capture, argv[optind]) != 0) exit(-1);
+   }
+   const struct lsm303d_loghdr *hdr = accflag ? capture.hdr : zipped ? &zlog.hdr : rawlog.hdr;
+   if(infoflag == 1) {
+      print_info(hdr);
+      if(accflag) capture_close(&capture);
+      else if(zipped) zlog_close(&zlog);
+      else log_close(&rawlog);
+      exit(0);
+   }
+   if(accflag == 1) {
+      static char obuf[1 << 16];
+      setvbuf(stdout, obuf, _IOFBF, sizeof(obuf));
+      uint64_t n = export_capture(hdr);
+      fflush(stdout);
+      if(verbose == 1) fprintf(stderr, "Debug: %llu records exported\n", (unsigned long long) n);
+      capture_close(&capture);
+      exit(0);
+   }
+   if(zipped && start > 0 && zlog_seek(&zlog, start) != 0) {
+      printf("Error: sample %llu is past the end of the archive.\n", (unsigned long long) start);
+      exit(-1);
+   }
+
+   /* ----------------------------------------------------------- *
+    * The conversion uses the ranges and calibration of the log   *
+    * ----------------------------------------------------------- */
+   log_calib(hdr, &lsm303d->cal);
+   lsm303d->declination = hdr->declination;
+
+   static char obuf[1 << 16];
+   setvbuf(stdout, obuf, _IOFBF, sizeof(obuf));
+   if(jsonflag == 1) printf("[\n");
+   else if(rawflag == 1) printf("time,mag_x,mag_y,mag_z,acc_x,acc_y,acc_z,temp,status_m,status_a\n");
+   else printf("time,mag_x,mag_y,mag_z,acc_x,acc_y,acc_z,temp,heading\n");
+
+   const struct lsm303draw *raw;
+   struct lsm303dsample smp;
+   uint64_t i;
+   for(i=0; i < count && (raw = next_record(i)) != NULL; i++) {
+      int64_t ts = (int64_t) raw->ts + hdr->rt_offset;
+      long long sec = ts / 1000000000LL, usec = (ts % 1000000000LL) / 1000;
+      if(rawflag == 1 && jsonflag == 1)
+         printf("%s{\"time\":%lld.%06lld,\"mag\":[%d,%d,%d],\"acc\":[%d,%d,%d],\"temp\":%d,"
+                "\"status_m\":%d,\"status_a\":%d}", (i > 0) ? ",\n" : "", sec, usec,
+                raw->mag[0], raw->mag[1], raw->mag[2], raw->acc[0], raw->acc[1], raw->acc[2],
+                raw->temp, raw->status_m, raw->status_a);
+      else if(rawflag == 1)
+         printf("%lld.%06lld,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", sec, usec,
+                raw->mag[0], raw->mag[1], raw->mag[2], raw->acc[0], raw->acc[1], raw->acc[2],
+                raw->temp, raw->status_m, raw->status_a);
+      else {
+         lsm303d_convert(raw, &smp);
+         /* no heading without gravity, e.g. before the first accel */
+         /* sample: null in JSON, an empty CSV field                */
+         char heading[16] = "";
+         float deg = get_heading_tc(&smp);
+         if(isfinite(deg)) snprintf(heading, sizeof(heading), "%.2f", deg);
+         else if(jsonflag == 1) strcpy(heading, "null");
+         if(jsonflag == 1)
+            printf("%s{\"time\":%lld.%06lld,\"mag\":[%.2f,%.2f,%.2f],\"acc\":[%.2f,%.2f,%.2f],"
+                   "\"temp\":%.1f,\"heading\":%s}", (i > 0) ? ",\n" : "", sec, usec,
+                   smp.mag.X, smp.mag.Y, smp.mag.Z, smp.acc.X, smp.acc.Y, smp.acc.Z,
+                   smp.temp, heading);
+         else
+            printf("%lld.%06lld,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%s\n", sec, usec,
+                   smp.mag.X, smp.mag.Y, smp.mag.Z, smp.acc.X, smp.acc.Y, smp.acc.Z,
+                   smp.temp, heading);
+      }
+   }
+   if(jsonflag == 1) printf("%s]\n", (i > 0) ? "\n" : "");
+   fflush(stdout);
+   if(verbose == 1) fprintf(stderr, "Debug: %llu records exported\n", (unsigned long long) i);
+   if(zipped) zlog_close(&zlog);
+   else log_close(&rawlog);
+   exit(0);
+}
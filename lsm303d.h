@@ -11,8 +11,8 @@
  * 3:SDA---------------A4(I2C:SDA)                              *
  * 4:CLK---------------A5(I2C:SCL)                              *
  * 5:SDO(SA0)----------X (not connected assigns SA0=1)          *
- * 6:INT1--------------X (not connected)                        *
- * 7:INT2--------------X (not connected)                        *
+ * 6:INT1--------------X (not connected, optional GPIO for -g)  *
+ * 7:INT2--------------X (not connected, optional GPIO for -g)  *
  * 8:CS----------------X (not connected)                        *
  * ------------------------------------------------------------ */
 
@@ -24,6 +24,8 @@
 #define I2C_ADDR            "0x1d" // The sensor default I2C addr
 #define PRD_ID               0x49  // LSM303D responds with 0x49
 #define POWER_MODE_NORMAL    0x00  // sensor default power mode
+#define LSM303D_AUTO_INC     0x80  // sub-address MSB=1 enables auto-increment
+#define LSM303D_REGMAP_SIZE    64  // register map size 0x00..0x3F
 
 /* ------------------------------------------------------------ *
  * Sensor register address information                          *
@@ -38,6 +40,10 @@
 #define LSM303D_OUT_Z_L_M       0x0C    // Z-axis magnetic data register (read-only) LSB
 #define LSM303D_OUT_Z_H_M       0x0D    // Z-axis magnetic data register (read-only) MSB
 #define LSM303D_WHO_AM_I        0x0F    // Product ID register (read-only, aka WHO_AM_I)
+#define LSM303D_INT_CTRL_M      0x12    // magnetic interrupt configuration (rw)
+#define LSM303D_INT_SRC_M       0x13    // magnetic interrupt source (read-only)
+#define LSM303D_INT_THS_L_M     0x14    // magnetic interrupt threshold (rw) LSB
+#define LSM303D_INT_THS_H_M     0x15    // magnetic interrupt threshold (rw) MSB
 #define LSM303D_CTRL0           0x1F    // rw
 #define LSM303D_CTRL1           0x20    // rw
 #define LSM303D_CTRL2           0x21    // rw
@@ -53,6 +59,82 @@
 #define LSM303D_OUT_Y_H_A       0x2B    // Y-axis acceleration data register (read-only) MSB
 #define LSM303D_OUT_Z_L_A       0x2C    // Z-axis acceleration data register (read-only) LSB
 #define LSM303D_OUT_Z_H_A       0x2D    // Z-axis acceleration data register (read-only) MSB
+#define LSM303D_FIFO_CTRL       0x2E    // FIFO mode and watermark threshold (rw)
+#define LSM303D_FIFO_SRC        0x2F    // FIFO fill level and status (read-only)
+#define LSM303D_IG_CFG1         0x30    // inertial interrupt generator 1 configuration (rw)
+#define LSM303D_IG_SRC1         0x31    // inertial interrupt generator 1 source (read-only)
+#define LSM303D_IG_THS1         0x32    // inertial interrupt generator 1 threshold (rw)
+#define LSM303D_IG_DUR1         0x33    // inertial interrupt generator 1 duration (rw)
+#define LSM303D_IG_CFG2         0x34    // inertial interrupt generator 2 configuration (rw)
+#define LSM303D_IG_SRC2         0x35    // inertial interrupt generator 2 source (read-only)
+#define LSM303D_IG_THS2         0x36    // inertial interrupt generator 2 threshold (rw)
+#define LSM303D_IG_DUR2         0x37    // inertial interrupt generator 2 duration (rw)
+#define LSM303D_CLICK_CFG       0x38    // click detection configuration (rw)
+#define LSM303D_CLICK_SRC       0x39    // click detection source (read-only)
+#define LSM303D_CLICK_THS       0x3A    // click detection threshold (rw)
+#define LSM303D_TIME_LIMIT      0x3B    // click time limit (rw)
+#define LSM303D_TIME_LATENCY    0x3C    // click time latency (rw)
+#define LSM303D_TIME_WINDOW     0x3D    // click time window (rw)
+#define LSM303D_ACT_THS         0x3E    // sleep-to-wake activation threshold (rw)
+#define LSM303D_ACT_DUR         0x3F    // sleep-to-wake activation duration (rw)
+
+/* ------------------------------------------------------------ *
+ * Status register bits (STATUS_M 0x07, STATUS_A 0x27)          *
+ * ------------------------------------------------------------ */
+#define LSM303D_ZYXMDA          0x08    // STATUS_M: new X, Y, Z magnetic data available
+#define LSM303D_ZYXMOR          0x80    // STATUS_M: magnetic data overrun
+#define LSM303D_ZYXADA          0x08    // STATUS_A: new X, Y, Z acceleration data available
+#define LSM303D_ZYXAOR          0x80    // STATUS_A: acceleration data overrun
+
+/* ------------------------------------------------------------ *
+ * Control register bit fields                                  *
+ * ------------------------------------------------------------ */
+#define LSM303D_CTRL0_BOOT      0x80    // CTRL0: reboot memory content
+#define LSM303D_CTRL0_FIFO_EN   0x40    // CTRL0: FIFO enable
+#define LSM303D_CTRL0_FTH_EN    0x20    // CTRL0: FIFO programmable threshold enable
+#define LSM303D_AODR_SHIFT      4       // CTRL1: AODR[3:0] acceleration data rate
+#define LSM303D_AXES_EN         0x07    // CTRL1: AZEN AYEN AXEN
+#define LSM303D_ABW_SHIFT       6       // CTRL2: ABW[1:0] anti-alias filter bandwidth
+#define LSM303D_AFS_SHIFT       3       // CTRL2: AFS[2:0] acceleration full scale
+#define LSM303D_TEMP_EN         0x80    // CTRL5: temperature sensor enable
+#define LSM303D_MRES_SHIFT      5       // CTRL5: M_RES[1:0] magnetic resolution
+#define LSM303D_MODR_SHIFT      2       // CTRL5: M_ODR[2:0] magnetic data rate
+#define LSM303D_MFS_SHIFT       5       // CTRL6: MFS[1:0] magnetic full scale
+#define LSM303D_MD_MASK         0x03    // CTRL7: MD[1:0] magnetic sensor mode
+#define LSM303D_MD_CONT         0x00    // CTRL7: continuous-conversion mode
+#define LSM303D_MD_SINGLE       0x01    // CTRL7: single-conversion mode
+#define LSM303D_MD_POWERDOWN    0x02    // CTRL7: magnetic sensor power-down
+#define LSM303D_P1_DRDYA        0x04    // CTRL3: accel data-ready on INT1
+#define LSM303D_P1_DRDYM        0x02    // CTRL3: magnetic data-ready on INT1
+#define LSM303D_P2_DRDYA        0x08    // CTRL4: accel data-ready on INT2
+#define LSM303D_P2_DRDYM        0x04    // CTRL4: magnetic data-ready on INT2
+#define LSM303D_P2_OVERRUN      0x02    // CTRL4: FIFO overrun on INT2
+#define LSM303D_P2_FTH          0x01    // CTRL4: FIFO watermark on INT2
+#define LSM303D_FM_SHIFT        5       // FIFO_CTRL: FM[2:0] FIFO mode
+#define LSM303D_FM_BYPASS       0x00    // FIFO_CTRL: bypass mode
+#define LSM303D_FM_FIFO         0x01    // FIFO_CTRL: FIFO mode, stops when full
+#define LSM303D_FM_STREAM       0x02    // FIFO_CTRL: stream mode, overwrites oldest
+#define LSM303D_FTH_MASK        0x1F    // FIFO_CTRL: FTH[4:0] watermark level
+#define LSM303D_FIFO_FTH        0x80    // FIFO_SRC: fill level reached watermark
+#define LSM303D_FIFO_OVRN       0x40    // FIFO_SRC: FIFO completely filled (32)
+#define LSM303D_FIFO_EMPTY      0x20    // FIFO_SRC: FIFO empty
+#define LSM303D_FSS_MASK        0x1F    // FIFO_SRC: FSS[4:0] stored sample count
+#define LSM303D_FIFO_DEPTH      32      // hardware FIFO holds 32 XYZ samples
+
+/* ------------------------------------------------------------ *
+ * Magnetic sensitivity in milli Gauss per LSB for MFS=01 (+/-4 *
+ * gauss), the full scale setting written by lsm303d_init().    *
+ * Conversions use lsm303d_cal, which follows the actual range. *
+ * ------------------------------------------------------------ */
+#define LSM303D_MAG_SCALE_4G    0.160
+
+/* ------------------------------------------------------------ *
+ * Acceleration sensitivity in milli g per LSB for AFS=000 (+/-2*
+ * g), the CTRL2 power-on default used by the FIFO stream mode. *
+ * ------------------------------------------------------------ */
+#define LSM303D_ACC_SCALE_2G    0.061
+#define LSM303D_FIFO_AODR       6       // FIFO stream default AODR=0110 100 Hz
+#define LSM303D_TEMP_LSB        8.0f    // temperature sensitivity LSB per deg C
 
 /* ------------------------------------------------------------ *
  * Define byte-as-bits printing for debug output                *
@@ -71,10 +153,68 @@
 /* ------------------------------------------------------------ *
  * global variables                                             *
  * ------------------------------------------------------------ */
-int i2cfd;             // I2C file descriptor
-int verbose;           // debug flag, 0 = normal, 1 = debug mode
-float offset[3];       // sensor axis offset values
-float declination;     // local declination value
+extern int verbose;       // debug flag, 0 = normal, 1 = debug mode
+extern int lsm303d_cache_mode;      // cache 0 = off, 1 = on, 2 = invalidate
+
+/* ------------------------------------------------------------ *
+ * Register transport interface. All sensor I/O goes through    *
+ * read_regs/write_regs of the active transport, a Linux i2c-dev*
+ * bus (i2c_lsm303d.c) or the simulated sensor (sim_lsm303d.c). *
+ * Both functions return 0 on success, -1 on error. reset()     *
+ * clears a hung bus for the fault recovery, 0 on success.      *
+ * ------------------------------------------------------------ */
+struct lsm303d_transport{
+   const char *name;   // backend name, "i2c-dev" or "sim"
+   int  (*read_regs)(void *priv, uint8_t reg, uint8_t *buf, uint16_t len);
+   int  (*write_regs)(void *priv, uint8_t reg, const uint8_t *buf, uint16_t len);
+   int  (*reset)(void *priv);
+   void (*close)(void *priv);
+   void *priv;         // backend private state
+};
+
+/* ------------------------------------------------------------ *
+ * Interrupt line interface. fd becomes readable (POLLIN) when  *
+ * the sensor INT1/INT2 pin fired, ack() consumes the event.    *
+ * Backends are a gpiochip line event (irq_lsm303d.c) and an    *
+ * eventfd stand-in line driven by the simulated sensor.        *
+ * ------------------------------------------------------------ */
+struct lsm303d_irqline{
+   const char *name;   // backend name, "gpio" or "sim"
+   int fd;             // pollable file descriptor
+   int  (*ack)(void *priv);
+   void (*close)(void *priv);
+   void *priv;         // backend private state
+};
+
+/* ------------------------------------------------------------ *
+ * Simulated LSM303D settings. The simulated board sits in a    *
+ * field of mag_field milli Gauss at inclination mag_incl, at a *
+ * given attitude, and optionally turns at rotate deg/sec.      *
+ * speed scales sensor time against CLOCK_MONOTONIC; speed = 0  *
+ * runs in virtual time: every status poll that finds no new    *
+ * data advances the sensor clock to the next sample, so the    *
+ * acquisition path runs as fast as the CPU allows. Injected    *
+ * faults: a transaction starts a NACK burst of nack_len failed *
+ * transactions with probability nack_rate, and every brownout  *
+ * seconds of sensor time the sensor reboots to its power-on    *
+ * register defaults, NACKing the next nack_len transactions.   *
+ * ------------------------------------------------------------ */
+struct lsm303d_simcfg{
+   double speed;       // sensor time scale, 0 = virtual time
+   float mag_field;    // total field strength in milli Gauss
+   float mag_incl;     // field inclination in degrees (down = +)
+   float heading;      // initial heading in degrees
+   float rotate;       // heading change in degrees per second
+   float pitch;        // board pitch in degrees
+   float roll;         // board roll in degrees
+   float mag_noise;    // magnetic noise (1 sigma) in milli Gauss
+   float acc_noise;    // acceleration noise (1 sigma) in milli g
+   float temp;         // die temperature in degrees Celsius
+   uint32_t seed;      // noise generator seed
+   float nack_rate;    // probability a transaction starts a NACK burst
+   int nack_len;       // failed transactions per burst, 0 = 1
+   double brownout;    // brown-out interval in seconds, 0 = never
+};
 
 /* ------------------------------------------------------------ *
  * LSM303D status and control data structure                      *
@@ -94,18 +234,668 @@ struct lsm303ddata{
    float Z;        // Z component
 };
 
+/* ------------------------------------------------------------ *
+ * LSM303D joint magnetic, acceleration and temperature sample  *
+ * ------------------------------------------------------------ */
+struct lsm303dsample{
+   uint64_t ts;             // CLOCK_MONOTONIC read time in ns
+   struct lsm303ddata mag;  // magnetic field in milli Gauss
+   struct lsm303ddata acc;  // acceleration in milli g
+   float temp;              // temperature in degrees Celsius
+};
+
+/* ------------------------------------------------------------ *
+ * LSM303D raw timestamped 9-axis sample, as read from sensor   *
+ * ------------------------------------------------------------ */
+struct lsm303draw{
+   uint64_t ts;        // CLOCK_MONOTONIC read time in ns
+   int16_t mag[3];     // raw magnetic X, Y, Z
+   int16_t acc[3];     // raw acceleration X, Y, Z
+   int16_t temp;       // raw temperature, 12 bit sign extended
+   uint8_t status_m;   // STATUS_M byte read with the data
+   uint8_t status_a;   // STATUS_A byte read with the data, no ZYXADA = acc stale
+};
+
+/* ------------------------------------------------------------ *
+ * Active range and calibration for the raw to unit conversion. *
+ * value = raw * sens - off per axis; sens is the range         *
+ * sensitivity, optionally corrected per axis (soft-iron gain). *
+ * ------------------------------------------------------------ */
+struct lsm303d_calib{
+   int mfs;            // CTRL6 MFS[1:0] magnetic full scale code
+   int afs;            // CTRL2 AFS[2:0] acceleration full scale code
+   float mag_sens[3];  // milli Gauss per LSB, X Y Z
+   float mag_off[3];   // hard-iron offset in milli Gauss
+   float acc_sens[3];  // milli g per LSB, X Y Z
+   float acc_off[3];   // zero-g offset in milli g
+   float mag_si[3][3]; // soft-iron matrix, applied after the offset
+};
+
+/* ------------------------------------------------------------ *
+ * Binary sample log: a 256 byte header, then fixed-size 24     *
+ * byte struct lsm303draw records. The file is memory-mapped and     *
+ * grows in LSM303D_LOG_CHUNK steps; with a size limit, records *
+ * wrap around and the oldest ones are overwritten. Record i of *
+ * count sits in slot i % cap. count is updated last, so a      *
+ * reader never sees a half-written record.                     *
+ * ------------------------------------------------------------ */
+#define LSM303D_LOG_MAGIC     0x4C33534C  // "LS3L"
+#define LSM303D_LOG_VERSION   1
+#define LSM303D_LOG_CHUNK     (16 << 20)  // file growth step, 16 MB
+#define LSM303D_LOG_WRAP      0x01        // flags: ring-wrap at cap records
+#define LSM303D_LOG_DELTA     0x02        // flags: delta compressed blocks follow
+#define LSM303D_LOG_ACC       0x04        // flags: accel capture, int16 X Y Z records
+
+struct lsm303d_loghdr{
+   uint32_t magic;
+   uint16_t version;
+   uint16_t hdrsize;   // records start at this offset
+   uint16_t recsize;   // sizeof(struct lsm303draw)
+   uint16_t flags;     // LSM303D_LOG_WRAP
+   uint8_t mfs;        // CTRL6 MFS[1:0] magnetic full scale code
+   uint8_t afs;        // CTRL2 AFS[2:0] acceleration full scale code
+   uint8_t modr;       // CTRL5 M_ODR[2:0] magnetic data rate code
+   uint8_t aodr;       // CTRL1 AODR[3:0] acceleration data rate code
+   uint64_t period;    // sample period in ns, 0 = single reads
+   int64_t rt_offset;  // CLOCK_REALTIME - CLOCK_MONOTONIC in ns at start
+   uint64_t cap;       // record slots before wrap, 0 = no limit
+   uint64_t count;     // records written since start
+   float declination;  // local declination in degrees
+   float mag_sens[3];  // calibration at start, see struct lsm303d_calib
+   float mag_off[3];
+   float acc_sens[3];
+   float acc_off[3];
+   float mag_si[3][3];
+   uint64_t t0;        // accel capture: CLOCK_MONOTONIC time of record 0
+   uint8_t reserved[112];
+};
+
+struct lsm303d_log{
+   int fd;
+   int rdonly;         // opened by log_open() for reading
+   uint8_t *map;       // file mapping, header and records
+   size_t mapsize;     // mapped and allocated file size
+   uint64_t slots;     // record slots in the mapping
+   struct lsm303d_loghdr *hdr;
+   struct lsm303draw *rec;
+};
+
+/* ------------------------------------------------------------ *
+ * Delta compressed sample archive: the log header, then blocks *
+ * of up to LSM303D_ZBLOCK bytes. A block starts with a full    *
+ * keyframe sample, the others are stored as zigzag varint      *
+ * deltas to the previous one: the time step in us minus the    *
+ * period, then the 6 axis deltas, and a temperature delta and  *
+ * the status bytes only if they changed (bit 0 of the time    *
+ * step). A block index and trailer close the file; without     *
+ * them, e.g. after a crash, the reader scans the block chain.  *
+ * ------------------------------------------------------------ */
+#define LSM303D_ZBLOCK        4096        // bytes per block, header included
+#define LSM303D_ZBLOCK_MAGIC  0x4233534C  // "LS3B"
+#define LSM303D_ZINDEX_MAGIC  0x4933534C  // "LS3I"
+#define LSM303D_ZSAMPLE_MAX   33          // worst case bytes of one delta sample
+
+struct lsm303d_zblock{
+   uint32_t magic;
+   uint16_t size;      // payload bytes after this header
+   uint16_t n;         // samples, keyframe included
+   uint64_t ts0;       // keyframe CLOCK_MONOTONIC time in ns
+   int16_t key[7];     // keyframe mag X Y Z, acc X Y Z, temp
+   uint8_t status_m;   // keyframe STATUS_M
+   uint8_t status_a;   // keyframe STATUS_A
+};
+
+struct lsm303d_zindex{
+   uint64_t offset;    // file offset of the block
+   uint64_t first;     // sample number of the keyframe
+   uint64_t ts0;       // keyframe time
+};
+
+struct lsm303d_ztrailer{
+   uint32_t magic;
+   uint32_t blocks;    // index entries
+   uint64_t index;     // file offset of the index
+};
+
+struct lsm303d_zlog{
+   int fd;
+   int rdonly;
+   struct lsm303d_loghdr hdr;
+   struct lsm303d_zindex *index;
+   uint32_t blocks;    // blocks written or found
+   uint32_t maxblocks; // index entries allocated
+   uint64_t offset;    // writer: file offset of the next block
+   uint32_t used;      // writer: payload bytes in buf
+   uint8_t buf[LSM303D_ZBLOCK];
+   struct lsm303draw prev; // last sample encoded or decoded
+   int64_t prev_us;    // its time in us
+   const uint8_t *map; // reader: file mapping
+   size_t mapsize;
+   uint32_t cur;       // reader: current block
+   uint32_t pos;       // reader: next payload byte in the block
+   uint32_t left;      // reader: samples left in the block
+};
+
+/* ------------------------------------------------------------ *
+ * High-rate accelerometer capture: FIFO watermark batches are  *
+ * drained straight into preallocated slots, either a memory    *
+ * buffer or a file mapping behind a log header with the flag   *
+ * LSM303D_LOG_ACC. Records are int16 X Y Z at the AODR period, *
+ * record i was sampled at t0 + i * period.                     *
+ * ------------------------------------------------------------ */
+#define LSM303D_CAPTURE_WTM   24          // default watermark, 8 levels of headroom
+
+struct lsm303d_capture{
+   int fd;             // capture file, -1 = memory buffer
+   int rdonly;         // opened by capture_open() for reading
+   uint8_t *map;       // header and records
+   size_t mapsize;
+   struct lsm303d_loghdr *hdr;
+   int16_t (*acc)[3];  // record slots
+   uint64_t slots;     // preallocated records
+   uint64_t batches;   // FIFO drains with data
+   uint64_t overruns;  // drains that found the FIFO full
+   uint64_t t_last;    // time of the last drain
+   int max_level;      // highest FIFO level at a drain
+};
+
+/* ------------------------------------------------------------ *
+ * Replay source: the recorded samples of a sample log, a delta *
+ * archive, an accel capture or a loglsm303d -r CSV export, in  *
+ * their original order. hdr holds the ranges, calibration and  *
+ * time base of the recording; a CSV has none, it gets the      *
+ * calibration of the device and realtime timestamps.           *
+ * ------------------------------------------------------------ */
+enum lsm303d_replay_kind { REPLAY_LOG, REPLAY_ZLOG, REPLAY_ACC, REPLAY_CSV };
+
+struct lsm303d_replay{
+   enum lsm303d_replay_kind kind;
+   struct lsm303d_loghdr hdr;  // header of the recording
+   struct lsm303d_log log;
+   struct lsm303d_zlog zlog;
+   struct lsm303d_capture cap;
+   FILE *csv;
+   uint64_t n;         // samples returned
+   uint64_t line;      // CSV line number, for errors
+};
+
+/* ------------------------------------------------------------ *
+ * Register shadow of the writable configuration registers.     *
+ * known: the shadow value equals the sensor, or is about to    *
+ * after a commit; dirty: changed but not yet written. Bit n of *
+ * the masks is register n. The read-only registers between     *
+ * them are never written, so a burst cannot cross them.        *
+ * ------------------------------------------------------------ */
+#define LSM303D_SHADOW_MASK ((1ULL << 0x12) | (3ULL << 0x14) | (0xFFULL << 0x1F) \
+                           | (1ULL << 0x2E) | (1ULL << 0x30) | (7ULL << 0x32)    \
+                           | (7ULL << 0x36) | (0x3FULL << 0x3A))
+
+struct lsm303d_shadow{
+   uint8_t reg[LSM303D_REGMAP_SIZE]; // register values, by address
+   uint64_t known;     // registers with a valid shadow value
+   uint64_t dirty;     // registers waiting for shadow_commit()
+   int verify;         // 1 = read back and compare after each commit
+};
+
+/* ------------------------------------------------------------ *
+ * Persistent cache file, one record per bus and address. The   *
+ * file is reset if magic, version or record size do not match. *
+ * ------------------------------------------------------------ */
+#define LSM303D_CACHE_FILE    "/var/tmp/lsm303d.cache"
+#define LSM303D_CACHE_MAGIC   0x4433534C  // "LS3D"
+#define LSM303D_CACHE_VERSION 1
+#define LSM303D_CACHE_SLOTS   8           // sensors, least recently used is reused
+#define LSM303D_CACHE_CTRL    0x01        // ctrl[] holds the last CTRL0..CTRL7 written
+#define LSM303D_CACHE_CAL     0x02        // calibration is valid
+#define LSM303D_CACHE_DECL    0x04        // declination is valid
+
+struct lsm303d_cacherec{
+   char bus[64];          // key: bus device name
+   int32_t addr;          // key: sensor I2C address
+   uint32_t flags;        // LSM303D_CACHE_* valid content
+   uint8_t ctrl[8];       // last CTRL0..CTRL7 values written
+   uint8_t ctrl_known;    // bit mask of the ctrl[] bytes written so far
+   float mag_off[3];      // hard-iron offset in milli Gauss
+   float mag_si[3][3];    // soft-iron matrix
+   float acc_off[3];      // zero-g offset in milli g
+   float declination;     // local declination in degrees
+   int64_t used;          // last use, unix time
+   uint32_t crc;          // FNV-1a of the record up to here
+};
+
+struct lsm303d_cachefile{
+   uint32_t magic;        // LSM303D_CACHE_MAGIC
+   uint32_t version;      // LSM303D_CACHE_VERSION
+   uint32_t recsize;      // sizeof(struct lsm303d_cacherec)
+   uint32_t reserved;
+   struct lsm303d_cacherec rec[LSM303D_CACHE_SLOTS];
+};
+
+/* ------------------------------------------------------------ *
+ * Bus fault recovery. A failed transaction is retried after an *
+ * exponential backoff, the last retry after a transport reset. *
+ * A sensor that stops delivering data for stall data periods   *
+ * is checked: a WHO_AM_I or CTRL mismatch against the shadow   *
+ * is a brown-out, the shadowed configuration is written again. *
+ * Errors come back as the LSM303D_E codes, the counters and    *
+ * recovery times collect in the lsm303d_faults of the device.  *
+ * ------------------------------------------------------------ */
+#define LSM303D_EIO     -1  // bus transaction failed after all retries
+#define LSM303D_ENODEV  -2  // wrong or no WHO_AM_I answer
+#define LSM303D_ESTALL  -3  // no data-ready, configuration intact
+
+struct lsm303d_recovery{
+   int retries;             // retries per failed transaction, 0 = fail fast
+   uint64_t backoff;        // first retry delay in ns, doubles per retry
+   uint64_t backoff_max;    // retry delay limit in ns
+   int reset;               // 1 = reset the transport before the last retry
+   int stall;               // data periods without data-ready before a check
+   int maxfail;             // failed -c reads in a row before giving up
+};
+
+struct lsm303d_faults{
+   uint64_t errors;         // failed bus transactions
+   uint64_t retries;        // retried transactions
+   uint64_t resets;         // transport resets
+   uint64_t recovered;      // errors cleared by a retry
+   uint64_t failures;       // errors returned to the caller
+   uint64_t stalls;         // data-ready timeouts
+   uint64_t reinits;        // brown-outs, configuration written again
+   uint64_t lat_sum;        // recovery time of recovered and reinits in ns
+   uint64_t lat_max;        // longest recovery in ns
+   int last_err;            // last LSM303D_E code
+};
+
+/* ------------------------------------------------------------ *
+ * Per-device context: everything the driver keeps about one    *
+ * sensor. The driver functions work on the device selected by  *
+ * lsm303d_select() for the calling thread, lsm303d_dev0 if the *
+ * thread never selected one. A thread per bus can so drive its *
+ * sensors while other threads drive theirs.                    *
+ * ------------------------------------------------------------ */
+#define LSM303D_MAX_DEVS 8         // sensors per getlsm303d run
+
+struct lsm303d_dev{
+   char busname[256];       // bus device name, or "sim[:speed]"
+   int addr;                // I2C address, 0x1d or 0x1e
+   struct lsm303d_transport *bus;  // sensor transport
+   struct lsm303d_irqline *irq;    // interrupt line, or NULL
+   int irqpin;              // sensor pin wired to it, 1 or 2
+   struct lsm303d_calib cal;       // active range and calibration
+   struct lsm303d_shadow shadow;   // configuration register shadow
+   struct lsm303d_cacherec *cache; // cache record, or NULL
+   float offset[3];         // sensor axis offset values
+   float declination;       // local declination value
+   struct lsm303d_recovery recovery; // bus fault recovery policy
+   struct lsm303d_faults faults;     // fault counters
+   int acc_ready;           // 1 once the accel delivered data after init
+};
+
+extern struct lsm303d_dev lsm303d_dev0;        // default device
+extern __thread struct lsm303d_dev *lsm303d;   // device of the calling thread
+
+/* ------------------------------------------------------------ *
+ * Streaming magnetometer calibration. Samples are folded into  *
+ * the ellipsoid fit normal equations AtA, Atb (upper triangle) *
+ * and 24 direction bins track the coverage of the sphere.      *
+ * ------------------------------------------------------------ */
+#define LSM303D_CAL_MINSAMPLES 50  // samples before the first fit
+#define LSM303D_CAL_BINS 24        // 8 sectors x 3 bands
+#define LSM303D_CAL_MINFIELD 100.0f // milli Gauss, below any Earth field
+
+struct lsm303d_magcal{
+   double ata[9][9];   // sum phi phi', phi = x2 y2 z2 2xy 2xz 2yz 2x 2y 2z
+   double atb[9];      // sum phi
+   double n;           // samples folded in
+   float mn[3];        // per-axis minimum, rough center before a fit
+   float mx[3];        // per-axis maximum
+   uint32_t bins;      // direction bins hit
+   float coverage;     // fraction of the direction bins hit
+   int valid;          // fit level: 2 = ellipsoid, 1 = sphere, 0 = none
+   float off[3];       // hard-iron offset in milli Gauss
+   float soft[3][3];   // soft-iron matrix, |soft (m - off)| = radius
+   float radius;       // fitted field strength in milli Gauss
+   float fit_err;      // RMS radial residual relative to radius
+};
+
+/* ------------------------------------------------------------ *
+ * Raw sample buffer in SoA layout: 7 int16 channels (mag X Y Z *
+ * acc X Y Z, temperature) of stride samples in one allocation, *
+ * 14 bytes per sample versus 40 for struct lsm303dsample. The  *
+ * samples are evenly spaced, so only the first time is kept.   *
+ * ------------------------------------------------------------ */
+#define LSM303D_SOA_CH 7
+
+struct lsm303d_soa{
+   uint64_t t0;        // CLOCK_MONOTONIC time of sample 0 in ns
+   int n;              // samples stored
+   int cap;            // sample capacity
+   int stride;         // channel array length, cap rounded up to 32
+   int16_t *mag[3];    // raw magnetic X, Y, Z arrays
+   int16_t *acc[3];    // raw acceleration X, Y, Z arrays
+   int16_t *temp;      // raw temperature array
+   int16_t *data;      // the allocation holding all channels
+};
+
+/* ------------------------------------------------------------ *
+ * Lock-free single-producer/single-consumer ring of raw        *
+ * samples, between the acquisition and the consumer thread.    *
+ * Producer and consumer indices sit on separate cache lines,   *
+ * each side keeps a private copy of the other side's index so *
+ * the shared line is only re-read when the cached value runs   *
+ * out. A full ring drops the new sample and counts an overflow *
+ * so acquisition never blocks on a slow sink.                  *
+ * ------------------------------------------------------------ */
+#define LSM303D_CACHELINE 64
+#define LSM303D_RING_SIZE 1024  // default ring slots, power of 2
+
+struct lsm303d_ring{
+   _Alignas(LSM303D_CACHELINE) uint64_t head; // next slot to write (producer)
+   uint64_t tail_cache;     // producer copy of tail
+   uint64_t overflows;      // samples dropped on a full ring
+   uint64_t hiwater;        // highest occupancy seen (producer)
+   _Alignas(LSM303D_CACHELINE) uint64_t tail; // next slot to read (consumer)
+   uint64_t head_cache;     // consumer copy of head
+   _Alignas(LSM303D_CACHELINE) uint32_t size; // slots, power of 2
+   uint32_t mask;           // size - 1
+   struct lsm303draw *slots;
+};
+
+/* ------------------------------------------------------------ *
+ * Fixed-rate sampling schedule on CLOCK_MONOTONIC, times in ns *
+ * ------------------------------------------------------------ */
+struct lsm303d_sched{
+   uint64_t period;    // sample period
+   uint64_t next;      // next absolute deadline
+   uint64_t ticks;     // deadlines met
+   uint64_t overruns;  // waits that started after a deadline passed
+   uint64_t missed;    // deadlines skipped by overruns
+   uint64_t max_lag;   // worst wakeup latency after a deadline
+};
+
+/* ------------------------------------------------------------ *
+ * Filter chain on raw samples, before the conversion. Stages   *
+ * run in order on the 7 channels mag X/Y/Z, acc X/Y/Z and temp *
+ * in integer arithmetic, with fixed windows, so a chain needs  *
+ * constant memory: avg n moving average, med n running median  *
+ * (n odd), iir k low-pass y += (x - y) / 2^k with 8 fraction   *
+ * bits of state, and dec n which passes every n-th sample.     *
+ * ------------------------------------------------------------ */
+#define LSM303D_FILT_CH     7    // filtered channels per sample
+#define LSM303D_FILT_STAGES 8    // stages per chain
+#define LSM303D_FILT_WIN    32   // longest avg/med window
+
+enum lsm303d_filt_type { FILT_AVG = 1, FILT_MED, FILT_IIR, FILT_DEC };
+
+struct lsm303d_stage{
+   enum lsm303d_filt_type type;
+   int n;              // window, shift k, or decimation factor
+   int fill;           // samples in the window, dec: since the last output
+   int pos;            // next window slot, the oldest once it is full
+   int32_t acc[LSM303D_FILT_CH];  // avg: window sum, iir: state << 8
+   uint8_t status_m;   // dec: STATUS_M bits of the dropped samples
+   uint8_t status_a;   // dec: STATUS_A bits of the dropped samples
+   int16_t win[LSM303D_FILT_CH][LSM303D_FILT_WIN];    // window in arrival order
+   int16_t sorted[LSM303D_FILT_CH][LSM303D_FILT_WIN]; // med: window sorted
+};
+
+struct lsm303d_filter{
+   int nstages;
+   int dec;            // total decimation of the chain
+   struct lsm303d_stage stage[LSM303D_FILT_STAGES];
+};
+
+/* ------------------------------------------------------------ *
+ * Hot path statistics. Each thread counts into its own slot,   *
+ * one writer per slot, so updates need no lock and no atomic   *
+ * read-modify-write. Slots are cache line aligned, neighbours  *
+ * do not share lines. Threads beyond the slots share the last  *
+ * one with atomic adds. A snapshot sums the slots. Histograms  *
+ * are log2 bucketed: bucket b holds latencies of 2^(b-1) up to *
+ * 2^b - 1 ns, bucket 0 holds 0 ns.                             *
+ * ------------------------------------------------------------ */
+#define LSM303D_STATS_THREADS 32   // slots, further threads share the last one atomically
+#define LSM303D_HIST_BUCKETS  40   // up to 2^39 ns, about 9 minutes
+
+struct lsm303d_hist{
+   uint64_t count;     // recorded latencies
+   uint64_t sum;       // their total in ns
+   uint64_t max;       // the longest in ns
+   uint64_t bucket[LSM303D_HIST_BUCKETS];
+};
+
+struct lsm303d_stats{
+   _Alignas(LSM303D_CACHELINE) uint64_t transactions; // bus transactions, retries included
+   uint64_t bytes_rd;     // register bytes read
+   uint64_t bytes_wr;     // register bytes written
+   uint64_t errors;       // failed transactions
+   uint64_t retries;      // fault recovery retries
+   uint64_t ovr_m;        // samples with STATUS_M ZYXMOR set
+   uint64_t ovr_a;        // samples with STATUS_A ZYXAOR set
+   uint64_t missed;       // deadlines skipped by the schedule
+   uint64_t samples;      // samples delivered to the output
+   struct lsm303d_hist bus;  // bus transfer latency
+   struct lsm303d_hist e2e;  // sample read to output latency
+};
+
+/* ------------------------------------------------------------ *
+ * Shared memory segment of the -D daemon: the latest sample    *
+ * and heading, and a ring of the recent ones. One seqlock      *
+ * covers both: the writer makes seq odd, updates, and makes it *
+ * even again; readers retry if seq was odd or changed while    *
+ * they copied. Readers never block the daemon.                 *
+ * ------------------------------------------------------------ */
+#define LSM303D_SHM_NAME      "/lsm303d"
+#define LSM303D_SHM_MAGIC     0x4D33534C  // "LS3M"
+#define LSM303D_SHM_VERSION   2
+#define LSM303D_SHM_HIST      1024        // history samples, power of 2
+
+struct lsm303d_shmsample{
+   uint64_t n;              // sample number since daemon start
+   struct lsm303dsample smp;
+   float heading;           // tilt-compensated, declination added
+};
+
+struct lsm303d_shm{
+   uint32_t magic;
+   uint32_t version;
+   uint32_t size;           // sizeof(struct lsm303d_shm)
+   uint32_t hist;           // history slots, LSM303D_SHM_HIST
+   int32_t pid;             // daemon process
+   char bus[256];           // sensor bus of the daemon, -b
+   int32_t addr;            // sensor i2c address of the daemon
+   float declination;       // applied to the headings
+   uint64_t period;         // sample period in ns
+   _Alignas(LSM303D_CACHELINE) uint32_t seq; // seqlock, odd while writing
+   uint64_t count;          // samples published
+   struct lsm303d_shmsample latest;
+   _Alignas(LSM303D_CACHELINE) struct lsm303d_shmsample ring[LSM303D_SHM_HIST];
+};
+
+/* ------------------------------------------------------------ *
+ * Unix domain socket server of the -S option. A client sends   *
+ * "SUB <Hz> [bin|text] [skip|drop]\n" and receives the samples *
+ * decimated to that rate, as struct lsm303d_shmsample records  *
+ * or CSV lines. Each client has an output queue; a client that *
+ * does not keep up skips samples until its queue drained, or   *
+ * is disconnected with "drop". The event loop never blocks.    *
+ * ------------------------------------------------------------ */
+#define LSM303D_SRV_PATH      "/tmp/lsm303d.sock"
+#define LSM303D_SRV_CLIENTS   32          // concurrent subscribers
+#define LSM303D_SRV_QUEUE     16384       // output queue bytes per client, power of 2
+#define LSM303D_SRV_BIN       0           // struct lsm303d_shmsample records
+#define LSM303D_SRV_TEXT      1           // CSV lines, like loglsm303d
+#define LSM303D_SRV_SKIP      0           // slow client: skip samples
+#define LSM303D_SRV_DROP      1           // slow client: disconnect
+
+struct lsm303d_client{
+   int fd;
+   int format;              // LSM303D_SRV_BIN or LSM303D_SRV_TEXT
+   int policy;              // LSM303D_SRV_SKIP or LSM303D_SRV_DROP
+   int skipping;            // queue was full, skip until it drained
+   int pollout;             // waiting for EPOLLOUT
+   uint64_t interval;       // ns between delivered samples, 0 = not subscribed
+   uint64_t next;           // timestamp the next delivered sample is due
+   uint64_t sent;           // samples queued
+   uint64_t skipped;        // samples skipped by the slow client policy
+   uint32_t head, tail;     // free-running queue positions
+   int cmdlen;
+   char cmd[64];            // partial command line
+   uint8_t queue[LSM303D_SRV_QUEUE];
+};
+
+struct lsm303d_srv{
+   int lfd;                 // listening socket
+   int epfd;
+   char path[108];
+   uint64_t period;         // sample period in ns
+   int64_t rt_offset;       // CLOCK_REALTIME - CLOCK_MONOTONIC for text times
+   int nclients;
+   struct lsm303d_client *client[LSM303D_SRV_CLIENTS];
+   uint64_t accepted;       // connections accepted
+   uint64_t dropped;        // clients disconnected by the drop policy
+   uint64_t writes;         // writev() calls
+};
+
 /* ------------------------------------------------------------ *
  * external function prototypes for I2C bus communication       *
  * ------------------------------------------------------------ */
-extern  void get_i2cbus(char*, char*);         // get the I2C bus file handle
-extern  void lsm303d_set();                    // charge CAP and execute SET
-extern  void lsm303d_reset();                  // charge CAP and execute RESET
+extern struct lsm303d_dev *lsm303d_open(const char*, int); // library: open bus, addr, NULL on error
+extern   int lsm303d_configure(struct lsm303d_dev*, int, int, int); // library: M_ODR, MFS, AFS, -1 = keep
+extern  void lsm303d_set_declination(struct lsm303d_dev*, float);  // library: heading declination
+extern  void lsm303d_set_verify(struct lsm303d_dev*, int);  // library: read back commits, 0 = off
+extern   int lsm303d_read_raw_batch(struct lsm303d_dev*, struct lsm303draw*, int); // library: n raw samples
+extern   int lsm303d_read_batch(struct lsm303d_dev*, struct lsm303dsample*, int); // library: n samples
+extern   int lsm303d_heading_batch(struct lsm303d_dev*, const struct lsm303dsample*, float*, int);
+extern   int lsm303d_close(struct lsm303d_dev*);   // library: power down, close, free the handle
+extern  void lsm303d_set_recovery(struct lsm303d_dev*, const struct lsm303d_recovery*); // library
+extern  void lsm303d_get_faults(struct lsm303d_dev*, struct lsm303d_faults*); // library: counters
+extern  void lsm303d_dev_init(struct lsm303d_dev*); // clear a context to the defaults
+extern  void lsm303d_select(struct lsm303d_dev*);   // driver calls of this thread use dev
+extern  void get_i2cbus(char*, char*);         // open the sensor transport, exit on error
+extern   int lsm303d_bus_open(const char*, int);       // open the sensor transport (bus, addr)
+extern struct lsm303d_transport *i2cdev_open(const char*, int); // Linux i2c-dev backend
+extern  void sim_defaults(struct lsm303d_simcfg*);               // simulator default settings
+extern struct lsm303d_transport *sim_open(const struct lsm303d_simcfg*); // simulated LSM303D
+extern  void get_irqline(char*);                // open the interrupt line, exit on error
+extern   int lsm303d_irq_open(const char*);    // open the interrupt line "chip:line[:pin]"
+extern struct lsm303d_irqline *gpio_irq_open(const char*, int);  // gpiochip line event
+extern struct lsm303d_irqline *sim_irq_open(struct lsm303d_transport*, int); // sim stand-in
+extern   int lsm303d_irq_route(uint8_t);       // route events to the INT pin (CTRL3/CTRL4 bits)
+extern   int lsm303d_irq_wait(int);            // block until the INT pin fires (timeout ms)
+extern   int lsm303d_read_regs(uint8_t, uint8_t*, uint16_t);        // burst register read
+extern   int lsm303d_write_regs(uint8_t, const uint8_t*, uint16_t); // burst register write
+extern   int fault_retry(uint8_t, uint8_t*, const uint8_t*, uint16_t); // retry a failed transaction
+extern   int fault_stall(uint64_t);            // data-ready timeout since t0: check the sensor
+extern uint64_t fault_stall_ns();              // data-ready timeout of the current M_ODR
+extern   int lsm303d_check();                  // WHO_AM_I and CTRL check, reapply after brown-out
+extern const char *lsm303d_strerror(int);      // text of an LSM303D_E code
 extern   int lsm303d_swreset();                // SW reset clears registers
-extern  void lsm303d_init();                   // initialize the sensor
+extern   int lsm303d_init();                   // initialize the sensor
+extern   int lsm303d_powerdown();              // power down accel and magnetic sensor
 extern   int lsm303d_dump();                   // dump the register map data
 extern  void lsm303d_info(struct lsm303dinf*); // print sensor information
 extern  char get_prdid();                      // get the sensor product id
-extern   int set_cmfreq(int);                  // set continuous read frequency
+extern   int set_cmfreq(int);                  // set the magnetic data rate M_ODR 0..5
 extern   int lsm303d_read();                   // read sensor data
+extern   int lsm303d_read_raw(struct lsm303draw*); // read one raw 9-axis sample, 2 transactions
+extern  void lsm303d_convert(const struct lsm303draw*, struct lsm303dsample*); // raw to units
+extern   int lsm303d_calib_set(struct lsm303d_calib*, int, int); // set range codes mfs, afs
+extern   int lsm303d_get_scale();              // read back the range, update lsm303d_cal
+extern   int soa_init(struct lsm303d_soa*, int);  // allocate SoA buffer for n samples
+extern  void soa_free(struct lsm303d_soa*);       // release the SoA buffer
+extern   int soa_push(struct lsm303d_soa*, const struct lsm303draw*); // append a raw sample
+extern  void convert_f32(const int16_t*, float*, int, float, float);    // one channel to float
+extern  void convert_q15(const int16_t*, int16_t*, int, int32_t, int16_t); // one channel to Q15
+extern  void soa_convert_f32(const struct lsm303d_soa*, const struct lsm303d_calib*, float*);
+extern  void soa_convert_q15(const struct lsm303d_soa*, const struct lsm303d_calib*, int16_t*);
+extern  void magcal_init(struct lsm303d_magcal*);               // clear calibration sums
+extern   int magcal_add(struct lsm303d_magcal*, const float*);    // fold in a sample, O(1)
+extern   int magcal_solve(struct lsm303d_magcal*);              // refine the fit from the sums
+extern  void magcal_apply(const struct lsm303d_magcal*, struct lsm303d_calib*); // use the fit
+extern  void log_header(struct lsm303d_loghdr*, uint64_t); // fill a log header, sample period
+extern  void log_calib(const struct lsm303d_loghdr*, struct lsm303d_calib*); // ranges and calibration of a log
+extern   int log_create(struct lsm303d_log*, const char*, uint64_t, uint64_t); // new log, size limit, period
+extern   int log_append(struct lsm303d_log*, const struct lsm303draw*); // add one record, no syscall
+extern   int log_open(struct lsm303d_log*, const char*);  // map an existing log read-only
+extern  void log_close(struct lsm303d_log*);              // sync, truncate and unmap the log
+extern const struct lsm303draw *log_record(const struct lsm303d_log*, uint64_t); // i-th oldest kept
+extern   int zlog_create(struct lsm303d_zlog*, const char*, uint64_t); // new archive, sample period
+extern   int zlog_append(struct lsm303d_zlog*, const struct lsm303draw*); // encode one sample
+extern   int zlog_open(struct lsm303d_zlog*, const char*);   // map an archive read-only
+extern   int zlog_seek(struct lsm303d_zlog*, uint64_t);      // position at sample n
+extern   int zlog_next(struct lsm303d_zlog*, struct lsm303draw*); // decode the next sample
+extern  void zlog_close(struct lsm303d_zlog*);               // flush, write the index, close
+extern   int capture_create(struct lsm303d_capture*, const char*, uint64_t, uint64_t); // file or NULL, slots, period
+extern   int capture_drain(struct lsm303d_capture*); // FIFO batch into the next slots
+extern   int capture_open(struct lsm303d_capture*, const char*); // map a capture file read-only
+extern  void capture_close(struct lsm303d_capture*); // trim and unmap, or free the buffer
+extern   int replay_open(struct lsm303d_replay*, const char*);      // log, archive, capture or CSV
+extern   int replay_next(struct lsm303d_replay*, struct lsm303draw*); // 0 sample, 1 end, -1 error
+extern  void replay_close(struct lsm303d_replay*);                  // close the recording
+extern struct lsm303d_shm *shm_create(const char*, const char*, int, uint64_t); // daemon: create the segment
+extern  void shm_publish(struct lsm303d_shm*, const struct lsm303dsample*, float); // seqlock write
+extern  void shm_remove(struct lsm303d_shm*, const char*);   // daemon: unlink the segment
+extern struct lsm303d_shm *shm_attach(const char*);     // client: map the segment read-only
+extern   int shm_latest(const struct lsm303d_shm*, struct lsm303d_shmsample*); // newest sample
+extern   int shm_history(const struct lsm303d_shm*, struct lsm303d_shmsample*, int); // last n
+extern  void shm_detach(struct lsm303d_shm*);           // client: unmap the segment
+extern   int srv_create(struct lsm303d_srv*, const char*, uint64_t); // listen on a socket path
+extern  void srv_publish(struct lsm303d_srv*, uint64_t, const struct lsm303dsample*, float); // queue
+extern   int srv_wait(struct lsm303d_srv*, int); // flush queues, serve events up to timeout ms
+extern  void srv_close(struct lsm303d_srv*);     // disconnect all, remove the socket
+extern  void stats_xfer(int, uint16_t, uint64_t, int); // count a transfer: write, len, ns, result
+extern  void stats_retry();                    // count a fault recovery retry
+extern  void stats_overrun(uint8_t, uint8_t);  // count the STATUS_M, STATUS_A overrun bits
+extern  void stats_missed(uint64_t);           // count skipped deadlines
+extern  void stats_sample(uint64_t);           // count an output sample read at ts
+extern  void stats_sum(struct lsm303d_stats*); // snapshot: sum of all thread slots
+extern  void stats_print(const struct lsm303d_stats*); // text dump
+extern   int stats_write(const struct lsm303d_stats*, const char*); // JSON snapshot file
+extern  void shadow_reset();                   // forget all shadow values
+extern   int shadow_fetch(uint8_t, uint8_t);   // burst read registers first..last into the shadow
+extern   int shadow_get(uint8_t);              // shadow value, read from the sensor once
+extern   int shadow_set(uint8_t, uint8_t, uint8_t); // change masked bits, in the shadow only
+extern   int shadow_commit();                  // write dirty registers in merged bursts
+extern   int lsm303d_set_aodr(int);            // CTRL1 acceleration data rate AODR 0..10
+extern   int lsm303d_set_afs(int);             // CTRL2 acceleration full scale AFS 0..4
+extern   int lsm303d_set_abw(int);             // CTRL2 anti-alias filter bandwidth ABW 0..3
+extern   int lsm303d_set_modr(int);            // CTRL5 magnetic data rate M_ODR 0..5
+extern   int lsm303d_set_rate(int);            // M_ODR 0..5, AODR raised to the same rate
+extern   int lsm303d_set_mres(int);            // CTRL5 magnetic resolution M_RES 0..3
+extern   int lsm303d_set_mfs(int);             // CTRL6 magnetic full scale MFS 0..3
+extern   int lsm303d_set_md(int);              // CTRL7 magnetic sensor mode MD 0..3
+extern   int cache_open(const char*, int);     // map the cache, select the bus/addr record
+extern  void cache_close();                    // write back and unmap the cache
+extern  void cache_invalidate();               // clear the record of the open sensor
+extern  void cache_store_regs(uint8_t, const uint8_t*, uint16_t); // mirror a register write
+extern   int cache_ctrl_match(const uint8_t*); // last CTRL0..CTRL7 written equal these?
+extern  void cache_store_cal(const struct lsm303d_calib*); // save the calibration
+extern   int cache_load_cal(struct lsm303d_calib*);       // restore the calibration
+extern  void cache_store_decl(float);          // save the declination
+extern   int cache_load_decl(float*);          // restore the declination
+extern   int ring_init(struct lsm303d_ring*, uint32_t);  // allocate ring with size slots
+extern  void ring_free(struct lsm303d_ring*);            // release the ring slots
+extern   int ring_push(struct lsm303d_ring*, const struct lsm303draw*); // producer side
+extern   int ring_pop(struct lsm303d_ring*, struct lsm303draw*);        // consumer side
+extern uint32_t ring_count(struct lsm303d_ring*);        // current occupancy
+extern   int filter_parse(struct lsm303d_filter*, const char*); // chain from "avg:4,dec:4"
+extern  void filter_reset(struct lsm303d_filter*);     // clear the windows and states
+extern   int filter_run(struct lsm303d_filter*, struct lsm303draw*); // 1 = sample out, 0 = held
+extern   int lsm303d_fifo_start(int, int);     // start FIFO stream mode (aodr, watermark)
+extern   int lsm303d_fifo_read(int16_t (*)[3], int, uint8_t*); // drain the accel FIFO
+extern   int lsm303d_fifo_stop();              // return the FIFO to bypass mode
 extern float get_heading();                    // calculate heading from raw data
+extern float get_heading_tc(const struct lsm303dsample*);  // tilt-compensated heading
+extern  void get_heading_batch(const struct lsm303dsample*, float*, int); // headings for n samples
+extern float fast_atan2(float, float);         // branch-free atan2 approximation
+extern  void heading_batch_f32(const float*, const float*, const float*,
+                               const float*, const float*, const float*,
+                               float*, int, float); // SoA float batch headings
+extern  void heading_batch_i16(const int16_t*, const int16_t*, const int16_t*,
+                               const int16_t*, const int16_t*, const int16_t*,
+                               const float*, float*, int, float); // SoA raw batch headings
 extern   int delay(long msec);                 // create a Arduino-style delay
+extern uint64_t mono_ns();                     // CLOCK_MONOTONIC in nanoseconds
+extern  void sched_start(struct lsm303d_sched*, uint64_t); // start a fixed-rate schedule
+extern   int sched_wait(struct lsm303d_sched*);            // sleep until the next deadline
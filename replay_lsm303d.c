@@ -0,0 +1,137 @@
+/* ------------------------------------------------------------ *
+ * file:        replay_lsm303d.c                                *
+ * purpose:     Replay source for recorded samples. Sample logs *
+ *              delta archives, accel captures and the raw CSV  *
+ *              export of loglsm303d -r return their records as *
+ *              struct lsm303draw, so recordings run through    *
+ *              the same filter, conversion and heading stages  *
+ *              as live samples, without a sensor.              *
+ *                                                              *
+ * author:      16/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lsm303d.h"
+
+#define CSV_HEADER "time,mag_x,mag_y,mag_z,acc_x,acc_y,acc_z,temp,status_m,status_a"
+
+/* ------------------------------------------------------------ *
+ * replay_csv() opens a loglsm303d -r CSV export. It has no log *
+ * header: the recording gets the ranges and calibration of the *
+ * selected device, and its realtime timestamps stay as they    *
+ * are, with a zero rt_offset. Returns 0 on success, -1 error.  *
+ * ------------------------------------------------------------ */
+static int replay_csv(struct lsm303d_replay *rp, const char *file) {
+   char line[256];
+
+   rp->csv = fopen(file, "r");
+   if(rp->csv == NULL) {
+      printf("Error: could not open replay file %s\n", file);
+      return(-1);
+   }
+   if(fgets(line, sizeof(line), rp->csv) == NULL || strncmp(line, CSV_HEADER, strlen(CSV_HEADER)) != 0) {
+      printf("Error: %s is no sample log and no raw CSV export of loglsm303d -r.\n", file);
+      fclose(rp->csv);
+      return(-1);
+   }
+   rp->line = 1;
+   rp->kind = REPLAY_CSV;
+   log_header(&rp->hdr, 0);
+   rp->hdr.rt_offset = 0;
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * replay_open() opens a recording. The first bytes tell a log, *
+ * archive or capture, with the log header magic, from a CSV.   *
+ * Returns 0 on success, -1 on error.                           *
+ * ------------------------------------------------------------ */
+int replay_open(struct lsm303d_replay *rp, const char *file) {
+   uint32_t magic = 0;
+   memset(rp, 0, sizeof(struct lsm303d_replay));
+
+   FILE *fp = fopen(file, "r");
+   if(fp == NULL) {
+      printf("Error: could not open replay file %s\n", file);
+      return(-1);
+   }
+   size_t got = fread(&magic, sizeof(magic), 1, fp);
+   fclose(fp);
+   if(got != 1 || magic != LSM303D_LOG_MAGIC) return replay_csv(rp, file);
+
+   int res = log_open(&rp->log, file);
+   if(res == 0) {
+      rp->kind = REPLAY_LOG;
+      rp->hdr = *rp->log.hdr;
+   }
+   else if(res == 1) {
+      if(zlog_open(&rp->zlog, file) != 0) return(-1);
+      rp->kind = REPLAY_ZLOG;
+      rp->hdr = rp->zlog.hdr;
+   }
+   else if(res == 2) {
+      if(capture_open(&rp->cap, file) != 0) return(-1);
+      rp->kind = REPLAY_ACC;
+      rp->hdr = *rp->cap.hdr;
+   }
+   else return(-1);
+   if(verbose == 1) printf("Debug: Replay [%s] %llu samples, period %.3f ms\n", file,
+                            (unsigned long long) rp->hdr.count, rp->hdr.period / 1e6);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * replay_next() returns the next recorded sample in raw. An    *
+ * accel capture sample has no magnetic data and is dated on    *
+ * the AODR grid. Returns 0 for a sample, 1 at the end of the   *
+ * recording, -1 on a bad CSV line.                             *
+ * ------------------------------------------------------------ */
+int replay_next(struct lsm303d_replay *rp, struct lsm303draw *raw) {
+   const struct lsm303draw *rec;
+   char line[256];
+
+   switch(rp->kind) {
+      case REPLAY_LOG:
+         if((rec = log_record(&rp->log, rp->n)) == NULL) return(1);
+         *raw = *rec;
+         break;
+      case REPLAY_ZLOG:
+         if(zlog_next(&rp->zlog, raw) != 0) return(1);
+         break;
+      case REPLAY_ACC:
+         if(rp->n >= rp->cap.hdr->count) return(1);
+         memset(raw, 0, sizeof(struct lsm303draw));
+         memcpy(raw->acc, rp->cap.acc[rp->n], sizeof(raw->acc));
+         raw->ts = rp->hdr.t0 + rp->n * rp->hdr.period;
+         break;
+      case REPLAY_CSV: {
+         long long sec, usec;
+         if(fgets(line, sizeof(line), rp->csv) == NULL) return(1);
+         rp->line++;
+         if(sscanf(line, "%lld.%6lld,%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hhu,%hhu", &sec, &usec,
+                   &raw->mag[0], &raw->mag[1], &raw->mag[2], &raw->acc[0], &raw->acc[1],
+                   &raw->acc[2], &raw->temp, &raw->status_m, &raw->status_a) != 11) {
+            printf("Error: bad replay CSV line %llu\n", (unsigned long long) rp->line);
+            return(-1);
+         }
+         raw->ts = (uint64_t) sec * 1000000000ULL + (uint64_t) usec * 1000;
+         break;
+      }
+   }
+   rp->n++;
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * replay_close() closes the recording                          *
+ * ------------------------------------------------------------ */
+void replay_close(struct lsm303d_replay *rp) {
+   switch(rp->kind) {
+      case REPLAY_LOG:  log_close(&rp->log); break;
+      case REPLAY_ZLOG: zlog_close(&rp->zlog); break;
+      case REPLAY_ACC:  capture_close(&rp->cap); break;
+      case REPLAY_CSV:  fclose(rp->csv); break;
+   }
+}
@@ -0,0 +1,101 @@
+/* ------------------------------------------------------------ *
+ * file:        ring_lsm303d.c                                  *
+ * purpose:     Lock-free single-producer/single-consumer ring  *
+ *              buffer for raw LSM303D samples. The acquisition *
+ *              thread pushes, the consumer thread (conversion, *
+ *              heading and output) pops, so a slow sink never  *
+ *              stalls the sensor reads.                        *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "lsm303d.h"
+
+/* ------------------------------------------------------------ *
+ * ring_init() allocates size slots (rounded up to a power of   *
+ * 2) on cache line boundaries. Returns 0 on success, -1 error. *
+ * ------------------------------------------------------------ */
+int ring_init(struct lsm303d_ring *r, uint32_t size) {
+   uint32_t slots = 2;
+   while(slots < size && slots < 0x80000000u) slots <<= 1;
+
+   memset(r, 0, sizeof(struct lsm303d_ring));
+   r->size = slots;
+   r->mask = slots - 1;
+   if(posix_memalign((void **) &r->slots, LSM303D_CACHELINE,
+                     slots * sizeof(struct lsm303draw)) != 0) {
+      printf("Error: could not allocate %u ring slots.\n", slots);
+      r->slots = NULL;
+      return(-1);
+   }
+   if(verbose == 1) printf("Debug: Ring buffer [%u] slots\n", slots);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * ring_free() releases the ring slots                          *
+ * ------------------------------------------------------------ */
+void ring_free(struct lsm303d_ring *r) {
+   free(r->slots);
+   r->slots = NULL;
+}
+
+/* ------------------------------------------------------------ *
+ * ring_push() producer side: copies the sample into the next   *
+ * slot, then publishes it with a release store of head. If the *
+ * ring is full, the sample is dropped and counted. Returns 0   *
+ * on success, -1 on overflow. The high water mark is checked   *
+ * on every push. The cached tail can only overstate the        *
+ * backlog, so tail is re-read only when it would set a new     *
+ * mark, which keeps the shared line off the common path.       *
+ * ------------------------------------------------------------ */
+int ring_push(struct lsm303d_ring *r, const struct lsm303draw *raw) {
+   uint64_t head = r->head;
+
+   if(head - r->tail_cache >= r->size) {
+      r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+      if(head - r->tail_cache >= r->size) {
+         __atomic_store_n(&r->overflows, r->overflows + 1, __ATOMIC_RELAXED);
+         return(-1);
+      }
+   }
+   r->slots[head & r->mask] = *raw;
+   __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+   if(head + 1 - r->tail_cache > r->hiwater) {
+      r->tail_cache = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+      if(head + 1 - r->tail_cache > r->hiwater)
+         __atomic_store_n(&r->hiwater, head + 1 - r->tail_cache, __ATOMIC_RELAXED);
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * ring_pop() consumer side: copies the oldest sample out and   *
+ * frees its slot with a release store of tail. Returns 0 on    *
+ * success, -1 if the ring is empty. The consumer refreshes its *
+ * copy of head only when it ran out.                           *
+ * ------------------------------------------------------------ */
+int ring_pop(struct lsm303d_ring *r, struct lsm303draw *raw) {
+   uint64_t tail = r->tail;
+
+   if(tail == r->head_cache) {
+      r->head_cache = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+      if(tail == r->head_cache) return(-1);
+   }
+   *raw = r->slots[tail & r->mask];
+   __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * ring_count() returns the current occupancy, safe to call     *
+ * from either side or a third (monitoring) thread.             *
+ * ------------------------------------------------------------ */
+uint32_t ring_count(struct lsm303d_ring *r) {
+   uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+   uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+   return (uint32_t) (head - tail);
+}
@@ -0,0 +1,188 @@
+/* ------------------------------------------------------------ *
+ * file:        shadow_lsm303d.c                                *
+ * purpose:     Register shadow of the LSM303D configuration:   *
+ *              CTRL0..CTRL7, FIFO_CTRL and the interrupt       *
+ *              generator registers. Bitfield setters update    *
+ *              the shadow only, shadow_commit() then writes    *
+ *              the dirty registers, merging them into as few   *
+ *              auto-increment bursts as possible. A change of  *
+ *              data rate or full scale costs one transaction.  *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "lsm303d.h"
+
+#define BIT(reg) (1ULL << (reg))
+
+/* ------------------------------------------------------------ *
+ * shadow_reset() forgets all shadow values, e.g. after opening *
+ * a bus or a sensor reboot. The verify setting is kept.        *
+ * ------------------------------------------------------------ */
+void shadow_reset() {
+   memset(lsm303d->shadow.reg, 0, sizeof(lsm303d->shadow.reg));
+   lsm303d->shadow.known = 0;
+   lsm303d->shadow.dirty = 0;
+}
+
+/* ------------------------------------------------------------ *
+ * shadow_fetch() loads the registers first..last from the      *
+ * sensor in one burst read, dropping pending changes to them.  *
+ * The range must not span the data registers 0x28..0x2D, the   *
+ * FIFO rollover would wrap the read. Returns 0 or -1 on error. *
+ * ------------------------------------------------------------ */
+int shadow_fetch(uint8_t first, uint8_t last) {
+   uint8_t buf[LSM303D_REGMAP_SIZE];
+   int len = last - first + 1;
+
+   if(lsm303d_read_regs(first, buf, len) != 0) return(-1);
+   for(int i=0; i<len; i++) {
+      uint64_t bit = BIT(first + i);
+      if(!(LSM303D_SHADOW_MASK & bit)) continue;
+      lsm303d->shadow.reg[first + i] = buf[i];
+      lsm303d->shadow.known |= bit;
+      lsm303d->shadow.dirty &= ~bit;
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * shadow_get() returns the value of a shadowed register, it is *
+ * read from the sensor only the first time. Returns -1 on a    *
+ * read error or a register that is not shadowed.               *
+ * ------------------------------------------------------------ */
+int shadow_get(uint8_t reg) {
+   if(reg >= LSM303D_REGMAP_SIZE || !(LSM303D_SHADOW_MASK & BIT(reg))) return(-1);
+   if(!(lsm303d->shadow.known & BIT(reg)) && shadow_fetch(reg, reg) != 0) return(-1);
+   return lsm303d->shadow.reg[reg];
+}
+
+/* ------------------------------------------------------------ *
+ * shadow_set() changes the mask bits of a shadowed register to *
+ * val. Only the shadow changes, shadow_commit() writes it. A   *
+ * partial mask needs the current value, a full mask does not.  *
+ * Returns 0 on success, -1 on error.                           *
+ * ------------------------------------------------------------ */
+int shadow_set(uint8_t reg, uint8_t mask, uint8_t val) {
+   if(reg >= LSM303D_REGMAP_SIZE || !(LSM303D_SHADOW_MASK & BIT(reg))) {
+      printf("Error: register 0x%02X is not in the shadow\n", reg);
+      return(-1);
+   }
+   int known = (lsm303d->shadow.known & BIT(reg)) != 0;
+   if(mask != 0xFF && !known) {
+      if(shadow_get(reg) < 0) return(-1);
+      known = 1;
+   }
+   uint8_t old = lsm303d->shadow.reg[reg];
+   uint8_t new = (old & ~mask) | (val & mask);
+   if(known && new == old) return(0);
+   lsm303d->shadow.reg[reg] = new;
+   lsm303d->shadow.known |= BIT(reg);
+   lsm303d->shadow.dirty |= BIT(reg);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * shadow_commit() writes all dirty registers. A burst starts at *
+ * a dirty register and extends over following shadowed ones,  *
+ * rewriting clean registers in between when that saves a bus   *
+ * transaction, up to the last dirty register of the block. The *
+ * optional readback compares each burst, CTRL0 BOOT clears     *
+ * itself and is ignored. Returns 0 on success, -1 on error.    *
+ * ------------------------------------------------------------ */
+int shadow_commit() {
+   int reg = 0;
+
+   while(lsm303d->shadow.dirty != 0) {
+      while(!(lsm303d->shadow.dirty & BIT(reg))) reg++;
+
+      /* extend the burst while the next register is shadowed, */
+      /* known, and a dirty one follows before the block ends  */
+      int end = reg, next = reg + 1;
+      while(next < LSM303D_REGMAP_SIZE && (LSM303D_SHADOW_MASK & BIT(next))
+            && (lsm303d->shadow.known & BIT(next))) {
+         if(lsm303d->shadow.dirty & BIT(next)) end = next;
+         next++;
+      }
+      int len = end - reg + 1;
+      if(verbose == 1) printf("Debug: Shadow commit [0x%02X..0x%02X] %d byte burst\n",
+                               reg, end, len);
+      if(lsm303d_write_regs(reg, &lsm303d->shadow.reg[reg], len) != 0) return(-1);
+      uint64_t run = ((len == 64) ? ~0ULL : (BIT(len) - 1)) << reg;
+      lsm303d->shadow.dirty &= ~run;
+
+      if(lsm303d->shadow.verify) {
+         uint8_t buf[LSM303D_REGMAP_SIZE];
+         if(lsm303d_read_regs(reg, buf, len) != 0) return(-1);
+         for(int i=0; i<len; i++) {
+            uint8_t mask = (reg + i == LSM303D_CTRL0) ? ~LSM303D_CTRL0_BOOT : 0xFF;
+            if((buf[i] & mask) == (lsm303d->shadow.reg[reg + i] & mask)) continue;
+            printf("Error: register 0x%02X readback 0x%02X, expected 0x%02X\n",
+                   reg + i, buf[i], lsm303d->shadow.reg[reg + i]);
+            lsm303d->shadow.known &= ~run;
+            return(-1);
+         }
+      }
+      reg = end + 1;
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * Bitfield setters, they change the shadow only. The full      *
+ * scale setters also switch the conversion sensitivities.      *
+ * ------------------------------------------------------------ */
+int lsm303d_set_aodr(int aodr) {    // CTRL1 AODR 0 = off, 1..10 = 3.125..1600 Hz
+   if(aodr < 0 || aodr > 10) return(-1);
+   return shadow_set(LSM303D_CTRL1, 0xF0, aodr << LSM303D_AODR_SHIFT);
+}
+
+int lsm303d_set_afs(int afs) {      // CTRL2 AFS 0..4 = +/-2, 4, 6, 8, 16 g
+   if(afs < 0 || afs > 4) return(-1);
+   if(shadow_set(LSM303D_CTRL2, 0x38, afs << LSM303D_AFS_SHIFT) != 0) return(-1);
+   return lsm303d_calib_set(&lsm303d->cal, lsm303d->cal.mfs, afs);
+}
+
+int lsm303d_set_abw(int abw) {      // CTRL2 ABW 0..3 = 773, 194, 362, 50 Hz
+   if(abw < 0 || abw > 3) return(-1);
+   return shadow_set(LSM303D_CTRL2, 0xC0, abw << LSM303D_ABW_SHIFT);
+}
+
+int lsm303d_set_modr(int modr) {    // CTRL5 M_ODR 0..5 = 3.125..100 Hz
+   if(modr < 0 || modr > 5) return(-1);
+   return shadow_set(LSM303D_CTRL5, 0x1C, modr << LSM303D_MODR_SHIFT);
+}
+
+/* ------------------------------------------------------------ *
+ * lsm303d_set_rate() sets M_ODR and raises AODR to at least    *
+ * the same rate, AODR code M_ODR + 1, so every magnetic sample *
+ * has fresh tilt data. M_ODR 100 Hz also requires AODR > 50 Hz *
+ * (datasheet, note to the M_ODR table). A faster AODR stays.   *
+ * ------------------------------------------------------------ */
+int lsm303d_set_rate(int modr) {    // M_ODR 0..5 with a matching AODR
+   if(modr < 0 || modr > 5) return(-1);
+   int ctrl1 = shadow_get(LSM303D_CTRL1);
+   if(ctrl1 < 0) return(-1);
+   int aodr = ctrl1 >> LSM303D_AODR_SHIFT;
+   if(aodr <= modr || aodr > 10) aodr = modr + 1;
+   if(lsm303d_set_modr(modr) != 0) return(-1);
+   return lsm303d_set_aodr(aodr);
+}
+
+int lsm303d_set_mres(int mres) {    // CTRL5 M_RES 0 = low, 3 = high resolution
+   if(mres < 0 || mres > 3) return(-1);
+   return shadow_set(LSM303D_CTRL5, 0x60, mres << LSM303D_MRES_SHIFT);
+}
+
+int lsm303d_set_mfs(int mfs) {      // CTRL6 MFS 0..3 = +/-2, 4, 8, 12 gauss
+   if(mfs < 0 || mfs > 3) return(-1);
+   if(shadow_set(LSM303D_CTRL6, 0x60, mfs << LSM303D_MFS_SHIFT) != 0) return(-1);
+   return lsm303d_calib_set(&lsm303d->cal, mfs, lsm303d->cal.afs);
+}
+
+int lsm303d_set_md(int md) {        // CTRL7 MD continuous, single, power-down
+   if(md < 0 || md > 3) return(-1);
+   return shadow_set(LSM303D_CTRL7, LSM303D_MD_MASK, md);
+}
@@ -0,0 +1,165 @@
+/* ------------------------------------------------------------ *
+ * file:        shm_lsm303d.c                                   *
+ * purpose:     POSIX shared memory publication of the latest   *
+ *              sample for the -D daemon mode. The daemon owns  *
+ *              the sensor and the bus, clients map the segment *
+ *              read-only and copy the newest sample, or recent *
+ *              history, under a seqlock: no bus access, no     *
+ *              system call, no lock the daemon could wait on.  *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lsm303d.h"
+
+/* ------------------------------------------------------------ *
+ * shm_create() creates the segment name for a daemon with the  *
+ * sensor bus and address and the sample period in ns. A        *
+ * segment of a running daemon is not taken over. Returns the   *
+ * mapped segment, or NULL on error.                            *
+ * ------------------------------------------------------------ */
+struct lsm303d_shm *shm_create(const char *name, const char *bus, int addr, uint64_t period) {
+   struct lsm303d_shm *shm = shm_attach(name);
+   if(shm != NULL) {
+      int pid = shm->pid;
+      shm_detach(shm);
+      if(pid > 0 && pid != getpid() && kill(pid, 0) == 0) {
+         printf("Error: daemon pid %d already publishes %s\n", pid, name);
+         return NULL;
+      }
+   }
+
+   int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+   if(fd < 0) {
+      printf("Error: could not create shared memory %s\n", name);
+      return NULL;
+   }
+   if(ftruncate(fd, sizeof(struct lsm303d_shm)) != 0) {
+      printf("Error: could not size shared memory %s\n", name);
+      close(fd);
+      return NULL;
+   }
+   shm = mmap(NULL, sizeof(struct lsm303d_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if(shm == MAP_FAILED) {
+      printf("Error: could not map shared memory %s\n", name);
+      return NULL;
+   }
+
+   /* magic last: clients ignore the segment until it is set up */
+   __atomic_store_n(&shm->magic, 0, __ATOMIC_RELAXED);
+   memset((uint8_t *) shm + sizeof(shm->magic), 0, sizeof(struct lsm303d_shm) - sizeof(shm->magic));
+   shm->version = LSM303D_SHM_VERSION;
+   shm->size    = sizeof(struct lsm303d_shm);
+   shm->hist    = LSM303D_SHM_HIST;
+   shm->pid     = getpid();
+   snprintf(shm->bus, sizeof(shm->bus), "%s", bus);
+   shm->addr    = addr;
+   shm->declination = lsm303d->declination;
+   shm->period  = period;
+   __atomic_store_n(&shm->magic, LSM303D_SHM_MAGIC, __ATOMIC_RELEASE);
+   if(verbose == 1) printf("Debug: Shared memory [%s] %zu bytes, %d history samples\n",
+                            name, sizeof(struct lsm303d_shm), LSM303D_SHM_HIST);
+   return shm;
+}
+
+/* ------------------------------------------------------------ *
+ * shm_publish() makes smp the latest sample and appends it to  *
+ * the history ring, inside one seqlock write section.          *
+ * ------------------------------------------------------------ */
+void shm_publish(struct lsm303d_shm *shm, const struct lsm303dsample *smp, float heading) {
+   uint32_t seq = shm->seq;
+   uint64_t n = shm->count;
+
+   __atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);     // odd seq is visible before the data
+   shm->latest.n = n;
+   shm->latest.smp = *smp;
+   shm->latest.heading = heading;
+   shm->ring[n & (LSM303D_SHM_HIST - 1)] = shm->latest;
+   shm->count = n + 1;
+   __atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* ------------------------------------------------------------ *
+ * shm_remove() unmaps and unlinks the segment at daemon exit   *
+ * ------------------------------------------------------------ */
+void shm_remove(struct lsm303d_shm *shm, const char *name) {
+   shm->pid = 0;
+   munmap(shm, sizeof(struct lsm303d_shm));
+   shm_unlink(name);
+}
+
+/* ------------------------------------------------------------ *
+ * shm_attach() maps the segment name read-only. Returns NULL   *
+ * if no daemon created it, or it has a different layout.       *
+ * ------------------------------------------------------------ */
+struct lsm303d_shm *shm_attach(const char *name) {
+   struct stat st;
+   int fd = shm_open(name, O_RDONLY, 0);
+   if(fd < 0) return NULL;
+   if(fstat(fd, &st) != 0 || st.st_size != sizeof(struct lsm303d_shm)) {
+      close(fd);
+      return NULL;
+   }
+   struct lsm303d_shm *shm = mmap(NULL, sizeof(struct lsm303d_shm), PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if(shm == MAP_FAILED) return NULL;
+   if(__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != LSM303D_SHM_MAGIC
+      || shm->version != LSM303D_SHM_VERSION || shm->size != sizeof(struct lsm303d_shm)) {
+      munmap(shm, sizeof(struct lsm303d_shm));
+      return NULL;
+   }
+   return shm;
+}
+
+/* ------------------------------------------------------------ *
+ * shm_latest() copies the newest sample into s. Returns 0, or  *
+ * -1 if nothing was published yet.                             *
+ * ------------------------------------------------------------ */
+int shm_latest(const struct lsm303d_shm *shm, struct lsm303d_shmsample *s) {
+   uint32_t seq;
+   uint64_t count;
+   do {
+      while((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1) sched_yield();
+      count = shm->count;
+      *s = shm->latest;
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);  // the copy completes before the recheck
+   } while(__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq);
+   return (count > 0) ? 0 : -1;
+}
+
+/* ------------------------------------------------------------ *
+ * shm_history() copies the last n samples, oldest first, into  *
+ * s. Returns the number copied, fewer if not published yet.    *
+ * ------------------------------------------------------------ */
+int shm_history(const struct lsm303d_shm *shm, struct lsm303d_shmsample *s, int n) {
+   uint32_t seq;
+   uint64_t count;
+   int m;
+   if(n > LSM303D_SHM_HIST) n = LSM303D_SHM_HIST;
+   do {                                         // clamp per attempt, count may grow
+      while((seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE)) & 1) sched_yield();
+      count = shm->count;
+      m = (count < (uint64_t) n) ? (int) count : n;
+      for(int i=0; i<m; i++) s[i] = shm->ring[(count - m + i) & (LSM303D_SHM_HIST - 1)];
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+   } while(__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) != seq);
+   return m;
+}
+
+/* ------------------------------------------------------------ *
+ * shm_detach() unmaps a client mapping                         *
+ * ------------------------------------------------------------ */
+void shm_detach(struct lsm303d_shm *shm) {
+   munmap(shm, sizeof(struct lsm303d_shm));
+}
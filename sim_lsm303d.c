@@ -0,0 +1,665 @@
+/* ------------------------------------------------------------ *
+ * file:        sim_lsm303d.c                                   *
+ * purpose:     Simulated LSM303D sensor behind the register    *
+ *              transport interface. Models the 64 byte register*
+ *              map, WHO_AM_I, CTRL0..CTRL7, STATUS_A/STATUS_M  *
+ *              data-ready and overrun bits, the 32-level accel *
+ *              FIFO, ODR timing and sensor noise. This lets the*
+ *              acquisition path run in CI and on dev machines  *
+ *              without a Pi and a sensor attached. Injected    *
+ *              NACKs and brown-outs exercise fault recovery.   *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include "lsm303d.h"
+
+#define DEG2RAD (M_PI / 180.0)
+
+/* ------------------------------------------------------------ *
+ * Acceleration data rates (CTRL1 AODR), magnetic data rates    *
+ * (CTRL5 M_ODR) in Hz, and the full scale sensitivities for    *
+ * CTRL2 AFS in milli g/LSB and CTRL6 MFS in milli Gauss/LSB.   *
+ * ------------------------------------------------------------ */
+static const double aodr_hz[16] = { 0, 3.125, 6.25, 12.5, 25, 50, 100, 200,
+                                    400, 800, 1600, 0, 0, 0, 0, 0 };
+static const double modr_hz[8]  = { 3.125, 6.25, 12.5, 25, 50, 100, 0, 0 };
+static const float  afs_mg[8]   = { 0.061, 0.122, 0.183, 0.244, 0.732,
+                                    0.732, 0.732, 0.732 };
+static const float  mfs_mg[4]   = { 0.080, 0.160, 0.320, 0.479 };
+
+/* ------------------------------------------------------------ *
+ * Simulated sensor state                                       *
+ * ------------------------------------------------------------ */
+struct simdev{
+   struct lsm303d_transport tp;
+   struct lsm303d_simcfg cfg;
+   uint8_t regs[LSM303D_REGMAP_SIZE]; // register file
+   int16_t fifo[LSM303D_FIFO_DEPTH][3];
+   int fifo_head;      // index of the oldest FIFO sample
+   int fifo_count;     // number of stored FIFO samples
+   double t0;          // CLOCK_MONOTONIC at open in seconds
+   double now;         // sensor time in seconds
+   double next_a;      // time the next accel sample is due
+   double next_m;      // time the next magnetic sample is due
+   double per_a;       // current accel sample period, 0 = off
+   double per_m;       // current magnetic sample period, 0 = off
+   uint32_t rng;       // xorshift32 noise generator state
+   int irq_fd[2];      // eventfd of the INT1/INT2 stand-in lines, -1 = none
+   uint32_t frng;      // xorshift32 fault generator state, apart from the noise
+   int nack_left;      // transactions still NACKed in the current burst
+   double next_brown;  // time of the next brown-out
+   pthread_mutex_t lock; // serializes transport and irq thread access
+};
+
+/* ------------------------------------------------------------ *
+ * Simulated interrupt line: an eventfd the sensor model writes *
+ * on each rising edge of the routed INT pin. In real time mode *
+ * a thread advances the sensor clock at each sample time; in   *
+ * virtual time the line is always ready, because the next     *
+ * status poll advances the sensor clock to the next sample.    *
+ * ------------------------------------------------------------ */
+struct simirq{
+   struct lsm303d_irqline line;
+   struct simdev *d;
+   int pin;            // sensor INT pin 1 or 2
+   int stop;           // asks the thread to finish
+   int running;        // 1 if the clock thread was started
+   pthread_t thread;   // real time clock thread
+};
+
+/* ------------------------------------------------------------ *
+ * sim_defaults() fills in the default simulator settings: a    *
+ * flat board facing north in a 480 milli Gauss field, running  *
+ * in virtual time.                                             *
+ * ------------------------------------------------------------ */
+void sim_defaults(struct lsm303d_simcfg *cfg) {
+   memset(cfg, 0, sizeof(struct lsm303d_simcfg));
+   cfg->speed     = 0;
+   cfg->mag_field = 480;
+   cfg->mag_incl  = 49;
+   cfg->mag_noise = 3;
+   cfg->acc_noise = 2;
+   cfg->temp      = 25;
+   cfg->seed      = 1;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_clock() returns CLOCK_MONOTONIC in seconds               *
+ * ------------------------------------------------------------ */
+static double sim_clock() {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_gauss() returns a normal distributed value (sigma 1)     *
+ * from the xorshift32 generator, using Box-Muller.             *
+ * ------------------------------------------------------------ */
+static float sim_gauss(struct simdev *d) {
+   float u[2];
+   for(int i=0; i<2; i++) {
+      d->rng ^= d->rng << 13;
+      d->rng ^= d->rng >> 17;
+      d->rng ^= d->rng << 5;
+      u[i] = (d->rng >> 8) * (1.0f / 16777216.0f);
+   }
+   if(u[0] < 1e-7f) u[0] = 1e-7f;
+   return sqrtf(-2.0f * logf(u[0])) * cosf(2.0f * M_PI * u[1]);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_clamp() rounds a LSB value into the int16 output range   *
+ * ------------------------------------------------------------ */
+static int16_t sim_clamp(float v) {
+   if(v > 32767.0f) return 32767;
+   if(v < -32768.0f) return -32768;
+   return (int16_t) lrintf(v);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_rotate() turns an earth frame vector (north, east, down) *
+ * into the sensor frame for heading psi, board pitch and roll: *
+ * b = Rx(roll) * Ry(pitch) * Rz(psi) * in is the body frame X  *
+ * forward, Y right, Z down, the LSM303D axes of a face-up      *
+ * board are X forward, Y left, Z up: out = (bx, -by, -bz).     *
+ * ------------------------------------------------------------ */
+static void sim_rotate(struct simdev *d, double psi, const float in[3], float out[3]) {
+   double th = d->cfg.pitch * DEG2RAD;
+   double ph = d->cfg.roll * DEG2RAD;
+   double x1 =  cos(psi) * in[0] + sin(psi) * in[1];
+   double y1 = -sin(psi) * in[0] + cos(psi) * in[1];
+   double z1 =  in[2];
+   double x2 =  cos(th) * x1 - sin(th) * z1;
+   double z2 =  sin(th) * x1 + cos(th) * z1;
+   out[0] = x2;
+   out[1] = -(cos(ph) * y1 + sin(ph) * z2);
+   out[2] = -(-sin(ph) * y1 + cos(ph) * z2);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_fifo_active() returns 1 if CTRL0 FIFO_EN is set and the  *
+ * FIFO_CTRL mode is not bypass.                                *
+ * ------------------------------------------------------------ */
+static int sim_fifo_active(struct simdev *d) {
+   return (d->regs[LSM303D_CTRL0] & LSM303D_CTRL0_FIFO_EN) &&
+          (d->regs[LSM303D_FIFO_CTRL] >> LSM303D_FM_SHIFT) != LSM303D_FM_BYPASS;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_int_level() returns the INT1/INT2 pin level for the      *
+ * events routed in CTRL3 (INT1) and CTRL4 (INT2).              *
+ * ------------------------------------------------------------ */
+static int sim_int_level(struct simdev *d, int pin) {
+   uint8_t drdya = d->regs[LSM303D_STATUS_A] & LSM303D_ZYXADA;
+   uint8_t drdym = d->regs[LSM303D_STATUS_M] & LSM303D_ZYXMDA;
+   if(pin == 1) {
+      uint8_t ctrl3 = d->regs[LSM303D_CTRL3];
+      return ((ctrl3 & LSM303D_P1_DRDYA) && drdya) ||
+             ((ctrl3 & LSM303D_P1_DRDYM) && drdym);
+   }
+   uint8_t ctrl4 = d->regs[LSM303D_CTRL4];
+   int fth = d->regs[LSM303D_FIFO_CTRL] & LSM303D_FTH_MASK;
+   return ((ctrl4 & LSM303D_P2_DRDYA) && drdya) ||
+          ((ctrl4 & LSM303D_P2_DRDYM) && drdym) ||
+          ((ctrl4 & LSM303D_P2_OVERRUN) && d->fifo_count == LSM303D_FIFO_DEPTH) ||
+          ((ctrl4 & LSM303D_P2_FTH) && d->fifo_count > 0 && d->fifo_count >= fth);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_int_edge() signals the stand-in lines whose INT pin went *
+ * from low (level before[] prior to a sample) to high.         *
+ * ------------------------------------------------------------ */
+static void sim_int_edge(struct simdev *d, const int before[2]) {
+   uint64_t one = 1;
+   for(int i=0; i<2; i++) {
+      if(d->irq_fd[i] < 0 || before[i] || !sim_int_level(d, i + 1)) continue;
+      if(write(d->irq_fd[i], &one, sizeof(one)) != sizeof(one) && verbose == 1)
+         printf("Debug: sim INT%d eventfd write failed\n", i + 1);
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * sim_accel_sample() creates one acceleration sample at time t *
+ * and stores it in the output registers or the FIFO. At rest   *
+ * the sensor measures the specific force, 1 g up, so a level   *
+ * board reads Z = +1000 mg.                                    *
+ * ------------------------------------------------------------ */
+static void sim_accel_sample(struct simdev *d, double t) {
+   static const float force[3] = { 0, 0, -1000 };
+   float acc[3];
+   int16_t raw[3];
+
+   sim_rotate(d, 0, force, acc);
+   float lsb = afs_mg[(d->regs[LSM303D_CTRL2] >> LSM303D_AFS_SHIFT) & 0x07];
+   for(int i=0; i<3; i++)
+      raw[i] = sim_clamp((acc[i] + d->cfg.acc_noise * sim_gauss(d)) / lsb);
+
+   if(sim_fifo_active(d)) {
+      int fm = d->regs[LSM303D_FIFO_CTRL] >> LSM303D_FM_SHIFT;
+      if(d->fifo_count == LSM303D_FIFO_DEPTH) {
+         if(fm == LSM303D_FM_FIFO) return;    // FIFO mode stops when full
+         d->fifo_head = (d->fifo_head + 1) % LSM303D_FIFO_DEPTH;
+         d->fifo_count--;                     // stream mode drops oldest
+      }
+      int slot = (d->fifo_head + d->fifo_count) % LSM303D_FIFO_DEPTH;
+      memcpy(d->fifo[slot], raw, sizeof(raw));
+      d->fifo_count++;
+   }
+   else {
+      for(int i=0; i<3; i++) {
+         d->regs[LSM303D_OUT_X_L_A + 2*i]     = raw[i] & 0xFF;
+         d->regs[LSM303D_OUT_X_L_A + 2*i + 1] = (raw[i] >> 8) & 0xFF;
+      }
+   }
+   if(d->regs[LSM303D_STATUS_A] & LSM303D_ZYXADA)
+      d->regs[LSM303D_STATUS_A] |= LSM303D_ZYXAOR;
+   d->regs[LSM303D_STATUS_A] |= LSM303D_ZYXADA;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_mag_sample() creates one magnetic and temperature sample *
+ * at time t in the output registers.                           *
+ * ------------------------------------------------------------ */
+static void sim_mag_sample(struct simdev *d, double t) {
+   float field[3], mag[3];
+   double psi = (d->cfg.heading + d->cfg.rotate * t) * DEG2RAD;
+
+   field[0] = d->cfg.mag_field * cos(d->cfg.mag_incl * DEG2RAD);
+   field[1] = 0;
+   field[2] = d->cfg.mag_field * sin(d->cfg.mag_incl * DEG2RAD);
+   sim_rotate(d, psi, field, mag);
+
+   float lsb = mfs_mg[(d->regs[LSM303D_CTRL6] >> LSM303D_MFS_SHIFT) & 0x03];
+   for(int i=0; i<3; i++) {
+      int16_t raw = sim_clamp((mag[i] + d->cfg.mag_noise * sim_gauss(d)) / lsb);
+      d->regs[LSM303D_OUT_X_L_M + 2*i]     = raw & 0xFF;
+      d->regs[LSM303D_OUT_X_L_M + 2*i + 1] = (raw >> 8) & 0xFF;
+   }
+   /* temperature: 12 bit, 8 LSB/deg C, zero at 25 deg C */
+   if(d->regs[LSM303D_CTRL5] & LSM303D_TEMP_EN) {
+      int16_t temp = sim_clamp((d->cfg.temp - 25.0f) * 8.0f) & 0x0FFF;
+      d->regs[LSM303D_TEMP_OUT_L] = temp & 0xFF;
+      d->regs[LSM303D_TEMP_OUT_H] = (temp >> 8) & 0x0F;
+   }
+   if(d->regs[LSM303D_STATUS_M] & LSM303D_ZYXMDA)
+      d->regs[LSM303D_STATUS_M] |= LSM303D_ZYXMOR;
+   d->regs[LSM303D_STATUS_M] |= LSM303D_ZYXMDA;
+
+   /* single-conversion mode returns to power-down */
+   if((d->regs[LSM303D_CTRL7] & LSM303D_MD_MASK) == LSM303D_MD_SINGLE) {
+      d->regs[LSM303D_CTRL7] |= LSM303D_MD_MASK;
+      d->per_m  = 0;
+      d->next_m = INFINITY;
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * sim_catchup() creates all samples due up to the sensor time. *
+ * After a long gap only the last FIFO_DEPTH samples matter, so *
+ * older ones are skipped.                                      *
+ * ------------------------------------------------------------ */
+static void sim_catchup(struct simdev *d) {
+   if(d->per_a > 0 && d->next_a < d->now - LSM303D_FIFO_DEPTH * d->per_a) {
+      double skip = floor((d->now - d->next_a) / d->per_a) - LSM303D_FIFO_DEPTH;
+      d->next_a += skip * d->per_a;
+      d->regs[LSM303D_STATUS_A] |= LSM303D_ZYXADA | LSM303D_ZYXAOR;
+   }
+   while(d->next_a <= d->now) {
+      int before[2] = { sim_int_level(d, 1), sim_int_level(d, 2) };
+      sim_accel_sample(d, d->next_a);
+      sim_int_edge(d, before);
+      d->next_a += d->per_a;
+   }
+   if(d->per_m > 0 && d->next_m < d->now - d->per_m) {
+      double skip = floor((d->now - d->next_m) / d->per_m) - 1;
+      d->next_m += skip * d->per_m;
+      d->regs[LSM303D_STATUS_M] |= LSM303D_ZYXMDA | LSM303D_ZYXMOR;
+   }
+   while(d->next_m <= d->now) {
+      int before[2] = { sim_int_level(d, 1), sim_int_level(d, 2) };
+      sim_mag_sample(d, d->next_m);
+      sim_int_edge(d, before);
+      d->next_m = (d->per_m > 0) ? d->next_m + d->per_m : INFINITY;
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * sim_retime() picks up ODR and mode changes from CTRL1, CTRL5 *
+ * and CTRL7, and reschedules the sample clocks if they changed *
+ * ------------------------------------------------------------ */
+static void sim_retime(struct simdev *d) {
+   double hz = aodr_hz[d->regs[LSM303D_CTRL1] >> LSM303D_AODR_SHIFT];
+   double per_a = (hz > 0) ? 1.0 / hz : 0;
+   if(per_a != d->per_a) {
+      d->per_a  = per_a;
+      d->next_a = (per_a > 0) ? d->now + per_a : INFINITY;
+   }
+
+   double per_m = 0;
+   int md = d->regs[LSM303D_CTRL7] & LSM303D_MD_MASK;
+   hz = modr_hz[(d->regs[LSM303D_CTRL5] >> LSM303D_MODR_SHIFT) & 0x07];
+   if(hz > 0 && (md == LSM303D_MD_CONT || md == LSM303D_MD_SINGLE)) per_m = 1.0 / hz;
+   if(per_m != d->per_m || md == LSM303D_MD_SINGLE) {
+      d->next_m = (per_m > 0) ? d->now + per_m : INFINITY;
+      d->per_m  = (md == LSM303D_MD_SINGLE) ? 0 : per_m;
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * sim_boot() loads the power-on register defaults              *
+ * ------------------------------------------------------------ */
+static void sim_boot(struct simdev *d) {
+   memset(d->regs, 0, sizeof(d->regs));
+   d->regs[LSM303D_WHO_AM_I] = PRD_ID;
+   d->regs[LSM303D_CTRL1]    = 0x07;   // AODR power-down, XYZ enabled
+   d->regs[LSM303D_CTRL5]    = 0x18;   // M_ODR 50 Hz
+   d->regs[LSM303D_CTRL6]    = 0x20;   // MFS +/-4 gauss
+   d->regs[LSM303D_CTRL7]    = 0x02;   // MD magnetic power-down
+   d->fifo_head  = 0;
+   d->fifo_count = 0;
+   d->per_a  = d->per_m  = 0;
+   d->next_a = d->next_m = INFINITY;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_nack() decides if the current transaction fails: inside  *
+ * a burst, or when a new burst starts with nack_rate.          *
+ * ------------------------------------------------------------ */
+static int sim_nack(struct simdev *d) {
+   if(d->nack_left > 0) {
+      d->nack_left--;
+      return 1;
+   }
+   if(d->cfg.nack_rate <= 0) return 0;
+   d->frng ^= d->frng << 13;
+   d->frng ^= d->frng >> 17;
+   d->frng ^= d->frng << 5;
+   if((d->frng >> 8) * (1.0f / 16777216.0f) >= d->cfg.nack_rate) return 0;
+   d->nack_left = (d->cfg.nack_len > 1) ? d->cfg.nack_len - 1 : 0;
+   return 1;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_brownout() reboots the sensor to its power-on registers, *
+ * it does not answer the next nack_len transactions.           *
+ * ------------------------------------------------------------ */
+static void sim_brownout(struct simdev *d) {
+   if(verbose == 1) printf("Debug: Simulated brown-out at %.3f s\n", d->now);
+   sim_boot(d);
+   d->next_brown = d->now + d->cfg.brownout;
+   d->nack_left  = (d->cfg.nack_len > 1) ? d->cfg.nack_len : 1;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_update() moves the sensor time forward to the real time  *
+ * (speed > 0) and creates the samples that became due.         *
+ * ------------------------------------------------------------ */
+static void sim_update(struct simdev *d) {
+   if(d->cfg.speed > 0) d->now = (sim_clock() - d->t0) * d->cfg.speed;
+   sim_catchup(d);
+   if(d->cfg.brownout > 0 && d->now >= d->next_brown) sim_brownout(d);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_wait() implements virtual time: a status poll finding no *
+ * new data advances the sensor clock to the next due sample,   *
+ * or for the FIFO until the watermark is reached.              *
+ * ------------------------------------------------------------ */
+static void sim_wait(struct simdev *d, uint8_t addr) {
+   if(d->cfg.speed > 0) return;
+
+   if(addr == LSM303D_STATUS_M) {
+      if(!(d->regs[LSM303D_STATUS_M] & LSM303D_ZYXMDA) && isfinite(d->next_m)) {
+         d->now = d->next_m;
+         sim_catchup(d);
+      }
+   }
+   else if(addr == LSM303D_STATUS_A && !sim_fifo_active(d)) {
+      if(!(d->regs[LSM303D_STATUS_A] & LSM303D_ZYXADA) && isfinite(d->next_a)) {
+         d->now = d->next_a;
+         sim_catchup(d);
+      }
+   }
+   else if(addr == LSM303D_FIFO_SRC && sim_fifo_active(d)) {
+      int target = 1;
+      if(d->regs[LSM303D_CTRL0] & LSM303D_CTRL0_FTH_EN)
+         target = d->regs[LSM303D_FIFO_CTRL] & LSM303D_FTH_MASK;
+      if(target < 1) target = 1;
+      while(d->fifo_count < target && isfinite(d->next_a)) {
+         d->now = d->next_a;
+         sim_catchup(d);
+      }
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * sim_getreg() returns one register byte, applying the read    *
+ * side effects: FIFO_SRC is computed, accel output registers   *
+ * show the oldest FIFO sample while the FIFO is active, and    *
+ * reading the Z high byte clears the data-ready status (and    *
+ * pops the FIFO).                                              *
+ * ------------------------------------------------------------ */
+static uint8_t sim_getreg(struct simdev *d, uint8_t addr) {
+   uint8_t val = d->regs[addr];
+
+   if(addr == LSM303D_STATUS_M || addr == LSM303D_STATUS_A || addr == LSM303D_FIFO_SRC) {
+      sim_wait(d, addr);
+      val = d->regs[addr];
+   }
+   if(addr == LSM303D_FIFO_SRC) {
+      int fth = d->regs[LSM303D_FIFO_CTRL] & LSM303D_FTH_MASK;
+      val = (d->fifo_count > LSM303D_FSS_MASK) ? LSM303D_FSS_MASK : d->fifo_count;
+      if(d->fifo_count == 0) val |= LSM303D_FIFO_EMPTY;
+      if(d->fifo_count == LSM303D_FIFO_DEPTH) val |= LSM303D_FIFO_OVRN;
+      if(d->fifo_count >= fth && d->fifo_count > 0) val |= LSM303D_FIFO_FTH;
+   }
+   else if(addr >= LSM303D_OUT_X_L_A && addr <= LSM303D_OUT_Z_H_A && sim_fifo_active(d)) {
+      int16_t v = 0;
+      int n = (addr - LSM303D_OUT_X_L_A);
+      if(d->fifo_count > 0) v = d->fifo[d->fifo_head][n / 2];
+      val = (n & 1) ? (v >> 8) & 0xFF : v & 0xFF;
+      if(addr == LSM303D_OUT_Z_H_A && d->fifo_count > 0) {
+         d->fifo_head = (d->fifo_head + 1) % LSM303D_FIFO_DEPTH;
+         d->fifo_count--;
+      }
+   }
+
+   if(addr == LSM303D_OUT_Z_H_M) d->regs[LSM303D_STATUS_M] = 0;
+   if(addr == LSM303D_OUT_Z_H_A) d->regs[LSM303D_STATUS_A] = 0;
+   return val;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_writable() returns 1 for the rw registers of the map     *
+ * ------------------------------------------------------------ */
+static int sim_writable(uint8_t addr) {
+   if(addr == 0x12 || addr == 0x14 || addr == 0x15) return 1; // INT_CTRL_M, INT_THS_M
+   if(addr >= 0x16 && addr <= LSM303D_CTRL7) return 1;        // OFFSET_M, REFERENCE, CTRL
+   if(addr == LSM303D_FIFO_CTRL) return 1;
+   if(addr == 0x30 || (addr >= 0x32 && addr <= 0x34)) return 1; // IG_CFG1/2, IG_THS1, IG_DUR1
+   if(addr >= 0x36 && addr <= 0x38) return 1;                 // IG_THS2, IG_DUR2, CLICK_CFG
+   if(addr >= 0x3A && addr <= 0x3F) return 1;                 // CLICK_THS.., ACT_THS, ACT_DUR
+   return 0;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_read() transport read: auto-increments for len > 1, with *
+ * the FIFO rollover from OUT_Z_H_A back to OUT_X_L_A, so the   *
+ * whole FIFO content can be drained in a single burst.         *
+ * ------------------------------------------------------------ */
+static int sim_read(void *priv, uint8_t reg, uint8_t *buf, uint16_t len) {
+   struct simdev *d = priv;
+   uint8_t addr = reg & (LSM303D_REGMAP_SIZE - 1);
+
+   pthread_mutex_lock(&d->lock);
+   sim_update(d);
+   if(sim_nack(d)) {
+      pthread_mutex_unlock(&d->lock);
+      return(-1);
+   }
+   for(int i=0; i<len; i++) {
+      buf[i] = sim_getreg(d, addr);
+      if(len == 1) break;
+      if(addr == LSM303D_OUT_Z_H_A && sim_fifo_active(d)) addr = LSM303D_OUT_X_L_A;
+      else addr = (addr + 1) & (LSM303D_REGMAP_SIZE - 1);
+   }
+   pthread_mutex_unlock(&d->lock);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_write() transport write: stores the rw registers, then   *
+ * applies BOOT, FIFO reset and ODR/mode changes.               *
+ * ------------------------------------------------------------ */
+static int sim_write(void *priv, uint8_t reg, const uint8_t *buf, uint16_t len) {
+   struct simdev *d = priv;
+   uint8_t addr = reg & (LSM303D_REGMAP_SIZE - 1);
+
+   pthread_mutex_lock(&d->lock);
+   sim_update(d);
+   if(sim_nack(d)) {
+      pthread_mutex_unlock(&d->lock);
+      return(-1);
+   }
+   for(int i=0; i<len; i++) {
+      if(sim_writable(addr)) d->regs[addr] = buf[i];
+      addr = (addr + 1) & (LSM303D_REGMAP_SIZE - 1);
+   }
+   d->regs[LSM303D_CTRL0] &= ~LSM303D_CTRL0_BOOT;  // reboot completes at once
+   if(!sim_fifo_active(d)) {                       // bypass mode resets the FIFO
+      d->fifo_head  = 0;
+      d->fifo_count = 0;
+   }
+   sim_retime(d);
+   pthread_mutex_unlock(&d->lock);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_reset() transport reset: ends the current NACK burst     *
+ * ------------------------------------------------------------ */
+static int sim_reset(void *priv) {
+   struct simdev *d = priv;
+   pthread_mutex_lock(&d->lock);
+   d->nack_left = 0;
+   pthread_mutex_unlock(&d->lock);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_close() frees the simulator                              *
+ * ------------------------------------------------------------ */
+static void sim_close(void *priv) {
+   struct simdev *d = priv;
+   pthread_mutex_destroy(&d->lock);
+   free(d);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_open() creates a simulated LSM303D in power-on state and *
+ * returns its transport, or NULL on error. cfg NULL = defaults *
+ * ------------------------------------------------------------ */
+struct lsm303d_transport *sim_open(const struct lsm303d_simcfg *cfg) {
+   struct simdev *d = calloc(1, sizeof(struct simdev));
+   if(d == NULL) return NULL;
+
+   if(cfg != NULL) d->cfg = *cfg;
+   else sim_defaults(&d->cfg);
+   d->irq_fd[0] = d->irq_fd[1] = -1;
+   pthread_mutex_init(&d->lock, NULL);
+   d->rng = (d->cfg.seed * 2654435761u) ^ 0x9E3779B9u;  // spread small seeds
+   if(d->rng == 0) d->rng = 1;
+   d->frng = d->rng ^ 0x5BD1E995u;
+   if(d->frng == 0) d->frng = 1;
+   d->t0  = sim_clock();
+   d->now = 0;
+   d->next_brown = d->cfg.brownout;
+   sim_boot(d);
+
+   d->tp.name       = "sim";
+   d->tp.read_regs  = sim_read;
+   d->tp.write_regs = sim_write;
+   d->tp.reset      = sim_reset;
+   d->tp.close      = sim_close;
+   d->tp.priv       = d;
+   if(verbose == 1) printf("Debug: Simulated LSM303D speed [%.2f]\n", d->cfg.speed);
+   if(verbose == 1 && (d->cfg.nack_rate > 0 || d->cfg.brownout > 0))
+      printf("Debug: Simulated faults: NACK rate [%g] burst [%d] brown-out every [%g] s\n",
+             d->cfg.nack_rate, d->cfg.nack_len, d->cfg.brownout);
+   return &d->tp;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_irq_thread() runs the sensor clock in real time mode: it *
+ * sleeps until the next sample is due and updates the model,  *
+ * which raises the INT edges. Sleeps are capped at 10ms so ODR *
+ * changes are picked up before a 1600 Hz FIFO fills up, and    *
+ * the stop request is seen.                                    *
+ * ------------------------------------------------------------ */
+static void *sim_irq_thread(void *arg) {
+   struct simirq *irq = arg;
+   struct simdev *d = irq->d;
+
+   while(!__atomic_load_n(&irq->stop, __ATOMIC_ACQUIRE)) {
+      pthread_mutex_lock(&d->lock);
+      sim_update(d);
+      double next = (d->next_a < d->next_m) ? d->next_a : d->next_m;
+      double wake = d->t0 + next / d->cfg.speed;
+      pthread_mutex_unlock(&d->lock);
+
+      double now = sim_clock();
+      if(!(wake < now + 0.01)) wake = now + 0.01;
+      struct timespec ts;
+      ts.tv_sec  = (time_t) wake;
+      ts.tv_nsec = (long) ((wake - ts.tv_sec) * 1e9);
+      while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+   }
+   return NULL;
+}
+
+/* ------------------------------------------------------------ *
+ * sim_irq_ack() consumes the eventfd count. In virtual time it *
+ * re-arms the line right away.                                 *
+ * ------------------------------------------------------------ */
+static int sim_irq_ack(void *priv) {
+   struct simirq *irq = priv;
+   uint64_t count;
+   if(read(irq->line.fd, &count, sizeof(count)) != sizeof(count)) return(-1);
+   if(irq->d->cfg.speed <= 0) {
+      count = 1;
+      if(write(irq->line.fd, &count, sizeof(count)) != sizeof(count)) return(-1);
+   }
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_irq_close() stops the clock thread and closes the line   *
+ * ------------------------------------------------------------ */
+static void sim_irq_close(void *priv) {
+   struct simirq *irq = priv;
+   if(irq->running) {
+      __atomic_store_n(&irq->stop, 1, __ATOMIC_RELEASE);
+      pthread_join(irq->thread, NULL);
+   }
+   pthread_mutex_lock(&irq->d->lock);
+   irq->d->irq_fd[irq->pin - 1] = -1;
+   pthread_mutex_unlock(&irq->d->lock);
+   close(irq->line.fd);
+   free(irq);
+}
+
+/* ------------------------------------------------------------ *
+ * sim_irq_open() creates the eventfd stand-in for the INT pin  *
+ * (1 or 2) of a simulated sensor, returns NULL on error.       *
+ * ------------------------------------------------------------ */
+struct lsm303d_irqline *sim_irq_open(struct lsm303d_transport *tp, int pin) {
+   if(tp == NULL || tp->read_regs != sim_read) {
+      printf("Error: simulated interrupt line requires the simulated sensor (-b sim).\n");
+      return NULL;
+   }
+   if(pin != 1 && pin != 2) return NULL;
+
+   struct simirq *irq = calloc(1, sizeof(struct simirq));
+   if(irq == NULL) return NULL;
+   irq->d   = tp->priv;
+   irq->pin = pin;
+   if((irq->line.fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+      printf("Error: could not create the simulated interrupt line.\n");
+      free(irq);
+      return NULL;
+   }
+   irq->line.name  = "sim";
+   irq->line.ack   = sim_irq_ack;
+   irq->line.close = sim_irq_close;
+   irq->line.priv  = irq;
+
+   pthread_mutex_lock(&irq->d->lock);
+   irq->d->irq_fd[pin - 1] = irq->line.fd;
+   pthread_mutex_unlock(&irq->d->lock);
+
+   if(irq->d->cfg.speed <= 0) {
+      uint64_t one = 1;
+      if(write(irq->line.fd, &one, sizeof(one)) != sizeof(one)) {
+         sim_irq_close(irq);
+         return NULL;
+      }
+   }
+   else if(pthread_create(&irq->thread, NULL, sim_irq_thread, irq) != 0) {
+      printf("Error: could not start the simulated interrupt thread.\n");
+      sim_irq_close(irq);
+      return NULL;
+   }
+   else irq->running = 1;
+   return &irq->line;
+}
@@ -0,0 +1,316 @@
+/* ------------------------------------------------------------ *
+ * file:        srv_lsm303d.c                                   *
+ * purpose:     Unix domain socket server for the -S option.    *
+ *              One epoll loop accepts subscribers, reads their *
+ *              "SUB" commands and writes the decimated samples *
+ *              from per-client queues with writev(). Sockets   *
+ *              are non-blocking, a slow client costs queue     *
+ *              space, never acquisition time.                  *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#define _GNU_SOURCE             // accept4()
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "lsm303d.h"
+
+#define QMASK (LSM303D_SRV_QUEUE - 1)
+
+/* ------------------------------------------------------------ *
+ * srv_drop() disconnects client slot i                         *
+ * ------------------------------------------------------------ */
+static void srv_drop(struct lsm303d_srv *srv, int i) {
+   struct lsm303d_client *c = srv->client[i];
+   if(verbose == 1) printf("Debug: Client fd %d closed, %llu samples, %llu skipped\n",
+                            c->fd, (unsigned long long) c->sent, (unsigned long long) c->skipped);
+   close(c->fd);       // also removes it from the epoll set
+   free(c);
+   srv->client[i] = NULL;
+   srv->nclients--;
+}
+
+/* ------------------------------------------------------------ *
+ * srv_pollout() switches the EPOLLOUT interest of a client     *
+ * ------------------------------------------------------------ */
+static void srv_pollout(struct lsm303d_srv *srv, struct lsm303d_client *c, int on) {
+   if(c->pollout == on) return;
+   struct epoll_event ev = { .events = EPOLLIN | (on ? EPOLLOUT : 0), .data.ptr = c };
+   epoll_ctl(srv->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+   c->pollout = on;
+}
+
+/* ------------------------------------------------------------ *
+ * srv_flush() writes the queue of a client, both parts of a    *
+ * wrapped queue in one writev(). Returns 0, or -1 if the       *
+ * client is gone.                                              *
+ * ------------------------------------------------------------ */
+static int srv_flush(struct lsm303d_srv *srv, struct lsm303d_client *c) {
+   while(c->head != c->tail) {
+      uint32_t pos = c->head & QMASK;
+      uint32_t len = c->tail - c->head;
+      struct iovec iov[2];
+      int n = 1;
+      iov[0].iov_base = &c->queue[pos];
+      iov[0].iov_len = len;
+      if(pos + len > LSM303D_SRV_QUEUE) {
+         iov[0].iov_len = LSM303D_SRV_QUEUE - pos;
+         iov[1].iov_base = c->queue;
+         iov[1].iov_len = len - iov[0].iov_len;
+         n = 2;
+      }
+      ssize_t res = writev(c->fd, iov, n);
+      srv->writes++;
+      if(res < 0) {
+         if(errno == EINTR) continue;
+         if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            srv_pollout(srv, c, 1);
+            return(0);
+         }
+         return(-1);
+      }
+      c->head += res;
+   }
+   c->skipping = 0;
+   srv_pollout(srv, c, 0);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * srv_command() executes a client command line. Returns 0, or  *
+ * -1 for an invalid command.                                   *
+ * ------------------------------------------------------------ */
+static int srv_command(struct lsm303d_srv *srv, struct lsm303d_client *c, char *line) {
+   char cmd[8] = "", format[8] = "bin", policy[8] = "skip";
+   float hz = 0;
+   if(sscanf(line, "%7s %f %7s %7s", cmd, &hz, format, policy) < 2
+      || strcmp(cmd, "SUB") != 0 || hz < 0) return(-1);
+   if(strcmp(format, "bin") == 0) c->format = LSM303D_SRV_BIN;
+   else if(strcmp(format, "text") == 0) c->format = LSM303D_SRV_TEXT;
+   else return(-1);
+   if(strcmp(policy, "skip") == 0) c->policy = LSM303D_SRV_SKIP;
+   else if(strcmp(policy, "drop") == 0) c->policy = LSM303D_SRV_DROP;
+   else return(-1);
+   c->interval = (hz > 0) ? (uint64_t) (1e9 / hz) : 0;
+   c->next = 0;
+   if(verbose == 1) printf("Debug: Client fd %d SUB %.3f Hz %s %s\n", c->fd, hz, format, policy);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * srv_read() reads command lines from a client. Returns 0, or  *
+ * -1 if the client closed or sent an invalid command.          *
+ * ------------------------------------------------------------ */
+static int srv_read(struct lsm303d_srv *srv, struct lsm303d_client *c) {
+   char buf[256];
+   ssize_t n;
+   while((n = read(c->fd, buf, sizeof(buf))) > 0) {
+      for(int i=0; i<n; i++) {
+         if(buf[i] == '\r') continue;
+         if(buf[i] != '\n') {
+            if(c->cmdlen >= (int) sizeof(c->cmd) - 1) return(-1);
+            c->cmd[c->cmdlen++] = buf[i];
+            continue;
+         }
+         c->cmd[c->cmdlen] = '\0';
+         c->cmdlen = 0;
+         if(srv_command(srv, c, c->cmd) != 0) {
+            if(verbose == 1) printf("Debug: Client fd %d invalid command [%s]\n", c->fd, c->cmd);
+            return(-1);
+         }
+      }
+   }
+   if(n == 0) return(-1);
+   return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+}
+
+/* ------------------------------------------------------------ *
+ * srv_accept() takes all pending connections                   *
+ * ------------------------------------------------------------ */
+static void srv_accept(struct lsm303d_srv *srv) {
+   int fd;
+   while((fd = accept4(srv->lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+      int i;
+      for(i=0; i<LSM303D_SRV_CLIENTS && srv->client[i] != NULL; i++);
+      struct lsm303d_client *c = (i < LSM303D_SRV_CLIENTS) ? malloc(sizeof(*c)) : NULL;
+      if(c == NULL) {
+         if(verbose == 1) printf("Debug: Client refused, %d clients connected\n", srv->nclients);
+         close(fd);
+         continue;
+      }
+      memset(c, 0, offsetof(struct lsm303d_client, queue));
+      c->fd = fd;
+      struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+      if(epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+         close(fd);
+         free(c);
+         continue;
+      }
+      srv->client[i] = c;
+      srv->nclients++;
+      srv->accepted++;
+      if(verbose == 1) printf("Debug: Client fd %d connected, %d clients\n", fd, srv->nclients);
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * srv_create() listens on the socket path for a sample period  *
+ * in ns. A socket with a live server behind it is not taken    *
+ * over, a stale one is replaced. Returns 0, or -1 on error.    *
+ * ------------------------------------------------------------ */
+int srv_create(struct lsm303d_srv *srv, const char *path, uint64_t period) {
+   struct sockaddr_un addr;
+   memset(srv, 0, sizeof(struct lsm303d_srv));
+   srv->lfd = srv->epfd = -1;
+   srv->period = period;
+
+   if(strlen(path) >= sizeof(addr.sun_path)) {
+      printf("Error: socket path %s too long.\n", path);
+      return(-1);
+   }
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, path);
+   strcpy(srv->path, path);
+
+   int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+   if(fd >= 0 && connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+      printf("Error: a server already listens on %s\n", path);
+      close(fd);
+      return(-1);
+   }
+   if(fd >= 0) close(fd);
+   unlink(path);
+
+   srv->lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if(srv->lfd < 0 || bind(srv->lfd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+      || listen(srv->lfd, LSM303D_SRV_CLIENTS) != 0) {
+      printf("Error: could not listen on socket %s\n", path);
+      if(srv->lfd >= 0) close(srv->lfd);
+      return(-1);
+   }
+   srv->epfd = epoll_create1(EPOLL_CLOEXEC);
+   struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+   if(srv->epfd < 0 || epoll_ctl(srv->epfd, EPOLL_CTL_ADD, srv->lfd, &ev) != 0) {
+      printf("Error: could not create the server event loop.\n");
+      srv_close(srv);
+      return(-1);
+   }
+   signal(SIGPIPE, SIG_IGN);    // a closed client shows up as EPIPE
+   if(verbose == 1) printf("Debug: Server listens on [%s], %d clients max\n",
+                            path, LSM303D_SRV_CLIENTS);
+   return(0);
+}
+
+/* ------------------------------------------------------------ *
+ * srv_publish() queues sample number n to every client that is *
+ * due for one. A sample up to half a period early counts as on *
+ * time, so jitter does not alias the client rate. Nothing is   *
+ * written here, srv_wait() flushes the queues.                 *
+ * ------------------------------------------------------------ */
+void srv_publish(struct lsm303d_srv *srv, uint64_t n, const struct lsm303dsample *smp, float heading) {
+   char text[192];
+   struct lsm303d_shmsample rec;
+   int textlen = -1;
+   uint64_t slack = srv->period / 2;
+
+   for(int i=0; i<LSM303D_SRV_CLIENTS; i++) {
+      struct lsm303d_client *c = srv->client[i];
+      if(c == NULL || c->interval == 0 || smp->ts + slack < c->next) continue;
+      c->next += c->interval;
+      if(c->next + slack <= smp->ts) c->next = smp->ts + c->interval; // after a gap
+
+      const void *data = &rec;
+      uint32_t len = sizeof(rec);
+      if(c->format == LSM303D_SRV_TEXT) {
+         if(textlen < 0) {
+            int64_t ts = (int64_t) smp->ts + srv->rt_offset;
+            textlen = snprintf(text, sizeof(text), "%lld.%06lld,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.1f,%.2f\n",
+                               (long long) (ts / 1000000000LL), (long long) (ts % 1000000000LL) / 1000,
+                               smp->mag.X, smp->mag.Y, smp->mag.Z, smp->acc.X, smp->acc.Y, smp->acc.Z,
+                               smp->temp, heading);
+         }
+         data = text;
+         len = textlen;
+      }
+      else {
+         rec.n = n;
+         rec.smp = *smp;
+         rec.heading = heading;
+      }
+
+      if(c->skipping || LSM303D_SRV_QUEUE - (c->tail - c->head) < len) {
+         if(c->policy == LSM303D_SRV_DROP) {
+            srv->dropped++;
+            srv_drop(srv, i);
+            continue;
+         }
+         c->skipping = 1;
+         c->skipped++;
+         continue;
+      }
+      uint32_t pos = c->tail & QMASK;
+      uint32_t first = (pos + len > LSM303D_SRV_QUEUE) ? LSM303D_SRV_QUEUE - pos : len;
+      memcpy(&c->queue[pos], data, first);
+      memcpy(c->queue, (const uint8_t *) data + first, len - first);
+      c->tail += len;
+      c->sent++;
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * srv_wait() flushes the client queues, then serves socket     *
+ * events for up to timeout ms. It replaces the idle sleep of   *
+ * the -c consumer loop. Returns the number of events.          *
+ * ------------------------------------------------------------ */
+int srv_wait(struct lsm303d_srv *srv, int timeout) {
+   struct epoll_event ev[16];
+
+   for(int i=0; i<LSM303D_SRV_CLIENTS; i++) {
+      struct lsm303d_client *c = srv->client[i];
+      if(c != NULL && !c->pollout && c->head != c->tail && srv_flush(srv, c) != 0)
+         srv_drop(srv, i);
+   }
+
+   int n = epoll_wait(srv->epfd, ev, 16, timeout);
+   for(int e=0; e<n; e++) {
+      struct lsm303d_client *c = ev[e].data.ptr;
+      if(c == NULL) {
+         srv_accept(srv);
+         continue;
+      }
+      int i;
+      for(i=0; i<LSM303D_SRV_CLIENTS && srv->client[i] != c; i++);
+      if(i == LSM303D_SRV_CLIENTS) continue;    // dropped by an earlier event
+      int res = 0;
+      if(ev[e].events & (EPOLLERR | EPOLLHUP)) res = -1;
+      if(res == 0 && (ev[e].events & EPOLLIN)) res = srv_read(srv, c);
+      if(res == 0 && (ev[e].events & EPOLLOUT)) res = srv_flush(srv, c);
+      if(res != 0) srv_drop(srv, i);
+   }
+   return (n > 0) ? n : 0;
+}
+
+/* ------------------------------------------------------------ *
+ * srv_close() disconnects all clients and removes the socket   *
+ * ------------------------------------------------------------ */
+void srv_close(struct lsm303d_srv *srv) {
+   for(int i=0; i<LSM303D_SRV_CLIENTS; i++)
+      if(srv->client[i] != NULL) srv_drop(srv, i);
+   if(srv->epfd >= 0) close(srv->epfd);
+   if(srv->lfd >= 0) {
+      close(srv->lfd);
+      unlink(srv->path);
+   }
+   srv->lfd = srv->epfd = -1;
+}
@@ -0,0 +1,226 @@
+/* ------------------------------------------------------------ *
+ * file:        stats_lsm303d.c                                 *
+ * purpose:     Hot path statistics: transaction, byte, retry,  *
+ *              overrun and missed deadline counters, and log2  *
+ *              latency histograms of the bus transfers and of  *
+ *              the samples from read to output. Every thread   *
+ *              writes its own slot with plain relaxed stores,  *
+ *              snapshots sum the slots, for a text dump or a   *
+ *              JSON file.                                      *
+ *                                                              *
+ * author:      15/10/2026 Frank4DD                             *
+ * ------------------------------------------------------------ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "lsm303d.h"
+
+/* ------------------------------------------------------------ *
+ * One slot per thread. A slot has a single writer, the relaxed *
+ * store keeps the 64 bit values untorn for the reader, also on *
+ * 32 bit ARM. The last slot takes all threads beyond the slots *
+ * and is updated with atomic adds, so no update gets lost.     *
+ * ------------------------------------------------------------ */
+#define STAT_ADD(x, n) do {                                          \
+   if(shared) __atomic_fetch_add(&(x), (n), __ATOMIC_RELAXED);       \
+   else __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED);         \
+} while(0)
+
+static struct lsm303d_stats slots[LSM303D_STATS_THREADS];
+static int nslots = 0;
+static __thread struct lsm303d_stats *self = NULL;
+static __thread int shared = 0;   // 1 if self is the shared last slot
+
+/* ------------------------------------------------------------ *
+ * stats_self() returns the slot of the calling thread, taking  *
+ * the next free one on the first call.                         *
+ * ------------------------------------------------------------ */
+static struct lsm303d_stats *stats_self() {
+   if(self == NULL) {
+      int n = __atomic_fetch_add(&nslots, 1, __ATOMIC_RELAXED);
+      if(n >= LSM303D_STATS_THREADS - 1) {
+         n = LSM303D_STATS_THREADS - 1;
+         shared = 1;
+      }
+      self = &slots[n];
+   }
+   return self;
+}
+
+/* ------------------------------------------------------------ *
+ * hist_add() records a latency of ns nanoseconds               *
+ * ------------------------------------------------------------ */
+static void hist_add(struct lsm303d_hist *h, uint64_t ns) {
+   int b = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+   if(b >= LSM303D_HIST_BUCKETS) b = LSM303D_HIST_BUCKETS - 1;
+   STAT_ADD(h->bucket[b], 1);
+   STAT_ADD(h->count, 1);
+   STAT_ADD(h->sum, ns);
+   uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+   while(ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 1,
+                                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* ------------------------------------------------------------ *
+ * The counting functions of the transport, fault recovery,     *
+ * acquisition and output paths.                                *
+ * ------------------------------------------------------------ */
+void stats_xfer(int write, uint16_t len, uint64_t ns, int res) {
+   struct lsm303d_stats *s = stats_self();
+   STAT_ADD(s->transactions, 1);
+   if(res != 0) STAT_ADD(s->errors, 1);
+   else if(write) STAT_ADD(s->bytes_wr, len);
+   else STAT_ADD(s->bytes_rd, len);
+   hist_add(&s->bus, ns);
+}
+
+void stats_retry() {
+   STAT_ADD(stats_self()->retries, 1);
+}
+
+void stats_overrun(uint8_t status_m, uint8_t status_a) {
+   struct lsm303d_stats *s = stats_self();
+   if(status_m & LSM303D_ZYXMOR) STAT_ADD(s->ovr_m, 1);
+   if(status_a & LSM303D_ZYXAOR) STAT_ADD(s->ovr_a, 1);
+}
+
+void stats_missed(uint64_t n) {
+   STAT_ADD(stats_self()->missed, n);
+}
+
+void stats_sample(uint64_t ts) {
+   struct lsm303d_stats *s = stats_self();
+   uint64_t now = mono_ns();
+   STAT_ADD(s->samples, 1);
+   hist_add(&s->e2e, (now > ts) ? now - ts : 0);
+}
+
+/* ------------------------------------------------------------ *
+ * stats_sum() adds up all slots into out. Slots are read while *
+ * their threads run, so the sum is a near-instant snapshot.    *
+ * ------------------------------------------------------------ */
+static void hist_sum(struct lsm303d_hist *out, const struct lsm303d_hist *h) {
+   out->count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+   out->sum   += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+   uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+   if(max > out->max) out->max = max;
+   for(int b=0; b<LSM303D_HIST_BUCKETS; b++)
+      out->bucket[b] += __atomic_load_n(&h->bucket[b], __ATOMIC_RELAXED);
+}
+
+void stats_sum(struct lsm303d_stats *out) {
+   int n = __atomic_load_n(&nslots, __ATOMIC_RELAXED);
+   if(n > LSM303D_STATS_THREADS) n = LSM303D_STATS_THREADS;
+   memset(out, 0, sizeof(struct lsm303d_stats));
+   for(int i=0; i<n; i++) {
+      const struct lsm303d_stats *s = &slots[i];
+      out->transactions += __atomic_load_n(&s->transactions, __ATOMIC_RELAXED);
+      out->bytes_rd     += __atomic_load_n(&s->bytes_rd, __ATOMIC_RELAXED);
+      out->bytes_wr     += __atomic_load_n(&s->bytes_wr, __ATOMIC_RELAXED);
+      out->errors       += __atomic_load_n(&s->errors, __ATOMIC_RELAXED);
+      out->retries      += __atomic_load_n(&s->retries, __ATOMIC_RELAXED);
+      out->ovr_m        += __atomic_load_n(&s->ovr_m, __ATOMIC_RELAXED);
+      out->ovr_a        += __atomic_load_n(&s->ovr_a, __ATOMIC_RELAXED);
+      out->missed       += __atomic_load_n(&s->missed, __ATOMIC_RELAXED);
+      out->samples      += __atomic_load_n(&s->samples, __ATOMIC_RELAXED);
+      hist_sum(&out->bus, &s->bus);
+      hist_sum(&out->e2e, &s->e2e);
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * hist_pct() returns the upper bound in ns of the bucket that  *
+ * holds the p quantile (0..1), at most the maximum, 0 for an   *
+ * empty histogram.                                             *
+ * ------------------------------------------------------------ */
+static uint64_t hist_pct(const struct lsm303d_hist *h, double p) {
+   if(h->count == 0) return 0;
+   uint64_t rank = (uint64_t) (p * (h->count - 1)) + 1, n = 0;
+   int b;
+   for(b=0; b<LSM303D_HIST_BUCKETS; b++) {
+      n += h->bucket[b];
+      if(n >= rank) break;
+   }
+   if(b == LSM303D_HIST_BUCKETS) return h->max;
+   uint64_t top = (b == 0) ? 0 : (1ULL << b) - 1;
+   return (top < h->max) ? top : h->max;
+}
+
+/* ------------------------------------------------------------ *
+ * hist_print() prints the summary and the non-empty buckets    *
+ * ------------------------------------------------------------ */
+static void hist_print(const char *name, const struct lsm303d_hist *h) {
+   printf("%s: %llu, avg %.1f us, p50 <= %.1f us, p99 <= %.1f us, p99.9 <= %.1f us, max %.1f us\n",
+          name, (unsigned long long) h->count, h->count ? h->sum / 1e3 / h->count : 0.0,
+          hist_pct(h, 0.5) / 1e3, hist_pct(h, 0.99) / 1e3, hist_pct(h, 0.999) / 1e3,
+          h->max / 1e3);
+   for(int b=0; b<LSM303D_HIST_BUCKETS; b++) {
+      if(h->bucket[b] == 0) continue;
+      printf("   %12.1f us .. %12.1f us %10llu\n", (b == 0) ? 0.0 : (1ULL << (b - 1)) / 1e3,
+             (1ULL << b) / 1e3, (unsigned long long) h->bucket[b]);
+   }
+}
+
+/* ------------------------------------------------------------ *
+ * stats_print() prints a snapshot as text                      *
+ * ------------------------------------------------------------ */
+void stats_print(const struct lsm303d_stats *s) {
+   printf("Stats: %llu transactions, %llu bytes read, %llu bytes written, %llu errors, "
+          "%llu retries\n", (unsigned long long) s->transactions,
+          (unsigned long long) s->bytes_rd, (unsigned long long) s->bytes_wr,
+          (unsigned long long) s->errors, (unsigned long long) s->retries);
+   printf("Stats: %llu samples, %llu mag overruns, %llu accel overruns, %llu missed deadlines\n",
+          (unsigned long long) s->samples, (unsigned long long) s->ovr_m,
+          (unsigned long long) s->ovr_a, (unsigned long long) s->missed);
+   hist_print("Bus transfer latency", &s->bus);
+   hist_print("Sample latency", &s->e2e);
+}
+
+/* ------------------------------------------------------------ *
+ * hist_json() writes a histogram as a JSON object              *
+ * ------------------------------------------------------------ */
+static void hist_json(FILE *fp, const struct lsm303d_hist *h) {
+   fprintf(fp, "{\"count\":%llu,\"sum_ns\":%llu,\"max_ns\":%llu,\"p50_ns\":%llu,"
+           "\"p99_ns\":%llu,\"p999_ns\":%llu,\"buckets\":[", (unsigned long long) h->count,
+           (unsigned long long) h->sum, (unsigned long long) h->max,
+           (unsigned long long) hist_pct(h, 0.5), (unsigned long long) hist_pct(h, 0.99),
+           (unsigned long long) hist_pct(h, 0.999));
+   for(int b=0; b<LSM303D_HIST_BUCKETS; b++)
+      fprintf(fp, "%s%llu", b ? "," : "", (unsigned long long) h->bucket[b]);
+   fprintf(fp, "]}");
+}
+
+/* ------------------------------------------------------------ *
+ * stats_write() writes a snapshot as JSON to file. It goes to  *
+ * file.tmp first and is renamed, so readers never see a half   *
+ * written snapshot. Returns 0 on success, -1 on error.         *
+ * ------------------------------------------------------------ */
+int stats_write(const struct lsm303d_stats *s, const char *file) {
+   char tmp[512];
+   snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+   FILE *fp = fopen(tmp, "w");
+   if(fp == NULL) {
+      printf("Error: could not create stats file %s\n", tmp);
+      return(-1);
+   }
+   fprintf(fp, "{\"time_ns\":%llu,\"pid\":%d,\"transactions\":%llu,\"bytes_rd\":%llu,"
+           "\"bytes_wr\":%llu,\"errors\":%llu,\"retries\":%llu,\"samples\":%llu,"
+           "\"ovr_m\":%llu,\"ovr_a\":%llu,\"missed\":%llu,\n \"bus\":",
+           (unsigned long long) mono_ns(), (int) getpid(),
+           (unsigned long long) s->transactions, (unsigned long long) s->bytes_rd,
+           (unsigned long long) s->bytes_wr, (unsigned long long) s->errors,
+           (unsigned long long) s->retries, (unsigned long long) s->samples,
+           (unsigned long long) s->ovr_m, (unsigned long long) s->ovr_a,
+           (unsigned long long) s->missed);
+   hist_json(fp, &s->bus);
+   fprintf(fp, ",\n \"e2e\":");
+   hist_json(fp, &s->e2e);
+   fprintf(fp, "}\n");
+   if(fclose(fp) != 0 || rename(tmp, file) != 0) {
+      printf("Error: could not write stats file %s\n", file);
+      unlink(tmp);
+      return(-1);
+   }
+   return(0);
+}